@@ -0,0 +1,69 @@
+#ifndef BENCH_BENCH
+#define BENCH_BENCH
+
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+
+/*
+	Microbenchmarks
+
+	A benchmark is a function that runs its operation a given number of
+	times. The runner calibrates the count so one run takes about 100 ms,
+	then times a number of runs and reports the fastest and the median time
+	per operation. A benchmark that cannot run, for example without the
+	privileges for raw sockets, calls bench::skip.
+*/
+
+namespace bench
+{
+	typedef boost::function<void(uint64_t iterations)> function_type;
+
+	struct benchmark
+	{
+		std::string name;
+		function_type function;
+	};
+
+	inline std::vector<benchmark>& registry()
+	{
+		static std::vector<benchmark> benchmarks;
+		return benchmarks;
+	}
+
+	///@brief Registers a benchmark at static initialization, one per translation unit and name.
+	struct registrar
+	{
+		registrar(const char* name, function_type function)
+		{
+			benchmark entry = { name, function };
+			registry().push_back(entry);
+		}
+	};
+
+	///@brief Keep the compiler from optimizing a result away.
+	template <typename Value>
+	inline void keep(const Value& value)
+	{
+		asm volatile("" : : "r"(&value) : "memory");
+	}
+
+	///@brief Thrown by a benchmark that cannot run here.
+	struct skipped
+	{
+		std::string reason;
+	};
+
+	inline void skip(const std::string& reason)
+	{
+		skipped error = { reason };
+		throw error;
+	}
+}
+
+#define BENCH_CONCAT_(a, b) a##b
+#define BENCH_CONCAT(a, b) BENCH_CONCAT_(a, b)
+#define BENCHMARK(name, function) static bench::registrar BENCH_CONCAT(bench_registrar_, __LINE__)(name, function)
+
+#endif
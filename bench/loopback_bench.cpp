@@ -0,0 +1,99 @@
+#include <bench.hpp>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <boost/asio.hpp>
+#include <boost/array.hpp>
+#include <icmp_header.hpp>
+#include <ipv4_header.hpp>
+#include <packet_template.hpp>
+#include <raw.hpp>
+#include <udp_header.hpp>
+
+namespace
+{
+	///@brief One UDP probe to a closed loopback port and back as port unreachable, per operation.
+	///
+	/// A reply that does not come within the receive timeout, say because an
+	/// ICMP rate limit or a firewall ate it, ends the iteration unanswered.
+	/// Without any reply at all there is nothing to measure and the benchmark
+	/// skips.
+	void udp_round_trip(uint64_t iterations)
+	{
+		boost::asio::io_context io_context;
+		boost::system::error_code error;
+		raw::socket send_socket(io_context);
+		boost::asio::ip::icmp::socket receive_socket(io_context);
+		send_socket.open(raw::v4(), error);
+		if(!error)
+			receive_socket.open(boost::asio::ip::icmp::v4(), error);
+		if(error)
+			bench::skip("raw sockets: " + error.message());
+
+		// the blocking receive must not wait forever for a reply that was dropped
+		timeval timeout = { 0, 100000 };
+		if(::setsockopt(receive_socket.native_handle(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != 0)
+			bench::skip("receive timeout cannot be set");
+
+		boost::asio::ip::address_v4 loopback = boost::asio::ip::address_v4::loopback();
+		packet_template probe;
+		probe.udp(loopback, loopback, 40001, 33434, 0, 32);
+		raw::endpoint destination(loopback, 0);
+
+		boost::array<uint8_t, 2048> buffer;
+		uint64_t answered = 0;
+		uint64_t timed_out = 0;
+		for(uint64_t i = 0; i < iterations; ++i)
+		{
+			uint16_t identification = static_cast<uint16_t>(i % 65535 + 1);
+			probe.identification(identification);
+			send_socket.send_to(probe.buffer(), destination);
+			for(;;)
+			{
+				// asio waits again on EAGAIN, only the plain call returns when the timeout expires
+				ssize_t length = ::recv(receive_socket.native_handle(), buffer.data(), buffer.size(), 0);
+				if(length < 0)
+				{
+					++timed_out;
+					break;
+				}
+				ipv4_header_view outer(buffer.data(), static_cast<std::size_t>(length));
+				icmp_header_view icmp(outer.payload(), outer.payload_length());
+				ipv4_header_view inner(icmp.payload(), icmp.payload_length());
+				udp_header_view udp(inner.payload(), inner.payload_length());
+				if(udp.valid() && udp.source_port() == 40001 && inner.identification() == identification)
+				{
+					++answered;
+					break;
+				}
+			}
+		}
+		if(answered == 0 && timed_out > 0)
+			bench::skip("no port unreachable came back on loopback");
+		bench::keep(answered);
+	}
+
+	void udp_send(uint64_t iterations)
+	{
+		boost::asio::io_context io_context;
+		boost::system::error_code error;
+		raw::socket send_socket(io_context);
+		send_socket.open(raw::v4(), error);
+		if(error)
+			bench::skip("raw sockets: " + error.message());
+
+		// a discard port nobody listens on, the replies are left to the kernel
+		boost::asio::ip::address_v4 loopback = boost::asio::ip::address_v4::loopback();
+		packet_template probe;
+		probe.udp(loopback, loopback, 40002, 9, 0, 32);
+		raw::endpoint destination(loopback, 0);
+		for(uint64_t i = 0; i < iterations; ++i)
+		{
+			probe.identification(static_cast<uint16_t>(i % 65535 + 1));
+			send_socket.send_to(probe.buffer(), destination);
+		}
+	}
+}
+
+BENCHMARK("loopback/udp_send", udp_send);
+BENCHMARK("loopback/udp_round_trip", udp_round_trip);
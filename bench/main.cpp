@@ -0,0 +1,83 @@
+#include <bench.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sys/utsname.h>
+
+namespace
+{
+	const double target_seconds = 0.1;
+	const std::size_t runs = 7;
+
+	double time_run(const bench::function_type& function, uint64_t iterations)
+	{
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		function(iterations);
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	std::string escape(const std::string& text)
+	{
+		std::string output;
+		for(std::size_t i = 0; i < text.size(); ++i)
+		{
+			if(text[i] == '"' || text[i] == '\\')
+				output += '\\';
+			output += text[i];
+		}
+		return output;
+	}
+}
+
+// usage: routeinfo_bench [filter], only benchmarks whose name contains filter run
+int main(int argc, char* argv[])
+{
+	const char* filter = argc > 1 ? argv[1] : "";
+
+	utsname system;
+	std::memset(&system, 0, sizeof(system));
+	uname(&system);
+	std::printf("{\n\"host\": \"%s\",\n\"kernel\": \"%s\",\n\"benchmarks\": [", escape(system.nodename).c_str(), escape(system.release).c_str());
+
+	bool first = true;
+	std::vector<bench::benchmark>& benchmarks = bench::registry();
+	for(std::size_t i = 0; i < benchmarks.size(); ++i)
+	{
+		const bench::benchmark& benchmark = benchmarks[i];
+		if(benchmark.name.find(filter) == std::string::npos)
+			continue;
+
+		std::printf("%s\n{\"name\": \"%s\"", first ? "" : ",", escape(benchmark.name).c_str());
+		first = false;
+		std::fflush(stdout);
+		try
+		{
+			// grow the count until a run takes long enough to time
+			uint64_t iterations = 1;
+			double seconds = time_run(benchmark.function, iterations);
+			while(seconds < target_seconds && iterations < (uint64_t(1) << 40))
+			{
+				double factor = seconds > 0 ? std::min(10.0, std::max(2.0, 1.2 * target_seconds / seconds)) : 10.0;
+				iterations = static_cast<uint64_t>(iterations * factor);
+				seconds = time_run(benchmark.function, iterations);
+			}
+
+			std::vector<double> times;
+			for(std::size_t run = 0; run < runs; ++run)
+				times.push_back(time_run(benchmark.function, iterations) * 1e9 / iterations);
+			std::sort(times.begin(), times.end());
+			std::printf(", \"iterations\": %llu, \"runs\": %u, \"ns_per_op_min\": %.3f, \"ns_per_op_median\": %.3f, \"ops_per_second\": %.0f}",
+				static_cast<unsigned long long>(iterations), static_cast<unsigned>(runs), times.front(), times[runs / 2], 1e9 / times[runs / 2]);
+		}
+		catch(const bench::skipped& skipped)
+		{
+			std::printf(", \"skipped\": \"%s\"}", escape(skipped.reason).c_str());
+		}
+		std::fflush(stdout);
+	}
+	std::printf("\n]\n}\n");
+	return 0;
+}
@@ -0,0 +1,193 @@
+#include <bench.hpp>
+
+#include <istream>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/array.hpp>
+#include <boost/bind/bind.hpp>
+#include <checksum.hpp>
+#include <icmp_header.hpp>
+#include <ipv4_header.hpp>
+#include <packet_template.hpp>
+#include <probe_table.hpp>
+#include <tx_stats.h>
+#include <udp_header.hpp>
+
+namespace
+{
+	const boost::asio::ip::address_v4 source = boost::asio::ip::make_address_v4("192.0.2.1");
+	const boost::asio::ip::address_v4 destination = boost::asio::ip::make_address_v4("198.51.100.1");
+	const boost::asio::ip::address_v4 router = boost::asio::ip::make_address_v4("203.0.113.1");
+
+	///@brief A UDP probe as the trace engine sends it.
+	packet_template udp_probe()
+	{
+		packet_template probe;
+		probe.udp(source, destination, 40000, 33434, 0, 0);
+		probe.time_to_live(5);
+		probe.destination_port(33439);
+		probe.identification(7);
+		return probe;
+	}
+
+	///@brief A port unreachable from router quoting probe, the checksums are not checked on receive.
+	std::vector<uint8_t> unreachable(const packet_template& probe)
+	{
+		packet_template reply;
+		reply.icmp_echo(router, source, 0, 0, probe.data(), probe.size());
+		std::vector<uint8_t> data(reply.data(), reply.data() + reply.size());
+		data[packet_template::ip_size] = icmp_header::destination_unreachable;
+		data[packet_template::ip_size + 1] = 3;
+		return data;
+	}
+
+	void parse_views(uint64_t iterations)
+	{
+		std::vector<uint8_t> reply = unreachable(udp_probe());
+		uint64_t sum = 0;
+		for(uint64_t i = 0; i < iterations; ++i)
+		{
+			ipv4_header_view outer(&reply[0], reply.size());
+			icmp_header_view icmp(outer.payload(), outer.payload_length());
+			ipv4_header_view inner(icmp.payload(), icmp.payload_length());
+			udp_header_view udp(inner.payload(), inner.payload_length());
+			if(outer.valid() && icmp.valid() && inner.valid() && udp.valid())
+				sum += udp.source_port() + inner.identification() + outer.source_address().to_uint();
+			bench::keep(reply);
+		}
+		bench::keep(sum);
+	}
+
+	void parse_streams(uint64_t iterations)
+	{
+		// the copying parse through std::istream the first probes were written with
+		std::vector<uint8_t> reply = unreachable(udp_probe());
+		uint64_t sum = 0;
+		for(uint64_t i = 0; i < iterations; ++i)
+		{
+			boost::asio::streambuf buffer;
+			buffer.commit(boost::asio::buffer_copy(buffer.prepare(reply.size()), boost::asio::buffer(reply)));
+			std::istream is(&buffer);
+			ipv4_header outer, inner;
+			icmp_header icmp;
+			udp_header udp;
+			if(is >> outer >> icmp >> inner >> udp)
+				sum += udp.source_port() + inner.identification() + outer.source_address().to_uint();
+		}
+		bench::keep(sum);
+	}
+
+	void build_patched(uint64_t iterations)
+	{
+		// what udp_tx::transmit does per packet
+		packet_template packet;
+		packet.udp(source, destination, 12345, 33434, 0, 32);
+		packet.time_to_live(5);
+		for(uint64_t i = 0; i < iterations; ++i)
+		{
+			packet.identification(static_cast<uint16_t>(i | 1));
+			bench::keep(*packet.data());
+		}
+	}
+
+	void build_full(uint64_t iterations)
+	{
+		packet_template packet;
+		for(uint64_t i = 0; i < iterations; ++i)
+		{
+			packet.udp(source, destination, 12345, 33434, 0, 32);
+			packet.time_to_live(5);
+			bench::keep(*packet.data());
+		}
+	}
+
+	void checksum(uint64_t iterations, std::size_t length)
+	{
+		std::vector<uint8_t> data(length);
+		for(std::size_t i = 0; i < length; ++i)
+			data[i] = static_cast<uint8_t>(i * 31 + 7);
+		uint32_t sum = 0;
+		for(uint64_t i = 0; i < iterations; ++i)
+		{
+			sum += internet_checksum(&data[0], length);
+			bench::keep(data);
+		}
+		bench::keep(sum);
+	}
+
+	void checksum_incremental(uint64_t iterations)
+	{
+		uint16_t checksum = 0x1234;
+		for(uint64_t i = 0; i < iterations; ++i)
+			checksum = checksum_adjust(checksum, static_cast<uint16_t>(i), static_cast<uint16_t>(i + 1));
+		bench::keep(checksum);
+	}
+
+	void match_probe_table(uint64_t iterations)
+	{
+		// the trace engine path: parse the reply, take the probe it quotes, the next burst inserts it again
+		const std::size_t probes = 1000 * 30;
+		probe_table table(probes);
+		probe_table::time_point now = boost::asio::chrono::steady_clock::now();
+		for(std::size_t i = 0; i < probes; ++i)
+			table.insert(probe_table::udp_key(static_cast<uint16_t>(32768 + i / 30), static_cast<uint16_t>(33435 + i % 30), 7), now, static_cast<uint8_t>(i % 30 + 1), static_cast<uint32_t>(i / 30));
+
+		std::vector<std::vector<uint8_t> > replies;
+		for(std::size_t i = 0; i < 256; ++i)
+		{
+			packet_template probe;
+			probe.udp(source, destination, static_cast<uint16_t>(32768 + i), 33434, 0, 0);
+			probe.destination_port(static_cast<uint16_t>(33435 + i % 30));
+			probe.identification(7);
+			replies.push_back(unreachable(probe));
+		}
+
+		uint64_t found = 0;
+		for(uint64_t i = 0; i < iterations; ++i)
+		{
+			const std::vector<uint8_t>& reply = replies[i & 255];
+			ipv4_header_view outer(&reply[0], reply.size());
+			icmp_header_view icmp(outer.payload(), outer.payload_length());
+			ipv4_header_view inner(icmp.payload(), icmp.payload_length());
+			udp_header_view udp(inner.payload(), inner.payload_length());
+			if(!udp.valid())
+				continue;
+			uint64_t key = probe_table::udp_key(udp.source_port(), udp.destination_port(), inner.identification());
+			probe_table::entry probe;
+			if(table.take(key, probe))
+			{
+				++found;
+				table.insert(key, probe.sent_at, probe.ttl, probe.session);
+			}
+		}
+		bench::keep(found);
+	}
+
+	void match_flow_tracker(uint64_t iterations)
+	{
+		// the tx path: number a packet, match its reply
+		tx_counters counters;
+		flow_tracker tracker(0, 1, &counters, boost::asio::chrono::milliseconds(1000));
+		boost::asio::chrono::steady_clock::time_point now = boost::asio::chrono::steady_clock::now();
+		boost::asio::chrono::steady_clock::duration rtt;
+		for(uint64_t i = 0; i < iterations; ++i)
+		{
+			uint16_t sequence = tracker.next(now, 60);
+			tracker.reply(sequence, now, rtt);
+		}
+		bench::keep(rtt);
+	}
+}
+
+BENCHMARK("parse/reply_views", parse_views);
+BENCHMARK("parse/reply_istream", parse_streams);
+BENCHMARK("build/udp_patch_identification", build_patched);
+BENCHMARK("build/udp_full", build_full);
+BENCHMARK("checksum/20", boost::bind(checksum, boost::placeholders::_1, 20));
+BENCHMARK("checksum/64", boost::bind(checksum, boost::placeholders::_1, 64));
+BENCHMARK("checksum/576", boost::bind(checksum, boost::placeholders::_1, 576));
+BENCHMARK("checksum/1500", boost::bind(checksum, boost::placeholders::_1, 1500));
+BENCHMARK("checksum/9000", boost::bind(checksum, boost::placeholders::_1, 9000));
+BENCHMARK("checksum/adjust", checksum_incremental);
+BENCHMARK("match/probe_table", match_probe_table);
+BENCHMARK("match/flow_tracker", match_flow_tracker);
@@ -0,0 +1,38 @@
+#include <bench.hpp>
+
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <hop_writer.h>
+#include <simulated_network.h>
+#include <trace_engine.h>
+
+namespace
+{
+	const uint8_t routers = 7;
+
+	std::string target_address(uint64_t target)
+	{
+		return boost::asio::ip::address_v4(static_cast<uint32_t>((10u << 24) | (target & 0xFFFFFF))).to_string();
+	}
+
+	///@brief One probe per operation, traced by the engine through routers without delay and answered by the destination.
+	void trace_engine_probes(uint64_t iterations)
+	{
+		boost::asio::io_context io_context;
+		simulated_network::hop hop;
+		hop.delay = boost::asio::chrono::steady_clock::duration::zero();
+		hop_writer results("/dev/null");
+		// the simulated routers answer any source
+		trace_engine engine(io_context, new simulated_network(io_context, std::vector<simulated_network::hop>(routers, hop), hop), boost::asio::ip::address_v4::loopback(), trace_engine::icmp, routers + 1, 1000, 1000, 0, 1, timestamping::none, &results);
+
+		// every trace sends one probe per TTL up to the destination
+		uint64_t targets = std::max<uint64_t>(1, iterations / (routers + 1));
+		for(uint64_t target = 0; target < targets; ++target)
+			engine.add_destination(target_address(target));
+		engine.start();
+		io_context.run();
+	}
+}
+
+BENCHMARK("simulated/trace_engine", trace_engine_probes);
@@ -0,0 +1,144 @@
+#ifndef ENGINE_INCREMENTAL_TRACE
+#define ENGINE_INCREMENTAL_TRACE
+
+#include <vector>
+#include <boost/asio.hpp>
+
+/// @brief Decides which TTLs to probe to re-trace a destination whose previous path is known.
+///
+/// The first round probes a window of sentinel TTLs spread over the cached
+/// path at once. If every sentinel answers as cached the path is taken as
+/// unchanged. Otherwise the TTLs from the last agreeing sentinel on are
+/// probed a window at a time, until a hop rejoins the cached path. With
+/// destination based routing the path beyond that hop is the cached one,
+/// shifted by the difference in TTL, so only sentinels beyond it are
+/// checked again. Every divergent segment becomes a route change. A cached
+/// path that ended before the destination is probed onwards from its end,
+/// a window at a time, until the destination answers or too many hops in a
+/// row stay silent; hops found there extend the path without counting as a
+/// change. The class only does the bookkeeping, the trace_engine sends the probes it
+/// asks for and reports answers and timeouts back.
+class incremental_trace
+{
+	public:
+
+		typedef boost::asio::chrono::steady_clock::time_point time_point;
+
+		///@brief A segment of the path that differs from the cached one, starting at ttl.
+		struct change
+		{
+			uint8_t ttl;
+			std::vector<uint32_t> before;
+			std::vector<uint32_t> after;
+		};
+
+		///@brief cached holds the addresses of the previous path by TTL from 1, 0 where no hop is known.
+		incremental_trace(const std::vector<uint32_t>& cached, uint32_t destination, uint8_t max_ttl, uint8_t window);
+
+		///@brief Append the TTLs of the first round to probes.
+		void start(time_point now, std::vector<uint8_t>& probes);
+
+		///@brief An answer from address to the probe with ttl, TTLs to probe next are appended to probes.
+		void answer(uint8_t ttl, uint32_t address, time_point now, std::vector<uint8_t>& probes);
+
+		///@brief Give up on the probes sent before cutoff, TTLs to probe next are appended to probes.
+		void expire(time_point cutoff, time_point now, std::vector<uint8_t>& probes);
+
+		bool done() const
+		{
+			return phase_ == finished;
+		}
+
+		///@brief When the oldest probe in flight was sent.
+		time_point oldest() const;
+
+		///@brief The path once done, answers where probed and the cached hops elsewhere, by TTL from 1.
+		const std::vector<uint32_t>& path() const
+		{
+			return path_;
+		}
+
+		///@brief True if the hop at ttl was probed and answered.
+		bool observed(uint8_t ttl) const
+		{
+			return ttl < state_.size() && state_[ttl] == resolved && observed_[ttl] != 0;
+		}
+
+		///@brief True if a probe was sent to ttl.
+		bool probed(uint8_t ttl) const
+		{
+			return ttl < state_.size() && state_[ttl] != unprobed;
+		}
+
+		const std::vector<change>& changes() const
+		{
+			return changes_;
+		}
+
+	private:
+
+		enum phase
+		{
+			sentinels,
+			segment,
+			finished
+		};
+
+		enum probe_state
+		{
+			unprobed,
+			in_flight,
+			resolved
+		};
+
+		void send(uint8_t ttl, time_point now, std::vector<uint8_t>& probes);
+
+		void resolve(uint8_t ttl, uint32_t address, time_point now, std::vector<uint8_t>& probes);
+
+		///@brief The cached hop at ttl under the current shift, 0 if none is known.
+		uint32_t cached_at(uint16_t ttl, int shift) const;
+
+		///@brief TTL of address on the cached path, 0 if it is not on it.
+		uint8_t cached_ttl(uint32_t address) const;
+
+		///@brief True if the sentinel at ttl answered something else than the cached path under shift.
+		bool conflicts(uint8_t ttl, int shift) const;
+
+		///@brief Continue at the agreeing sentinel in front of the first one above ttl that conflicts, false if none conflicts.
+		bool next_segment(uint8_t ttl, time_point now, std::vector<uint8_t>& probes);
+
+		///@brief Probe on from the end of the cached path if it did not reach the destination, false if it did.
+		bool extend(time_point now, std::vector<uint8_t>& probes);
+
+		///@brief Walk the segment as far as answers are in.
+		void advance(time_point now, std::vector<uint8_t>& probes);
+
+		///@brief Record the segment from ttl up to the cursor, which replaced the cached hops from cached_first to cached_last.
+		void add_change(uint8_t ttl, int cached_first, int cached_last);
+
+		void finish();
+
+		std::vector<uint32_t> cached_;
+		uint32_t destination_;
+		uint8_t max_ttl_;
+		uint8_t window_;
+		phase phase_;
+		///@brief By TTL, index 0 is unused.
+		std::vector<uint8_t> state_;
+		std::vector<uint32_t> observed_;
+		std::vector<time_point> sent_;
+		std::size_t in_flight_;
+		std::vector<uint8_t> sentinels_;
+		///@brief The next TTL of the segment to look at and the highest TTL sent so far.
+		uint16_t cursor_;
+		uint16_t sent_up_to_;
+		///@brief First TTL off the cached path in the segment, 0 while the segment agrees.
+		uint8_t diverged_at_;
+		///@brief Observed TTL minus cached TTL of the path beyond each rejoin, as TTL and shift.
+		std::vector<std::pair<uint8_t, int> > shifts_;
+		uint8_t silent_;
+		std::vector<uint32_t> path_;
+		std::vector<change> changes_;
+};
+
+#endif
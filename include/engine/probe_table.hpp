@@ -0,0 +1,261 @@
+#ifndef ENGINE_PROBE_TABLE
+#define ENGINE_PROBE_TABLE
+
+#include <vector>
+#include <boost/array.hpp>
+#include <boost/asio.hpp>
+#include <boost/cstdint.hpp>
+#include <icmp_header.hpp>
+#include <ipv4_header.hpp>
+#include <udp_header.hpp>
+
+/// @brief Table of probes in flight, keyed by the header fields a reply quotes back.
+///
+/// Open addressing with linear probing over a preallocated power of two array
+/// kept at most half full, deletions shift the following entries back so no
+/// tombstones build up. The entries are also chained in the order they were
+/// sent, expiry pops from the oldest end, so lookup, removal and expiry of a
+/// probe are all constant time.
+class probe_table
+{
+	public:
+		
+		typedef boost::asio::chrono::steady_clock::time_point time_point;
+		
+		struct entry
+		{
+			uint64_t key;
+			time_point sent_at;
+			uint32_t session;
+			uint8_t ttl;
+			
+		private:
+			
+			friend class probe_table;
+			uint32_t older;
+			uint32_t newer;
+		};
+		
+		///@brief Key of an ICMP echo request.
+		static uint64_t icmp_key(uint16_t identifier, uint16_t sequence_number)
+		{
+			return (static_cast<uint64_t>(IPPROTO_ICMP) << 48) | (static_cast<uint64_t>(identifier) << 16) | sequence_number;
+		}
+		
+		///@brief Key of a UDP probe.
+		static uint64_t udp_key(uint16_t source_port, uint16_t destination_port, uint16_t identification)
+		{
+			return (static_cast<uint64_t>(IPPROTO_UDP) << 48) | (static_cast<uint64_t>(source_port) << 32) | (static_cast<uint32_t>(destination_port) << 16) | identification;
+		}
+		
+		///@brief Key of a probe as it was sent, from the copy its send stamp comes with. 0 if it is no probe.
+		static uint64_t sent_key(const ipv4_header_view& sent)
+		{
+			if(sent.protocol() == ipv4_header::protocol::udp)
+			{
+				udp_header_view udp(sent.payload(), sent.payload_length());
+				return udp.valid() ? udp_key(udp.source_port(), udp.destination_port(), sent.identification()) : 0;
+			}
+			if(sent.protocol() == ipv4_header::protocol::icmp)
+			{
+				icmp_header_view icmp(sent.payload(), sent.payload_length());
+				return icmp.valid() && icmp.type() == icmp_header::echo_request ? icmp_key(icmp.identifier(), icmp.sequence_number()) : 0;
+			}
+			return 0;
+		}
+		
+		///@brief Preallocate room for capacity probes in flight.
+		explicit probe_table(std::size_t capacity)
+		: size_(0),
+		  oldest_(none),
+		  newest_(none)
+		{
+			capacity_ = std::max<std::size_t>(1, capacity);
+			std::size_t slots = 16;
+			while(slots < capacity_ * 2)
+				slots <<= 1;
+			mask_ = slots - 1;
+			entry empty = entry();
+			slots_.assign(slots, empty);
+		}
+		
+		std::size_t size() const
+		{
+			return size_;
+		}
+		
+		std::size_t capacity() const
+		{
+			return capacity_;
+		}
+		
+		///@brief Add a probe, a probe with the same key is replaced. When full the oldest probe is dropped.
+		void insert(uint64_t key, time_point sent_at, uint8_t ttl, uint32_t session)
+		{
+			std::size_t index = locate(key);
+			if(slots_[index].key == key)
+			{
+				unlink(index);
+			}
+			else
+			{
+				if(size_ == capacity_)
+				{
+					remove(oldest_);
+					index = locate(key);
+				}
+				++size_;
+			}
+			slots_[index].key = key;
+			slots_[index].sent_at = sent_at;
+			slots_[index].ttl = ttl;
+			slots_[index].session = session;
+			link_newest(index);
+		}
+		
+		///@brief Find a probe, 0 if it is not in flight.
+		const entry* find(uint64_t key) const
+		{
+			std::size_t index = locate(key);
+			return slots_[index].key == 0 ? 0 : &slots_[index];
+		}
+
+		///@brief Replace the send time of a probe in flight, the expiry order stays that of insertion.
+		bool restamp(uint64_t key, time_point sent_at)
+		{
+			std::size_t index = locate(key);
+			if(slots_[index].key == 0)
+				return false;
+			slots_[index].sent_at = sent_at;
+			return true;
+		}
+
+		///@brief Remove a probe and hand it out, false if it is not in flight.
+		bool take(uint64_t key, entry& probe)
+		{
+			std::size_t index = locate(key);
+			if(slots_[index].key == 0)
+				return false;
+			probe = slots_[index];
+			remove(index);
+			return true;
+		}
+		
+		///@brief Drop every probe sent before cutoff, calling handler with each of them.
+		template <typename Handler>
+		std::size_t expire(time_point cutoff, Handler handler)
+		{
+			std::size_t expired = 0;
+			while(oldest_ != none && slots_[oldest_].sent_at < cutoff)
+			{
+				entry probe = slots_[oldest_];
+				remove(oldest_);
+				handler(probe);
+				++expired;
+			}
+			return expired;
+		}
+		
+		///@brief Drop every probe sent before cutoff.
+		std::size_t expire(time_point cutoff)
+		{
+			return expire(cutoff, ignore());
+		}
+
+	private:
+		
+		static const uint32_t none = 0xFFFFFFFF;
+		
+		struct ignore
+		{
+			void operator()(const entry&) const
+			{}
+		};
+		
+		static std::size_t hash(uint64_t key)
+		{
+			key ^= key >> 33;
+			key *= 0xff51afd7ed558ccdULL;
+			key ^= key >> 33;
+			key *= 0xc4ceb9fe1a85ec53ULL;
+			key ^= key >> 33;
+			return static_cast<std::size_t>(key);
+		}
+		
+		// slot holding key, or the empty slot where it would go
+		std::size_t locate(uint64_t key) const
+		{
+			std::size_t index = hash(key) & mask_;
+			while(slots_[index].key != 0 && slots_[index].key != key)
+				index = (index + 1) & mask_;
+			return index;
+		}
+		
+		void link_newest(std::size_t index)
+		{
+			slots_[index].older = newest_;
+			slots_[index].newer = none;
+			if(newest_ != none)
+				slots_[newest_].newer = static_cast<uint32_t>(index);
+			else
+				oldest_ = static_cast<uint32_t>(index);
+			newest_ = static_cast<uint32_t>(index);
+		}
+		
+		void unlink(std::size_t index)
+		{
+			entry& probe = slots_[index];
+			if(probe.older != none)
+				slots_[probe.older].newer = probe.newer;
+			else
+				oldest_ = probe.newer;
+			if(probe.newer != none)
+				slots_[probe.newer].older = probe.older;
+			else
+				newest_ = probe.older;
+		}
+		
+		// the entry moved from one slot to another, point its neighbours in the send order at it
+		void relink(std::size_t index)
+		{
+			entry& probe = slots_[index];
+			if(probe.older != none)
+				slots_[probe.older].newer = static_cast<uint32_t>(index);
+			else
+				oldest_ = static_cast<uint32_t>(index);
+			if(probe.newer != none)
+				slots_[probe.newer].older = static_cast<uint32_t>(index);
+			else
+				newest_ = static_cast<uint32_t>(index);
+		}
+		
+		void remove(std::size_t index)
+		{
+			unlink(index);
+			// backward shift: move later members of the cluster into the hole if that keeps them reachable
+			std::size_t hole = index;
+			std::size_t next = (hole + 1) & mask_;
+			while(slots_[next].key != 0)
+			{
+				std::size_t home = hash(slots_[next].key) & mask_;
+				if(((next - home) & mask_) >= ((next - hole) & mask_))
+				{
+					slots_[hole] = slots_[next];
+					relink(hole);
+					hole = next;
+				}
+				next = (next + 1) & mask_;
+			}
+			slots_[hole].key = 0;
+			--size_;
+		}
+		
+		std::vector<entry> slots_;
+		std::size_t mask_;
+		std::size_t capacity_;
+		std::size_t size_;
+		uint32_t oldest_;
+		uint32_t newest_;
+};
+
+#endif
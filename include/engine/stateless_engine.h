@@ -0,0 +1,96 @@
+#ifndef ENGINE_STATELESS_ENGINE
+#define ENGINE_STATELESS_ENGINE
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <hop_writer.h>
+#include <pacer.h>
+#include <probe_codec.hpp>
+#include <transport.hpp>
+
+/// @brief Probes every TTL of many destinations without state per probe, in the style of Yarrp.
+///
+/// All pairs of destination and TTL are sent once, in the order of a
+/// multiplicative permutation of their index, so consecutive probes seldom
+/// meet the same router and its ICMP rate limit. A probe_codec packs TTL,
+/// send stamp and a keyed hash of the destination into every probe, and
+/// every reply is validated and turned into a hop record on its own. Memory
+/// grows with the destination list only, not with the probes in flight.
+/// Hops are written to the results file, or printed one per line, as they
+/// arrive. There are no traces per destination, so no hop is ever waited for.
+/// The send stamp has 16 bits of 100 microseconds, replies later than 6.5
+/// seconds come back with their round trip time wrapped around. It is taken
+/// when the probe is encoded, kernel timestamps of the transport only end the
+/// round trips. A probe the transport refuses is tried again on the next
+/// wake-up, and while the batch is full the engine waits with a growing
+/// backoff; if no probe gets through for seconds the rest are given up.
+class stateless_engine
+{
+	public:
+
+		///@brief The engine takes ownership of network and probes from source. Without a rate every wake-up sends a batch.
+		stateless_engine(boost::asio::io_context& io_context, transport* network, const boost::asio::ip::address_v4& source, probe_codec::probe_type type, uint8_t max_ttl, uint32_t deadline, uint32_t rate, uint32_t burst, uint32_t spin, uint16_t batch_size, uint16_t shard = 0, hop_writer* results = 0);
+
+		void add_destination(const std::string& destination);
+
+		void start();
+
+	private:
+
+		stateless_engine(const stateless_engine&);
+
+		stateless_engine& operator=(const stateless_engine&);
+
+		void send_batch();
+
+		uint32_t send_paced(uint32_t allowance);
+
+		///@brief Send the next count probes of the permutation, returns how many the transport took.
+		uint32_t transmit(uint32_t count);
+
+		///@brief True if the transport took no probe for too long, the probes left are given up then.
+		bool stalled(uint32_t sent);
+
+		///@brief Wait deadline for the replies to the last probes, then stop.
+		void drain();
+
+		void handle_deadline(const boost::system::error_code& error);
+
+		void handle_receive(const received_datagram* datagrams, std::size_t count);
+
+		uint16_t stamp(boost::asio::chrono::steady_clock::time_point time) const;
+
+		std::unique_ptr<transport> transport_;
+		std::unique_ptr<pacer> pacer_;
+		boost::asio::steady_timer send_timer_;
+		boost::asio::steady_timer deadline_timer_;
+		probe_codec::probe_type type_;
+		uint16_t identifier_;
+		probe_codec codec_;
+		uint8_t max_ttl_;
+		uint32_t deadline_;
+		uint16_t batch_size_;
+		std::vector<uint32_t> destinations_;
+
+		///@brief The probes left walk position_ through all total_ pairs in steps of step_, which is coprime to total_.
+		uint64_t total_;
+		uint64_t remaining_;
+		uint64_t step_;
+		uint64_t position_;
+
+		boost::asio::chrono::steady_clock::time_point epoch_;
+		///@brief Wait of an unpaced engine while the transport takes nothing, it doubles until a probe gets through.
+		boost::asio::chrono::microseconds backoff_;
+		boost::asio::chrono::steady_clock::time_point last_sent_;
+		uint64_t sent_;
+		uint64_t refused_;
+		hop_writer* results_;
+		std::vector<hop_record> records_;
+		uint64_t answered_;
+		uint64_t rejected_;
+		bool draining_;
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef ENGINE_STOP_SET
+#define ENGINE_STOP_SET
+
+#include <mutex>
+#include <unordered_set>
+#include <boost/asio.hpp>
+
+/// @brief Interfaces and paths known from earlier traces, consulted to skip probes (Doubletree).
+///
+/// Probing backwards from a mid-path TTL stops at the first interface any
+/// trace has seen, the hops in front of it are shared with that trace.
+/// Probing forwards stops at an interface already seen on the way to the
+/// same destination prefix, the rest of the path is known. Engines on
+/// several workers share one stop set, every call takes a lock.
+class stop_set
+{
+	public:
+
+		explicit stop_set(uint8_t prefix_length = 24);
+
+		///@brief Add an interface, true if it was known already.
+		bool add_interface(const boost::asio::ip::address_v4& interface);
+
+		///@brief Add an interface on the way to the prefix of destination, true if the pair was known already.
+		bool add_path(const boost::asio::ip::address_v4& interface, const boost::asio::ip::address_v4& destination);
+
+		std::size_t interfaces() const;
+
+		std::size_t paths() const;
+
+	private:
+
+		stop_set(const stop_set&);
+
+		stop_set& operator=(const stop_set&);
+
+		uint32_t mask_;
+		mutable std::mutex mutex_;
+		std::unordered_set<uint32_t> interfaces_;
+		///@brief Interface in the upper half, destination prefix in the lower one.
+		std::unordered_set<uint64_t> paths_;
+};
+
+#endif
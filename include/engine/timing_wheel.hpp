@@ -0,0 +1,210 @@
+#ifndef ENGINE_TIMING_WHEEL
+#define ENGINE_TIMING_WHEEL
+
+#include <algorithm>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/cstdint.hpp>
+
+/// @brief Hierarchical timing wheel for many deadlines driven by one periodic tick.
+///
+/// Four levels of 64 slots each, a timer lands in the lowest level whose
+/// range covers its distance from now. Whenever the slots of one level wrapped
+/// around, the next slot of the level above is cascaded down. Insert and cancel
+/// are O(1), expiry costs O(1) per timer plus the cascades. Timers carry a
+/// 64-bit cookie handed to the handler when they fire, the wheel never
+/// allocates once its node pool has grown to the peak number of timers.
+class timing_wheel
+{
+	public:
+		typedef boost::asio::chrono::steady_clock::time_point time_point;
+		typedef boost::asio::chrono::steady_clock::duration duration;
+
+		///@brief Names a scheduled timer, stays invalid after the timer fired or was cancelled.
+		typedef uint64_t timer_id;
+
+		static const timer_id invalid_timer = 0;
+
+		timing_wheel(duration tick, time_point start)
+		: tick_(tick > duration::zero() ? tick : duration(1)),
+		  start_(start),
+		  current_tick_(0),
+		  free_(none),
+		  size_(0)
+		{
+			heads_.assign(levels * slots, static_cast<uint32_t>(none));
+		}
+
+		duration tick() const
+		{
+			return tick_;
+		}
+
+		std::size_t size() const
+		{
+			return size_;
+		}
+
+		///@brief The time the next tick is due.
+		time_point next_tick() const
+		{
+			return start_ + tick_ * static_cast<duration::rep>(current_tick_ + 1);
+		}
+
+		///@brief Fire cookie at expiry, rounded up to the next tick and at the earliest on the next one.
+		timer_id schedule(time_point expiry, uint64_t cookie)
+		{
+			uint64_t expiry_tick = current_tick_ + 1;
+			if(expiry > start_)
+				expiry_tick = std::max<uint64_t>(expiry_tick, static_cast<uint64_t>((expiry - start_ + tick_ - duration(1)) / tick_));
+
+			uint32_t index = allocate();
+			nodes_[index].expiry_tick = expiry_tick;
+			nodes_[index].cookie = cookie;
+			place(index);
+			++size_;
+			return (static_cast<uint64_t>(nodes_[index].generation) << 32) | (index + 1);
+		}
+
+		///@brief Cancel a timer, false if it already fired or was cancelled.
+		bool cancel(timer_id timer)
+		{
+			uint32_t index = static_cast<uint32_t>(timer & 0xFFFFFFFF) - 1;
+			if(timer == invalid_timer || index >= nodes_.size() || nodes_[index].list == none || nodes_[index].generation != static_cast<uint32_t>(timer >> 32))
+				return false;
+			unlink(index);
+			release(index);
+			--size_;
+			return true;
+		}
+
+		///@brief Advance to now, calling handler(cookie) for every timer that expired.
+		template <typename Handler>
+		void advance(time_point now, Handler handler)
+		{
+			if(now < start_)
+				return;
+			uint64_t target = static_cast<uint64_t>((now - start_) / tick_);
+			while(current_tick_ < target)
+			{
+				++current_tick_;
+				// a wrapped level pulls the next slot of the level above down
+				for(std::size_t level = 1; level < levels; ++level)
+				{
+					if((current_tick_ & ((uint64_t(1) << (bits * level)) - 1)) != 0)
+						break;
+					cascade(level * slots + ((current_tick_ >> (bits * level)) & mask));
+				}
+
+				std::size_t list = current_tick_ & mask;
+				while(heads_[list] != none)
+				{
+					// the node is freed first, so the handler may schedule again
+					uint32_t index = heads_[list];
+					uint64_t cookie = nodes_[index].cookie;
+					unlink(index);
+					release(index);
+					--size_;
+					handler(cookie);
+				}
+			}
+		}
+
+	private:
+		static const std::size_t bits = 6;
+		static const std::size_t slots = 1 << bits;
+		static const uint64_t mask = slots - 1;
+		static const std::size_t levels = 4;
+		static const uint32_t none = 0xFFFFFFFF;
+
+		struct node
+		{
+			uint64_t expiry_tick;
+			uint64_t cookie;
+			uint32_t previous;
+			uint32_t next;
+			uint32_t list;
+			uint32_t generation;
+		};
+
+		uint32_t allocate()
+		{
+			if(free_ == none)
+			{
+				node empty = node();
+				empty.list = none;
+				empty.generation = 1;
+				nodes_.push_back(empty);
+				return static_cast<uint32_t>(nodes_.size() - 1);
+			}
+			uint32_t index = free_;
+			free_ = nodes_[index].next;
+			return index;
+		}
+
+		void release(uint32_t index)
+		{
+			nodes_[index].list = none;
+			// a stale timer_id of the old timer no longer matches
+			++nodes_[index].generation;
+			nodes_[index].next = free_;
+			free_ = index;
+		}
+
+		void place(uint32_t index)
+		{
+			uint64_t expiry_tick = nodes_[index].expiry_tick;
+			uint64_t delta = expiry_tick > current_tick_ ? expiry_tick - current_tick_ : 0;
+			std::size_t list = current_tick_ & mask;
+			if(delta > 0)
+			{
+				std::size_t level = 0;
+				while(level + 1 < levels && delta >= (uint64_t(1) << (bits * (level + 1))))
+					++level;
+				// beyond the top level the timer waits in its last slot and is cascaded again
+				if(delta >= (uint64_t(1) << (bits * levels)))
+					expiry_tick = current_tick_ + (uint64_t(1) << (bits * levels)) - 1;
+				list = level * slots + ((expiry_tick >> (bits * level)) & mask);
+			}
+
+			nodes_[index].list = static_cast<uint32_t>(list);
+			nodes_[index].previous = none;
+			nodes_[index].next = heads_[list];
+			if(heads_[list] != none)
+				nodes_[heads_[list]].previous = index;
+			heads_[list] = index;
+		}
+
+		void unlink(uint32_t index)
+		{
+			node& entry = nodes_[index];
+			if(entry.previous != none)
+				nodes_[entry.previous].next = entry.next;
+			else
+				heads_[entry.list] = entry.next;
+			if(entry.next != none)
+				nodes_[entry.next].previous = entry.previous;
+		}
+
+		void cascade(std::size_t list)
+		{
+			uint32_t index = heads_[list];
+			heads_[list] = none;
+			while(index != none)
+			{
+				uint32_t next = nodes_[index].next;
+				place(index);
+				index = next;
+			}
+		}
+
+		duration tick_;
+		time_point start_;
+		uint64_t current_tick_;
+		std::vector<node> nodes_;
+		std::vector<uint32_t> heads_;
+		uint32_t free_;
+		std::size_t size_;
+};
+
+#endif
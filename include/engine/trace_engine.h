@@ -0,0 +1,135 @@
+#ifndef ENGINE_TRACE_ENGINE
+#define ENGINE_TRACE_ENGINE
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <hop_writer.h>
+#include <probe_table.hpp>
+#include <send_stamps.hpp>
+#include <stop_set.h>
+#include <timestamping.hpp>
+#include <timing_wheel.hpp>
+#include <topology_store.h>
+#include <trace_session.h>
+#include <transport.hpp>
+
+class icmp_header_view;
+class ipv4_header_view;
+
+/// @brief Runs parallel-TTL traces to many destinations at once on one io_context.
+///
+/// All sessions share one transport, which owns the sockets, or simulates the
+/// network in process. Every session owns a slot, the slot number is carried in the ICMP identifier or
+/// the UDP source port of its probes. Probes in flight are kept in a
+/// probe_table, which gives TTL and send time of a reply and the serial of the
+/// session it belongs to. Several engines on separate workers split the
+/// identifier range into shards, every engine ignores replies outside its own.
+/// With a stop set a session probes Doubletree style instead of in one burst,
+/// one TTL at a time forwards and backwards from a mid-path TTL. In
+/// incremental mode destinations with a path in the topology store are
+/// re-traced by an incremental_trace, which only probes what changed.
+class trace_engine
+{
+	public:
+		
+		enum probe_type
+		{
+			icmp,
+			udp
+		};
+		
+		///@brief The engine takes ownership of network and probes from source.
+		trace_engine(boost::asio::io_context& io_context, transport* network, const boost::asio::ip::address_v4& source, probe_type type, uint8_t max_ttl, uint32_t deadline, uint16_t concurrency, uint16_t shard = 0, uint16_t shards = 1, timestamping::mode stamps = timestamping::none, hop_writer* results = 0);
+		
+		void add_destination(const std::string& destination);
+		
+		///@brief Probe from first_ttl forwards and backwards, stopping at what stops already knows.
+		void doubletree(stop_set* stops, uint8_t first_ttl);
+		
+		///@brief Merge every finished trace into store as well.
+		void topology(topology_store* store);
+		
+		///@brief Re-trace destinations with a path in the topology store incrementally, window TTLs at a time.
+		void incremental(uint8_t window);
+		
+		void start();
+
+	private:
+		
+		void start_sessions();
+		
+		///@brief Send one probe for every TTL from first to last.
+		void send_probes(trace_session& session, uint8_t first, uint8_t last);
+		
+		///@brief Doubletree step on an answer, the next probe in its direction or the end of that direction.
+		void advance(uint16_t slot, uint8_t ttl, const boost::asio::ip::address_v4& address, bool unreachable);
+		
+		///@brief Doubletree step once a probe of the session got no answer in time.
+		void handle_probe_timeout(uint16_t slot);
+		
+		void schedule_probe_timeout(uint16_t slot);
+		
+		///@brief Send the probes an incremental trace asked for, finish the session once it is done.
+		void continue_incremental(uint16_t slot);
+		
+		///@brief Log the route changes an incremental trace found and fill in the hops it took from the cache.
+		void merge_incremental(trace_session& session);
+		
+		void handle_receive(const received_datagram* datagrams, std::size_t count);
+		
+		///@brief Move the send time of a probe to its kernel stamp.
+		void handle_send_stamp(const ipv4_header_view& sent, boost::asio::chrono::steady_clock::time_point sent_at);
+		
+		///@brief Match one received ICMP packet to the probe it answers.
+		void handle_reply(const uint8_t* data, std::size_t length, boost::asio::chrono::steady_clock::time_point now);
+		
+		void schedule_deadline(uint16_t slot, boost::asio::chrono::steady_clock::time_point expiry);
+		
+		void handle_tick(const boost::system::error_code& error);
+		
+		void handle_deadline(uint64_t cookie);
+		
+		void record_hop(uint16_t identifier, uint64_t key, const ipv4_header_view& reply, const icmp_header_view& icmp, boost::asio::chrono::steady_clock::time_point now);
+		
+		void finish(uint16_t slot);
+
+		boost::asio::io_context& io_context_;
+		///@brief Drives the deadlines of all sessions, ticks once a millisecond while any is pending.
+		boost::asio::steady_timer tick_timer_;
+		timing_wheel timers_;
+		bool ticking_;
+		probe_type type_;
+		uint8_t max_ttl_;
+		uint32_t deadline_;
+		
+		std::unique_ptr<transport> transport_;
+		boost::asio::ip::address_v4 source_address_;
+		///@brief 0 without kernel send stamps.
+		std::unique_ptr<send_stamps> send_stamps_;
+		
+		std::vector<boost::asio::ip::address_v4> destinations_;
+		std::size_t next_destination_;
+		
+		uint16_t identifier_base_;
+		std::vector<std::unique_ptr<trace_session> > slots_;
+		std::vector<uint16_t> free_slots_;
+		probe_table probes_;
+		
+		///@brief Finished sessions go here instead of to stdout if set, records_ is reused for every session.
+		hop_writer* results_;
+		topology_store* topology_;
+		std::vector<hop_record> records_;
+		
+		///@brief Shared by the engines of all workers, 0 without Doubletree.
+		stop_set* stops_;
+		uint8_t first_ttl_;
+		///@brief TTLs an incremental trace probes at once, 0 without incremental mode.
+		uint8_t window_;
+		std::vector<uint32_t> cached_;
+		std::vector<uint8_t> ttls_;
+		uint64_t probes_sent_;
+};
+
+#endif
@@ -0,0 +1,190 @@
+#ifndef ENGINE_TRACE_SESSION
+#define ENGINE_TRACE_SESSION
+
+#include <memory>
+#include <ostream>
+#include <vector>
+#include <boost/asio.hpp>
+#include <hop_format.hpp>
+#include <incremental_trace.h>
+#include <timing_wheel.hpp>
+
+/// @brief State of one parallel-TTL trace run by the trace_engine.
+class trace_session
+{
+	public:
+		
+		trace_session(const boost::asio::ip::address_v4& destination, uint16_t identifier, uint32_t serial, uint8_t max_ttl);
+		
+		const boost::asio::ip::address_v4& destination() const
+		{
+			return destination_;
+		}
+		
+		uint16_t identifier() const
+		{
+			return identifier_;
+		}
+		
+		uint32_t serial() const
+		{
+			return serial_;
+		}
+		
+		uint8_t max_ttl() const
+		{
+			return max_ttl_;
+		}
+		
+		boost::asio::chrono::steady_clock::time_point deadline() const
+		{
+			return deadline_;
+		}
+		
+		timing_wheel::timer_id deadline_timer() const
+		{
+			return deadline_timer_;
+		}
+		
+		///@brief Remember when and by which timer of the engine's wheel the session ends.
+		void deadline(boost::asio::chrono::steady_clock::time_point expiry, timing_wheel::timer_id timer)
+		{
+			deadline_ = expiry;
+			deadline_timer_ = timer;
+		}
+		
+		///@brief The TTL probed forwards in Doubletree mode, 0 once forward probing is done.
+		uint8_t forward_ttl() const
+		{
+			return forward_ttl_;
+		}
+		
+		boost::asio::chrono::steady_clock::time_point forward_sent() const
+		{
+			return forward_sent_;
+		}
+		
+		void forward(uint8_t ttl, boost::asio::chrono::steady_clock::time_point sent)
+		{
+			forward_ttl_ = ttl;
+			forward_sent_ = sent;
+			probed(ttl);
+		}
+		
+		///@brief The TTL probed backwards in Doubletree mode, 0 once backward probing is done.
+		uint8_t backward_ttl() const
+		{
+			return backward_ttl_;
+		}
+		
+		boost::asio::chrono::steady_clock::time_point backward_sent() const
+		{
+			return backward_sent_;
+		}
+		
+		void backward(uint8_t ttl, boost::asio::chrono::steady_clock::time_point sent)
+		{
+			backward_ttl_ = ttl;
+			backward_sent_ = sent;
+			probed(ttl);
+		}
+		
+		///@brief Forward probes in a row that got no answer.
+		uint8_t gap() const
+		{
+			return gap_;
+		}
+		
+		void gap(uint8_t gap)
+		{
+			gap_ = gap;
+		}
+		
+		///@brief Store the first reply for a TTL, returns false if the TTL is out of range or already answered.
+		bool record_hop(uint16_t ttl, const boost::asio::ip::address_v4& address, boost::asio::chrono::steady_clock::duration rtt, uint8_t icmp_type, uint8_t icmp_code, uint8_t reply_ttl);
+		
+		///@brief Fill a TTL that was not probed with the hop of the cached path, returns false if it was answered.
+		bool cached_hop(uint16_t ttl, const boost::asio::ip::address_v4& address);
+		
+		///@brief The incremental trace of the session, 0 unless it re-traces a cached path.
+		incremental_trace* incremental() const
+		{
+			return incremental_.get();
+		}
+		
+		void incremental(incremental_trace* trace)
+		{
+			incremental_.reset(trace);
+		}
+		
+		///@brief The TTL at which the destination answered, 0 while it has not.
+		uint8_t destination_ttl() const
+		{
+			return destination_ttl_;
+		}
+		
+		boost::asio::chrono::steady_clock::duration destination_rtt() const
+		{
+			return hop_rtt_[destination_ttl_];
+		}
+		
+		///@brief True once the destination and every hop in front of it have answered.
+		bool complete() const;
+		
+		///@brief Doubletree left out TTLs the stop set knew, in front of the first TTL probed or behind the last one.
+		bool partial() const
+		{
+			return lowest_ttl_ > 1 || cut_;
+		}
+		
+		///@brief Forward probing stopped at the stop set before the destination answered.
+		void cut()
+		{
+			cut_ = true;
+		}
+		
+		void print(std::ostream& os) const;
+		
+		///@brief Append a hop_record for every answered or cached TTL, flags are set on all of them.
+		void records(std::vector<hop_record>& records, uint8_t flags) const;
+
+	private:
+		
+		///@brief Widen the range of probed TTLs, print leaves out those a Doubletree trace skipped.
+		void probed(uint8_t ttl)
+		{
+			if(ttl == 0)
+				return;
+			if(lowest_ttl_ == 0 || ttl < lowest_ttl_)
+				lowest_ttl_ = ttl;
+			if(ttl > highest_ttl_)
+				highest_ttl_ = ttl;
+		}
+		
+		boost::asio::ip::address_v4 destination_;
+		uint16_t identifier_;
+		uint32_t serial_;
+		uint8_t max_ttl_;
+		uint8_t destination_ttl_;
+		boost::asio::chrono::steady_clock::time_point deadline_;
+		timing_wheel::timer_id deadline_timer_;
+		std::vector<boost::asio::chrono::steady_clock::duration> hop_rtt_;
+		std::vector<boost::asio::ip::address_v4> hop_address_;
+		std::vector<bool> hop_answered_;
+		std::vector<bool> hop_cached_;
+		std::vector<uint8_t> hop_icmp_type_;
+		std::vector<uint8_t> hop_icmp_code_;
+		std::vector<uint8_t> hop_reply_ttl_;
+		uint8_t forward_ttl_;
+		boost::asio::chrono::steady_clock::time_point forward_sent_;
+		uint8_t backward_ttl_;
+		boost::asio::chrono::steady_clock::time_point backward_sent_;
+		uint8_t gap_;
+		///@brief Range of TTLs probed in Doubletree mode, 0 while all of them are.
+		uint8_t lowest_ttl_;
+		uint8_t highest_ttl_;
+		bool cut_;
+		std::unique_ptr<incremental_trace> incremental_;
+};
+
+#endif
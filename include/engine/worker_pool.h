@@ -0,0 +1,53 @@
+#ifndef ENGINE_WORKER_POOL
+#define ENGINE_WORKER_POOL
+
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+
+/// @brief Threads that each run their own io_context, optionally pinned to a core.
+///
+/// Every worker owns the sockets, sessions, engines and flows created on its
+/// io_context, their handlers need no locking. What the workers share, the
+/// stop_set, topology_store, hop_writer, tx_stats and the logger, locks with
+/// its own mutex or counts with atomics. Worker i
+/// is pinned to cpus[i % cpus.size()], an empty list leaves placement to the
+/// scheduler. An exception that escapes a handler ends its worker only, it
+/// is thrown again by run() once all workers are done.
+class worker_pool
+{
+	public:
+		
+		worker_pool(std::size_t threads, const std::vector<int>& cpus);
+		
+		std::size_t size() const
+		{
+			return io_contexts_.size();
+		}
+		
+		boost::asio::io_context& io_context(std::size_t worker)
+		{
+			return *io_contexts_[worker];
+		}
+		
+		///@brief Run all workers until each io_context ran out of work, then throw the first exception a worker ended with.
+		void run();
+		
+		///@brief Parse a cpu list like "0-3,8,10-11".
+		static std::vector<int> parse_cpu_list(const std::string& list);
+		
+		///@brief Cores local to the NUMA node of a network interface, empty if unknown.
+		static std::vector<int> interface_cpus(const std::string& interface);
+
+	private:
+		
+		void run_worker(std::size_t worker);
+		
+		std::vector<std::unique_ptr<boost::asio::io_context> > io_contexts_;
+		std::vector<int> cpus_;
+		std::vector<std::exception_ptr> errors_;
+};
+
+#endif
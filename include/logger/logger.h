@@ -1,5 +1,278 @@
-#ifndef logger
-#define logger
+#ifndef LOGGER_LOGGER
+#define LOGGER_LOGGER
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <boost/asio/ip/address_v4.hpp>
+#include <boost/cstdint.hpp>
+
+/// @brief Fixed-size binary log record, formatted by the logger thread.
+///
+/// The format is a string literal with {} for every argument, it is kept by
+/// pointer. Arguments are stored as raw values, strings are copied into the
+/// record and cut off where it is full.
+struct log_record
+{
+	enum argument_type
+	{
+		signed_integer,
+		unsigned_integer,
+		floating_point,
+		address,
+		text
+	};
+
+	static const std::size_t max_arguments = 6;
+	static const std::size_t text_size = 56;
+
+	union argument
+	{
+		int64_t signed_value;
+		uint64_t unsigned_value;
+		double floating_value;
+		uint32_t address_value;
+		struct
+		{
+			uint16_t offset;
+			uint16_t length;
+		} text_value;
+	};
+
+	int64_t time;
+	const char* format;
+	uint8_t level;
+	uint8_t count;
+	uint8_t types[max_arguments];
+	argument arguments[max_arguments];
+	char texts[text_size];
+	uint16_t text_used;
+};
+
+/// @brief Single producer, single consumer ring of log records, one per logging thread.
+class log_ring
+{
+	public:
+		explicit log_ring(std::size_t capacity);
+
+		///@brief Slot for the next record, 0 if the ring is full.
+		log_record* reserve()
+		{
+			std::size_t head = head_.load(std::memory_order_relaxed);
+			if(head - tail_cache_ == records_.size())
+			{
+				tail_cache_ = tail_.load(std::memory_order_acquire);
+				if(head - tail_cache_ == records_.size())
+					return 0;
+			}
+			return &records_[head & mask_];
+		}
+
+		///@brief Hand the reserved record to the consumer.
+		void commit()
+		{
+			head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+
+		///@brief Oldest record or 0, release() it once it is formatted.
+		const log_record* front()
+		{
+			std::size_t tail = tail_.load(std::memory_order_relaxed);
+			if(tail == head_.load(std::memory_order_acquire))
+				return 0;
+			return &records_[tail & mask_];
+		}
+
+		void release()
+		{
+			tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+
+	private:
+		std::vector<log_record> records_;
+		std::size_t mask_;
+		// producer and consumer side each get their own cache line
+		char producer_padding_[64];
+		std::atomic<std::size_t> head_;
+		std::size_t tail_cache_;
+		char consumer_padding_[64];
+		std::atomic<std::size_t> tail_;
+};
+
+/// @brief Leveled asynchronous logger.
+///
+/// Logging threads encode their arguments into a record in their own
+/// log_ring and return, a background thread formats the records and writes
+/// them, errors and warnings to stderr, everything else to stdout. A full ring
+/// drops the record instead of blocking the caller, the number of dropped
+/// records is reported when the logger stops.
+class logger
+{
+	public:
+		enum level
+		{
+			error,
+			warning,
+			info,
+			debug,
+			trace
+		};
+
+		static logger& instance();
+
+		///@brief Start the writer thread, records above threshold are not recorded.
+		void start(level threshold);
+
+		///@brief Write out everything recorded and stop the writer thread.
+		void stop();
+
+		bool enabled(level value) const
+		{
+			return static_cast<int>(value) <= threshold_.load(std::memory_order_relaxed);
+		}
+
+		template <typename... Arguments>
+		void log(level value, const char* format, const Arguments&... arguments)
+		{
+			if(!enabled(value))
+				return;
+			log_ring& ring = thread_ring();
+			log_record* record = ring.reserve();
+			if(record == 0)
+			{
+				dropped_.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			record->time = now();
+			record->format = format;
+			record->level = static_cast<uint8_t>(value);
+			record->count = 0;
+			record->text_used = 0;
+			encode(*record, arguments...);
+			ring.commit();
+		}
+
+	private:
+		logger();
+
+		~logger();
+
+		static int64_t now();
+
+		log_ring& thread_ring();
+
+		log_ring& add_ring();
+
+		void run();
+
+		///@brief Format and write every record waiting, false if there was none.
+		bool drain(std::string& output, std::string& errors);
+
+		static void format(const log_record& record, std::string& output);
+
+		static void encode(log_record&)
+		{
+		}
+
+		template <typename Argument, typename... Arguments>
+		static void encode(log_record& record, const Argument& argument, const Arguments&... arguments)
+		{
+			if(record.count < log_record::max_arguments)
+			{
+				put(record, record.arguments[record.count], record.types[record.count], argument);
+				++record.count;
+			}
+			encode(record, arguments...);
+		}
+
+		template <typename Integer>
+		static void put(log_record&, log_record::argument& value, uint8_t& type, const Integer& argument, typename std::enable_if<std::is_integral<Integer>::value && std::is_signed<Integer>::value>::type* = 0)
+		{
+			value.signed_value = argument;
+			type = log_record::signed_integer;
+		}
+
+		template <typename Integer>
+		static void put(log_record&, log_record::argument& value, uint8_t& type, const Integer& argument, typename std::enable_if<std::is_integral<Integer>::value && !std::is_signed<Integer>::value>::type* = 0)
+		{
+			value.unsigned_value = argument;
+			type = log_record::unsigned_integer;
+		}
+
+		static void put(log_record&, log_record::argument& value, uint8_t& type, double argument)
+		{
+			value.floating_value = argument;
+			type = log_record::floating_point;
+		}
+
+		static void put(log_record&, log_record::argument& value, uint8_t& type, const boost::asio::ip::address_v4& argument)
+		{
+			value.address_value = argument.to_uint();
+			type = log_record::address;
+		}
+
+		static void put(log_record& record, log_record::argument& value, uint8_t& type, const char* argument)
+		{
+			put_text(record, value, type, argument, std::strlen(argument));
+		}
+
+		static void put(log_record& record, log_record::argument& value, uint8_t& type, const std::string& argument)
+		{
+			put_text(record, value, type, argument.data(), argument.size());
+		}
+
+		static void put_text(log_record& record, log_record::argument& value, uint8_t& type, const char* text, std::size_t length)
+		{
+			length = std::min<std::size_t>(length, log_record::text_size - record.text_used);
+			std::memcpy(record.texts + record.text_used, text, length);
+			value.text_value.offset = record.text_used;
+			value.text_value.length = static_cast<uint16_t>(length);
+			record.text_used = static_cast<uint16_t>(record.text_used + length);
+			type = log_record::text;
+		}
+
+		std::atomic<int> threshold_;
+		std::atomic<bool> running_;
+		std::atomic<uint64_t> dropped_;
+		std::mutex rings_mutex_;
+		std::vector<std::unique_ptr<log_ring> > rings_;
+		std::thread writer_;
+};
+
+template <typename... Arguments>
+inline void log_error(const char* format, const Arguments&... arguments)
+{
+	logger::instance().log(logger::error, format, arguments...);
+}
+
+template <typename... Arguments>
+inline void log_warning(const char* format, const Arguments&... arguments)
+{
+	logger::instance().log(logger::warning, format, arguments...);
+}
+
+template <typename... Arguments>
+inline void log_info(const char* format, const Arguments&... arguments)
+{
+	logger::instance().log(logger::info, format, arguments...);
+}
+
+template <typename... Arguments>
+inline void log_debug(const char* format, const Arguments&... arguments)
+{
+	logger::instance().log(logger::debug, format, arguments...);
+}
+
+template <typename... Arguments>
+inline void log_trace(const char* format, const Arguments&... arguments)
+{
+	logger::instance().log(logger::trace, format, arguments...);
+}
 
 #endif
@@ -1,15 +1,21 @@
 #ifndef PROBES_ICMP_PROBE
 #define PROBES_ICMP_PROBE
 
+#include <memory>
+#include <boost/array.hpp>
 #include <boost/asio.hpp>
 #include <boost/random.hpp>
-#include <raw.hpp>
+#include <packet_template.hpp>
+#include <probe_table.hpp>
+#include <send_stamps.hpp>
+#include <transport.hpp>
 
 class icmp_probe
 {
 	public:
 		
-		icmp_probe(boost::asio::io_context& io_context, const char* destination);
+		///@brief The probe takes ownership of network and probes from source.
+		icmp_probe(boost::asio::io_context& io_context, transport* network, const boost::asio::ip::address_v4& source, const char* destination, uint8_t max_ttl = 30, uint32_t deadline = 5000, bool parallel = false, timestamping::mode stamps = timestamping::none);
 		
 		void start();
 
@@ -17,29 +23,50 @@ class icmp_probe
 		
 		void send_packet();
 		
-		void start_receive();
-		
-		void handle_send(const boost::system::error_code& error, std::size_t bytes_transferred);
-		
 		void handle_timeout(const boost::system::error_code& error);
 		
-		void handle_receive(const boost::system::error_code& error, size_t length);
+		void handle_receive(const received_datagram* datagrams, std::size_t count);
+		
+		void handle_reply(const uint8_t* data, std::size_t length, boost::asio::chrono::steady_clock::time_point now);
+
+		void handle_send_stamp(const ipv4_header_view& sent, boost::asio::chrono::steady_clock::time_point sent_at);
+
+		// parallel mode: one probe per TTL in a single burst, replies matched back by sequence number
+		void send_burst();
 
-		boost::asio::basic_raw_socket<raw> raw_socket_;
-		boost::asio::ip::icmp::resolver icmp_resolver_;
+		void handle_deadline(const boost::system::error_code& error);
+
+		void handle_burst_reply(const uint8_t* data, std::size_t length, boost::asio::chrono::steady_clock::time_point now);
+
+		void record_hop(uint16_t ttl, const boost::asio::ip::address_v4& address, boost::asio::chrono::steady_clock::duration rtt);
+
+		void finish();
+
+		std::unique_ptr<transport> transport_;
+		std::unique_ptr<send_stamps> send_stamps_;
 		std::string remote_end_point_;
+		boost::asio::ip::address_v4 remote_address_;
+		packet_template packet_;
 		boost::asio::chrono::steady_clock::time_point timestamp_;
 		uint8_t ttl_;
 		uint16_t identifier_;
 		uint16_t sequence_number_;
 		boost::random::mt19937 gen_;
 				
-		boost::asio::ip::icmp::socket receive_socket_;
-		boost::asio::streambuf receive_buffer_;
 		boost::asio::steady_timer receive_timeout_; 
 		uint8_t retries_;
+
+		uint8_t max_ttl_;
+		uint32_t deadline_;
+		bool parallel_;
+		bool done_;
+		uint8_t destination_ttl_;
+		probe_table probes_;
+		boost::array<boost::asio::chrono::steady_clock::duration, 256> hop_rtt_;
+		boost::array<boost::asio::ip::address_v4, 256> hop_address_;
+		boost::array<bool, 256> hop_answered_;
 		
-		void debug(const boost::asio::streambuf& buffer, std::size_t length);
+		void debug(const uint8_t* data, std::size_t length);
 };
 
 #endif
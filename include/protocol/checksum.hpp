@@ -0,0 +1,83 @@
+#ifndef PROTOCOL_CHECKSUM
+#define PROTOCOL_CHECKSUM
+
+#include <cstddef>
+#include <boost/asio/ip/address_v4.hpp>
+#include <boost/cstdint.hpp>
+
+/*
+	Internet checksum - rfc1071
+
+	The checksum is the one's complement of the one's complement sum of all
+	16-bit words. The sum does not depend on the byte order it is computed
+	in, so the kernels add up the buffer in memory order, as wide as the cpu
+	allows, and swap the folded result once at the end. The widest kernel the
+	cpu supports (AVX2, SSE2 or scalar) is chosen on first use.
+*/
+
+///@brief One's complement sum of the big-endian 16-bit words of data, added to sum.
+///
+/// Not folded and not complemented, so sums of several parts can be chained.
+/// Every part but the last has to be of even length.
+uint32_t checksum_add(const uint8_t* data, std::size_t length, uint32_t sum = 0);
+
+///@brief The kernels checksum_add chooses from.
+enum checksum_kernel
+{
+	checksum_scalar,
+	checksum_sse2,
+	checksum_avx2
+};
+
+///@brief Whether the cpu can run kernel.
+bool checksum_supported(checksum_kernel kernel);
+
+///@brief checksum_add on the given kernel, which the cpu has to support, for tests and benchmarks.
+uint32_t checksum_add_on(checksum_kernel kernel, const uint8_t* data, std::size_t length, uint32_t sum = 0);
+
+///@brief Fold a sum to 16 bits and complement it.
+inline uint16_t checksum_finish(uint32_t sum)
+{
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	return static_cast<uint16_t>(~sum);
+}
+
+inline uint16_t internet_checksum(const uint8_t* data, std::size_t length)
+{
+	return checksum_finish(checksum_add(data, length));
+}
+
+///@brief Sum of the pseudo header UDP and TCP checksums cover - rfc768.
+inline uint32_t pseudo_header_sum(const boost::asio::ip::address_v4& source, const boost::asio::ip::address_v4& destination, uint8_t protocol, uint16_t length)
+{
+	uint32_t source_bits = source.to_uint();
+	uint32_t destination_bits = destination.to_uint();
+	return (source_bits >> 16) + (source_bits & 0xFFFF) + (destination_bits >> 16) + (destination_bits & 0xFFFF) + protocol + length;
+}
+
+///@brief Checksum of a UDP datagram whose checksum field is zero, a result of zero is sent as 0xFFFF.
+inline uint16_t udp_checksum(const boost::asio::ip::address_v4& source, const boost::asio::ip::address_v4& destination, const uint8_t* datagram, std::size_t length)
+{
+	uint16_t checksum = checksum_finish(checksum_add(datagram, length, pseudo_header_sum(source, destination, 17, static_cast<uint16_t>(length))));
+	return checksum == 0 ? 0xFFFF : checksum;
+}
+
+/*
+	Incremental update of the Internet checksum - rfc1624
+
+	HC' = ~(~HC + ~m + m')
+
+	HC is the old checksum, m the old and m' the new value of the 16-bit
+	word that changed. The sums are one's complement sums.
+*/
+
+inline uint16_t checksum_adjust(uint16_t checksum, uint16_t old_word, uint16_t new_word)
+{
+	uint32_t sum = static_cast<uint16_t>(~checksum) + static_cast<uint16_t>(~old_word) + static_cast<uint32_t>(new_word);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	sum = (sum & 0xFFFF) + (sum >> 16);
+	return static_cast<uint16_t>(~sum);
+}
+
+#endif
@@ -3,7 +3,10 @@
 
 #include <istream>
 #include <ostream>
+#include <sstream>
 #include <algorithm>
+#include <iterator>
+#include <checksum.hpp>
 #include <utils.hpp>
 
 /* 
@@ -205,18 +208,18 @@ class icmp_header {
 			return (buffer_[6] << 8) | buffer_[7];
 		}
 	
+		///@brief Checksum over header and body, the body has to be contiguous like a vector, string or array.
 		template <typename Iterator>
-		void calculate_checksum(Iterator body_begin, Iterator body_end) {
-			unsigned int sum = ((buffer_[0] << 8) | buffer_[1]) + ((buffer_[4] << 8) | buffer_[5]) + ((buffer_[6] << 8) | buffer_[7]);
-			Iterator body_iter = body_begin;
-			while (body_iter != body_end) {
-			sum += (static_cast<unsigned char>(*body_iter++) << 8);
-			if (body_iter != body_end)
-				sum += static_cast<unsigned char>(*body_iter++);
-			}
-			sum = (sum >> 16) + (sum & 0xFFFF);
-			sum += (sum >> 16);
-			checksum(static_cast<uint16_t>(~sum));
+		void calculate_checksum(Iterator body_begin, Iterator body_end)
+		{
+			std::size_t length = std::distance(body_begin, body_end);
+			calculate_checksum(length == 0 ? 0 : reinterpret_cast<const uint8_t*>(&*body_begin), length);
+		}
+		
+		void calculate_checksum(const uint8_t* body, std::size_t length)
+		{
+			checksum(0);
+			checksum(checksum_finish(checksum_add(body, length, checksum_add(buffer_.data(), buffer_.size()))));
 		}
 		 
 	public: 
@@ -296,4 +299,85 @@ class icmp_payload {
 		boost::array<uint8_t, 1472> buffer_;
 		uint16_t length_;
 };
+
+/// @brief Read-only view of an ICMP header in place in a received buffer, use only if valid().
+class icmp_header_view {
+
+	public:
+
+		icmp_header_view()
+		: data_(0),
+		  length_(0)
+		{}
+
+		icmp_header_view(const uint8_t* data, std::size_t length)
+		: data_(data),
+		  length_(length)
+		{}
+
+		bool valid() const
+		{
+			return data_ != 0 && length_ >= 8;
+		}
+
+		uint8_t type() const
+		{ 
+			return data_[0]; 
+		}
+
+		uint8_t code() const
+		{ 
+			return data_[1]; 
+		}
+
+		uint16_t checksum() const
+		{ 
+			return (data_[2] << 8) | data_[3];
+		}
+
+		uint16_t identifier() const
+		{ 
+			return (data_[4] << 8) | data_[5];
+		}
+
+		uint16_t sequence_number() const
+		{ 
+			return (data_[6] << 8) | data_[7];
+		}
+
+		///@brief True for the messages that quote the header of the packet that caused them.
+		bool is_error() const
+		{
+			return type() == icmp_header::destination_unreachable || type() == icmp_header::source_quench || type() == icmp_header::redirect || type() == icmp_header::time_exceeded || type() == icmp_header::parameter_problem;
+		}
+
+	public:
+
+		std::size_t size() const
+		{ 
+			return 8; 
+		}
+
+		const uint8_t* data() const
+		{
+			return data_;
+		}
+
+		///@brief The echo data, or the quoted IP header of an error message.
+		const uint8_t* payload() const
+		{
+			return data_ + 8;
+		}
+
+		std::size_t payload_length() const
+		{
+			return length_ - 8;
+		}
+
+	private:
+
+		const uint8_t* data_;
+		std::size_t length_;
+};
+
 #endif
@@ -5,6 +5,7 @@
 #include <iomanip>
 #include <sstream>
 #include <boost/asio/ip/address_v4.hpp>
+#include <checksum.hpp>
 #include <utils.hpp>
 
 /*
@@ -185,22 +186,9 @@ class ipv4_header
 		
 		void calculate_checksum()
 		{
-			// Zero out the checksum
+			// the checksum field takes part in the sum, so it is zeroed first
 			checksum(0);
-			// Checksum is the 16-bit one's complement of the one's complement sum of
-			// all 16-bit words in the header.
-			// Sum all 16-bit words.
-			auto data = buffer_.data();
-			auto sum = std::accumulate<uint16_t*, uint32_t>(
-				reinterpret_cast<uint16_t*>(&data[0]),
-				reinterpret_cast<uint16_t*>(&data[0] + buffer_.size()),
-			0);
-			// Fold 32-bit into 16-bits.
-			while (sum >> 16)
-			{
-				sum = (sum & 0xFFFF) + (sum >> 16);
-			}
-			checksum(~sum);
+			checksum(internet_checksum(buffer_.data(), buffer_.size()));
 		}
 
 	public:
@@ -246,4 +234,123 @@ class ipv4_header
 		boost::array<uint8_t, 40> options_;
 };
 
+/// @brief Read-only view of an IPv4 header in place in a received buffer.
+///
+/// Nothing is copied, the fields are read straight from the bytes. The
+/// accessors may only be used once valid() confirmed that the buffer holds
+/// the whole header including its options.
+class ipv4_header_view
+{
+	public:
+
+		ipv4_header_view()
+		: data_(0),
+		  length_(0)
+		{}
+
+		ipv4_header_view(const uint8_t* data, std::size_t length)
+		: data_(data),
+		  length_(length)
+		{}
+
+		bool valid() const
+		{
+			return data_ != 0 && length_ >= 20 && version() == 4 && header_length() >= 5 && size() <= length_;
+		}
+
+		uint8_t version() const
+		{
+			return (data_[0] >> 4) & 0x0F;
+		}
+
+		uint8_t header_length() const
+		{
+			return data_[0] & 0x0F;
+		}
+
+		uint8_t type_of_service() const
+		{
+			return data_[1];
+		}
+
+		uint16_t total_length() const
+		{
+			return (data_[2] << 8) | data_[3];
+		}
+
+		uint16_t identification() const
+		{
+			return (data_[4] << 8) | data_[5];
+		}
+
+		bool dont_fragment() const
+		{
+			return data_[6] & 0x40;
+		}
+
+		bool more_fragments() const
+		{
+			return data_[6] & 0x20;
+		}
+
+		uint16_t fragment_offset() const
+		{
+			return ((data_[6] << 8) | data_[7]) & 0x1FFF;
+		}
+
+		uint8_t time_to_live() const
+		{
+			return data_[8];
+		}
+
+		uint8_t protocol() const
+		{
+			return data_[9];
+		}
+
+		uint16_t checksum() const
+		{
+			return (data_[10] << 8) | data_[11];
+		}
+
+		boost::asio::ip::address_v4 source_address() const
+		{
+			return boost::asio::ip::address_v4({data_[12], data_[13], data_[14], data_[15]});
+		}
+
+		boost::asio::ip::address_v4 destination_address() const
+		{
+			return boost::asio::ip::address_v4({data_[16], data_[17], data_[18], data_[19]});
+		}
+
+	public:
+
+		///@brief Length of the header including options.
+		std::size_t size() const
+		{
+			return header_length() * 4;
+		}
+
+		const uint8_t* data() const
+		{
+			return data_;
+		}
+
+		///@brief The bytes following the header in the buffer.
+		const uint8_t* payload() const
+		{
+			return data_ + size();
+		}
+
+		std::size_t payload_length() const
+		{
+			return length_ - size();
+		}
+
+	private:
+
+		const uint8_t* data_;
+		std::size_t length_;
+};
+
 #endif
@@ -0,0 +1,202 @@
+#ifndef PROTOCOL_PACKET_TEMPLATE
+#define PROTOCOL_PACKET_TEMPLATE
+
+#include <vector>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/ip/address_v4.hpp>
+#include <checksum.hpp>
+#include <icmp_header.hpp>
+#include <ipv4_header.hpp>
+#include <udp_header.hpp>
+
+/// @brief A complete IPv4 datagram built once and patched for every send.
+///
+/// The headers and checksums are computed when the template is built. The
+/// setters only rewrite the field that changes and fold the difference into
+/// the affected checksum (rfc1624), so a send costs a few stores instead of
+/// building and checksumming the headers again.
+class packet_template
+{
+	public:
+		
+		packet_template()
+		: transport_checksum_(0)
+		{}
+		
+		///@brief Build an IPv4 + UDP datagram, a null payload is zero filled.
+		void udp(const boost::asio::ip::address_v4& source, const boost::asio::ip::address_v4& destination, uint16_t source_port, uint16_t destination_port, const uint8_t* payload, std::size_t payload_size)
+		{
+			udp_header udp;
+			udp.source_port(source_port);
+			udp.destination_port(destination_port);
+			udp.length(static_cast<uint16_t>(udp.size() + payload_size));
+			udp.checksum(0);
+			
+			build(source, destination, ipv4_header::protocol::udp, udp.data().begin(), udp.data().end(), payload, payload_size);
+			transport_checksum_ = ip_size + 6;
+			
+			// some middleboxes drop UDP without a checksum, it is computed over the built datagram with its zero filled payload
+			uint16_t checksum = udp_checksum(source, destination, &buffer_[ip_size], buffer_.size() - ip_size);
+			buffer_[transport_checksum_] = (checksum >> 8) & 0xFF;
+			buffer_[transport_checksum_ + 1] = checksum & 0xFF;
+		}
+		
+		///@brief Build an IPv4 + ICMP echo request, a null payload is zero filled.
+		void icmp_echo(const boost::asio::ip::address_v4& source, const boost::asio::ip::address_v4& destination, uint16_t identifier, uint16_t sequence_number, const uint8_t* payload, std::size_t payload_size)
+		{
+			icmp_header icmp;
+			icmp.type(icmp_header::echo_request);
+			icmp.code(0);
+			icmp.identifier(identifier);
+			icmp.sequence_number(sequence_number);
+			
+			build(source, destination, ipv4_header::protocol::icmp, icmp.data().begin(), icmp.data().end(), payload, payload_size);
+			transport_checksum_ = ip_size + 2;
+			
+			// the checksum covers the zero filled payload as built
+			uint16_t checksum = internet_checksum(&buffer_[ip_size], buffer_.size() - ip_size);
+			buffer_[transport_checksum_] = (checksum >> 8) & 0xFF;
+			buffer_[transport_checksum_ + 1] = checksum & 0xFF;
+		}
+		
+		void time_to_live(uint8_t value)
+		{
+			// TTL shares its 16-bit word with the protocol
+			update(8, static_cast<uint16_t>((value << 8) | buffer_[9]), 10);
+		}
+		
+		void identification(uint16_t value)
+		{
+			update(4, value, 10);
+		}
+		
+		void source_port(uint16_t value)
+		{
+			update(ip_size, value, transport_checksum_);
+		}
+		
+		void destination_port(uint16_t value)
+		{
+			update(ip_size + 2, value, transport_checksum_);
+		}
+		
+		void identifier(uint16_t value)
+		{
+			update(ip_size + 4, value, transport_checksum_);
+		}
+		
+		void sequence_number(uint16_t value)
+		{
+			update(ip_size + 6, value, transport_checksum_);
+		}
+		
+		void destination_address(const boost::asio::ip::address_v4& value)
+		{
+			uint32_t bits = value.to_uint();
+			for(std::size_t offset = 16; offset < 20; offset += 2)
+			{
+				uint16_t word = static_cast<uint16_t>(offset == 16 ? bits >> 16 : bits & 0xFFFF);
+				// the UDP checksum covers the addresses through the pseudo header
+				if(transport_checksum_ == ip_size + 6)
+					adjust(transport_checksum_, word_at(offset), word);
+				update(offset, word, 10);
+			}
+		}
+		
+		///@brief Rewrite the 16-bit word at offset of the payload.
+		void payload_word(std::size_t offset, uint16_t value)
+		{
+			update(ip_size + 8 + offset, value, transport_checksum_);
+		}
+		
+		///@brief Make the transport checksum value by rewriting the payload word at offset, the datagram stays valid.
+		void transport_checksum(uint16_t value, std::size_t offset)
+		{
+			// with the checksum at value the payload word has to make up the difference - rfc1624 solved for m'
+			std::size_t word_offset = ip_size + 8 + offset;
+			uint32_t sum = static_cast<uint16_t>(~value) + static_cast<uint32_t>(word_at(transport_checksum_)) + word_at(word_offset);
+			sum = (sum & 0xFFFF) + (sum >> 16);
+			sum = (sum & 0xFFFF) + (sum >> 16);
+			write(word_offset, static_cast<uint16_t>(sum));
+			// zero would mean no checksum for UDP, 0xFFFF is the same in one's complement
+			write(transport_checksum_, value == 0 && transport_checksum_ == ip_size + 6 ? 0xFFFF : value);
+		}
+		
+		static const std::size_t ip_size = 20;
+		
+		const uint8_t* data() const
+		{
+			return buffer_.data();
+		}
+		
+		std::size_t size() const
+		{
+			return buffer_.size();
+		}
+		
+		boost::asio::const_buffer buffer() const
+		{
+			return boost::asio::buffer(buffer_);
+		}
+		
+	private:
+		
+		template <typename Iterator>
+		void build(const boost::asio::ip::address_v4& source, const boost::asio::ip::address_v4& destination, uint8_t protocol, Iterator transport_begin, Iterator transport_end, const uint8_t* payload, std::size_t payload_size)
+		{
+			std::size_t transport_size = std::distance(transport_begin, transport_end);
+			
+			ipv4_header ip;
+			ip.version(4);
+			ip.header_length(ip.size() / 4);
+			ip.type_of_service(0);
+			ip.total_length(static_cast<uint16_t>(ip.size() + transport_size + payload_size));
+			ip.identification(0);
+			ip.dont_fragment(false);
+			ip.more_fragments(false);
+			ip.fragment_offset(0);
+			ip.time_to_live(255);
+			ip.source_address(source);
+			ip.destination_address(destination);
+			ip.protocol(protocol);
+			ip.calculate_checksum();
+			
+			buffer_.assign(ip.size() + transport_size + payload_size, 0);
+			std::copy(ip.data().begin(), ip.data().end(), buffer_.begin());
+			std::copy(transport_begin, transport_end, buffer_.begin() + ip.size());
+			if(payload)
+				std::copy(payload, payload + payload_size, buffer_.begin() + ip.size() + transport_size);
+		}
+		
+		void update(std::size_t offset, uint16_t value, std::size_t checksum_offset)
+		{
+			uint16_t old_value = word_at(offset);
+			write(offset, value);
+			adjust(checksum_offset, old_value, value);
+		}
+		
+		void adjust(std::size_t checksum_offset, uint16_t old_value, uint16_t value)
+		{
+			uint16_t checksum = checksum_adjust(word_at(checksum_offset), old_value, value);
+			// zero would mean no checksum for UDP
+			if(checksum == 0 && checksum_offset == ip_size + 6)
+				checksum = 0xFFFF;
+			write(checksum_offset, checksum);
+		}
+		
+		uint16_t word_at(std::size_t offset) const
+		{
+			return static_cast<uint16_t>((buffer_[offset] << 8) | buffer_[offset + 1]);
+		}
+		
+		void write(std::size_t offset, uint16_t value)
+		{
+			buffer_[offset] = (value >> 8) & 0xFF;
+			buffer_[offset + 1] = value & 0xFF;
+		}
+		
+		std::vector<uint8_t> buffer_;
+		std::size_t transport_checksum_;
+};
+
+#endif
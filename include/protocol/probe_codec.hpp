@@ -0,0 +1,170 @@
+#ifndef PROTOCOL_PROBE_CODEC
+#define PROTOCOL_PROBE_CODEC
+
+#include <cstring>
+#include <boost/array.hpp>
+#include <boost/asio/ip/address_v4.hpp>
+#include <boost/cstdint.hpp>
+#include <checksum.hpp>
+#include <icmp_header.hpp>
+#include <ipv4_header.hpp>
+#include <packet_template.hpp>
+#include <udp_header.hpp>
+
+/// @brief Stateless probe encoding in the style of Yarrp, replies describe the probe they answer.
+///
+/// Everything needed to match a reply travels in fields that ICMP errors
+/// quote back. The IP identification holds the TTL in its low byte and a
+/// byte of a keyed hash of the target in its high byte. An ICMP probe has
+/// the send stamp in its sequence number and the TTL again in its payload,
+/// for the echo reply of the target. Two more payload bytes make its ICMP
+/// checksum 16 further bits of the hash, so all probes to a target look like
+/// one flow to load balancers. A UDP probe has 15 bits of the hash in its
+/// source port, and the payload makes its UDP checksum the send stamp. A
+/// reply is taken if the hash recomputed for the quoted destination matches,
+/// nothing is kept per probe. The ICMP identifier or the UDP destination
+/// port tells apart the shards of the workers.
+class probe_codec
+{
+	public:
+
+		enum probe_type
+		{
+			icmp,
+			udp
+		};
+
+		///@brief A validated reply.
+		struct reply
+		{
+			uint32_t target;
+			uint32_t responder;
+			uint8_t ttl;
+			uint8_t icmp_type;
+			uint8_t icmp_code;
+			uint8_t reply_ttl;
+			///@brief The send stamp the probe was encoded with.
+			uint16_t stamp;
+			///@brief The target answered itself.
+			bool destination;
+		};
+
+		static const std::size_t payload_size = 4;
+
+		///@brief Probes of type from source, key seeds the hash, identifier is the ICMP identifier or the UDP destination port.
+		probe_codec(probe_type type, uint64_t key, uint16_t identifier, const boost::asio::ip::address_v4& source)
+		: type_(type),
+		  key_(key),
+		  identifier_(identifier)
+		{
+			const uint8_t payload[payload_size] = { 0 };
+			if(type_ == udp)
+				template_.udp(source, boost::asio::ip::address_v4::any(), 0, identifier_, payload, payload_size);
+			else
+				template_.icmp_echo(source, boost::asio::ip::address_v4::any(), identifier_, 0, payload, payload_size);
+		}
+
+		///@brief The probe to target at ttl sent at stamp, valid until the next call.
+		const packet_template& encode(uint32_t target, uint8_t ttl, uint16_t stamp)
+		{
+			uint32_t hash = hash_of(target);
+			template_.destination_address(boost::asio::ip::address_v4(target));
+			template_.time_to_live(ttl);
+			template_.identification(static_cast<uint16_t>((hash >> 16 & 0xFF00) | ttl));
+			if(type_ == udp)
+			{
+				template_.source_port(static_cast<uint16_t>(0x8000 | (hash & 0x7FFF)));
+				template_.transport_checksum(stamp, 2);
+			}
+			else
+			{
+				template_.sequence_number(stamp);
+				template_.payload_word(0, static_cast<uint16_t>(ttl << 8));
+				template_.transport_checksum(static_cast<uint16_t>(hash), 2);
+			}
+			return template_;
+		}
+
+		///@brief Fill in result if the datagram answers one of our probes.
+		bool decode(const uint8_t* data, std::size_t length, reply& result) const
+		{
+			ipv4_header_view outer(data, length);
+			if(!outer.valid() || outer.protocol() != ipv4_header::protocol::icmp)
+				return false;
+			icmp_header_view message(outer.payload(), outer.payload_length());
+			if(!message.valid())
+				return false;
+
+			result.responder = outer.source_address().to_uint();
+			result.reply_ttl = outer.time_to_live();
+			result.icmp_type = message.type();
+			result.icmp_code = message.code();
+
+			if(message.type() == icmp_header::echo_reply)
+			{
+				if(type_ != icmp || message.identifier() != identifier_ || message.payload_length() < payload_size)
+					return false;
+				// the echo request as it was sent checksums to zero, with the hash of the target as its checksum
+				uint8_t request[8 + payload_size];
+				std::memcpy(request, message.data(), sizeof(request));
+				uint32_t hash = hash_of(result.responder);
+				request[0] = icmp_header::echo_request;
+				request[1] = 0;
+				request[2] = static_cast<uint8_t>(hash >> 8);
+				request[3] = static_cast<uint8_t>(hash);
+				if(internet_checksum(request, sizeof(request)) != 0)
+					return false;
+				result.target = result.responder;
+				result.ttl = message.payload()[0];
+				result.stamp = message.sequence_number();
+				result.destination = true;
+				return result.ttl != 0;
+			}
+
+			if(message.type() != icmp_header::time_exceeded && message.type() != icmp_header::destination_unreachable)
+				return false;
+			ipv4_header_view inner(message.payload(), message.payload_length());
+			if(!inner.valid())
+				return false;
+			result.target = inner.destination_address().to_uint();
+			uint32_t hash = hash_of(result.target);
+			if((inner.identification() & 0xFF00) != (hash >> 16 & 0xFF00))
+				return false;
+			result.ttl = static_cast<uint8_t>(inner.identification());
+			result.destination = result.responder == result.target;
+
+			if(type_ == udp)
+			{
+				udp_header_view quoted(inner.payload(), inner.payload_length());
+				if(inner.protocol() != ipv4_header::protocol::udp || !quoted.valid() || quoted.source_port() != (0x8000 | (hash & 0x7FFF)) || quoted.destination_port() != identifier_)
+					return false;
+				result.stamp = quoted.checksum();
+			}
+			else
+			{
+				icmp_header_view quoted(inner.payload(), inner.payload_length());
+				if(inner.protocol() != ipv4_header::protocol::icmp || !quoted.valid() || quoted.type() != icmp_header::echo_request || quoted.identifier() != identifier_ || quoted.checksum() != static_cast<uint16_t>(hash))
+					return false;
+				result.stamp = quoted.sequence_number();
+			}
+			return result.ttl != 0;
+		}
+
+	private:
+
+		///@brief Keyed mix of the target address, splitmix64 finalizer.
+		uint32_t hash_of(uint32_t target) const
+		{
+			uint64_t z = key_ + target * 0x9E3779B97F4A7C15ull;
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+			return static_cast<uint32_t>((z ^ (z >> 31)) >> 32);
+		}
+
+		probe_type type_;
+		uint64_t key_;
+		uint16_t identifier_;
+		packet_template template_;
+};
+
+#endif
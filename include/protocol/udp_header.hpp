@@ -5,6 +5,7 @@
 #include <iomanip>
 #include <sstream>
 #include <boost/asio/ip/address_v4.hpp>
+#include <checksum.hpp>
 #include <utils.hpp>
 
 /*
@@ -74,6 +75,15 @@ class udp_header
 			return (buffer_[6] << 8) | buffer_[7];
 		}
 
+		///@brief Checksum over pseudo header, header and payload, length has to be set before.
+		void calculate_checksum(const boost::asio::ip::address_v4& source, const boost::asio::ip::address_v4& destination, const uint8_t* payload, std::size_t payload_size)
+		{
+			checksum(0);
+			uint32_t sum = checksum_add(buffer_.data(), buffer_.size(), pseudo_header_sum(source, destination, 17, length()));
+			uint16_t result = checksum_finish(checksum_add(payload, payload_size, sum));
+			checksum(result == 0 ? 0xFFFF : result);
+		}
+
 	public:
 
 		std::size_t size()
@@ -103,4 +113,62 @@ class udp_header
 		boost::array<uint8_t, 8> buffer_;
 };
 
+/// @brief Read-only view of a UDP header in place in a received buffer, use only if valid().
+class udp_header_view
+{
+	public:
+
+		udp_header_view()
+		: data_(0),
+		  length_(0)
+		{}
+
+		udp_header_view(const uint8_t* data, std::size_t length)
+		: data_(data),
+		  length_(length)
+		{}
+
+		bool valid() const
+		{
+			return data_ != 0 && length_ >= 8;
+		}
+
+		uint16_t source_port() const
+		{ 
+			return (data_[0] << 8) | data_[1];
+		}
+
+		uint16_t destination_port() const
+		{ 
+			return (data_[2] << 8) | data_[3];
+		}
+
+		uint16_t length() const
+		{ 
+			return (data_[4] << 8) | data_[5];
+		}
+
+		uint16_t checksum() const
+		{ 
+			return (data_[6] << 8) | data_[7];
+		}
+
+	public:
+
+		std::size_t size() const
+		{ 
+			return 8; 
+		}
+
+		const uint8_t* data() const
+		{
+			return data_;
+		}
+
+	private:
+
+		const uint8_t* data_;
+		std::size_t length_;
+};
+
 #endif
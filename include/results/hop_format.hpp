@@ -0,0 +1,127 @@
+#ifndef RESULTS_HOP_FORMAT
+#define RESULTS_HOP_FORMAT
+
+#include <cstddef>
+#include <boost/cstdint.hpp>
+
+/*
+	Binary hop record file
+
+	+--------------------+
+	| hop_file_header    |  64 bytes, record and block count, index offset
+	+--------------------+
+	| block 0            |  hop_block_header, then one column per field
+	| block 1            |
+	| ...                |
+	+--------------------+
+	| hop_index_entry[]  |  one per block, written when the file is closed
+	+--------------------+
+
+	Every block holds up to block_capacity records, stored column by column:
+	rtt_ns, target, responder, ttl, icmp_type, icmp_code, reply_ttl and flags.
+	Each column starts 8-byte aligned, so a reader that maps the file can use
+	the columns in place. Values are in the byte order of the host that wrote
+	the file, addresses as the host order integer of the IPv4 address. A file
+	whose writer did not finish has no index, the blocks can still be walked
+	one after the other from the header.
+*/
+
+namespace hop_format
+{
+	static const char magic[8] = { 'R', 'T', 'I', 'H', 'O', 'P', 'S', 0 };
+	static const uint32_t version = 1;
+	static const uint32_t byte_order = 0x01020304;
+}
+
+///@brief Flags of a hop record.
+namespace hop_flags
+{
+	///@brief The responder is the target itself.
+	static const uint8_t destination = 1;
+	///@brief The probe was a UDP datagram, an ICMP echo request otherwise.
+	static const uint8_t udp = 2;
+	///@brief The round trip time was taken from kernel timestamps.
+	static const uint8_t kernel_time = 4;
+	///@brief The hop was not probed, an incremental trace took it from the topology store.
+	static const uint8_t cached = 8;
+}
+
+///@brief One answered probe of a trace.
+struct hop_record
+{
+	uint32_t target;
+	uint32_t responder;
+	uint64_t rtt_ns;
+	uint8_t ttl;
+	uint8_t icmp_type;
+	uint8_t icmp_code;
+	uint8_t reply_ttl;
+	uint8_t flags;
+};
+
+struct hop_file_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t block_capacity;
+	uint32_t reserved;
+	uint64_t record_count;
+	uint64_t block_count;
+	///@brief Offset of the block index, 0 while the file is being written.
+	uint64_t index_offset;
+	uint8_t padding[16];
+};
+
+struct hop_block_header
+{
+	uint32_t count;
+	uint32_t reserved;
+	///@brief Size of the block including this header.
+	uint64_t size;
+};
+
+struct hop_index_entry
+{
+	uint64_t offset;
+	uint64_t first_record;
+	uint32_t count;
+	///@brief Range of the targets in the block, to skip blocks when looking for one.
+	uint32_t min_target;
+	uint32_t max_target;
+	uint32_t reserved;
+};
+
+///@brief Offsets of the columns of a block of count records, from the start of the block.
+struct hop_block_layout
+{
+	explicit hop_block_layout(uint32_t count)
+	{
+		rtt_ns = sizeof(hop_block_header);
+		target = rtt_ns + align(count * sizeof(uint64_t));
+		responder = target + align(count * sizeof(uint32_t));
+		ttl = responder + align(count * sizeof(uint32_t));
+		icmp_type = ttl + align(count);
+		icmp_code = icmp_type + align(count);
+		reply_ttl = icmp_code + align(count);
+		flags = reply_ttl + align(count);
+		size = flags + align(count);
+	}
+
+	static std::size_t align(std::size_t length)
+	{
+		return (length + 7) & ~static_cast<std::size_t>(7);
+	}
+
+	std::size_t rtt_ns;
+	std::size_t target;
+	std::size_t responder;
+	std::size_t ttl;
+	std::size_t icmp_type;
+	std::size_t icmp_code;
+	std::size_t reply_ttl;
+	std::size_t flags;
+	std::size_t size;
+};
+
+#endif
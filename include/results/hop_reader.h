@@ -0,0 +1,154 @@
+#ifndef RESULTS_HOP_READER
+#define RESULTS_HOP_READER
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include <boost/asio/ip/address_v4.hpp>
+#include <hop_format.hpp>
+
+/// @brief Columns of one block of a mapped hop record file, valid as long as its hop_reader.
+class hop_block
+{
+	public:
+
+		hop_block(const uint8_t* block, uint32_t count, uint64_t first_record) :
+			block_(block),
+			count_(count),
+			first_record_(first_record),
+			layout_(count)
+		{
+		}
+
+		std::size_t size() const
+		{
+			return count_;
+		}
+
+		///@brief Number of the first record of the block in the whole file.
+		uint64_t first_record() const
+		{
+			return first_record_;
+		}
+
+		const uint64_t* rtt_ns() const
+		{
+			return reinterpret_cast<const uint64_t*>(block_ + layout_.rtt_ns);
+		}
+
+		const uint32_t* targets() const
+		{
+			return reinterpret_cast<const uint32_t*>(block_ + layout_.target);
+		}
+
+		const uint32_t* responders() const
+		{
+			return reinterpret_cast<const uint32_t*>(block_ + layout_.responder);
+		}
+
+		const uint8_t* ttls() const
+		{
+			return block_ + layout_.ttl;
+		}
+
+		const uint8_t* icmp_types() const
+		{
+			return block_ + layout_.icmp_type;
+		}
+
+		const uint8_t* icmp_codes() const
+		{
+			return block_ + layout_.icmp_code;
+		}
+
+		const uint8_t* reply_ttls() const
+		{
+			return block_ + layout_.reply_ttl;
+		}
+
+		const uint8_t* flags() const
+		{
+			return block_ + layout_.flags;
+		}
+
+		hop_record record(std::size_t i) const
+		{
+			hop_record record;
+			record.target = targets()[i];
+			record.responder = responders()[i];
+			record.rtt_ns = rtt_ns()[i];
+			record.ttl = ttls()[i];
+			record.icmp_type = icmp_types()[i];
+			record.icmp_code = icmp_codes()[i];
+			record.reply_ttl = reply_ttls()[i];
+			record.flags = flags()[i];
+			return record;
+		}
+
+	private:
+
+		const uint8_t* block_;
+		uint32_t count_;
+		uint64_t first_record_;
+		hop_block_layout layout_;
+};
+
+/// @brief Maps a hop record file read-only and hands out its blocks without copying.
+///
+/// The file is checked once when it is opened, a damaged or foreign file
+/// throws std::runtime_error. A file without index, because its writer did
+/// not finish, is indexed by walking its blocks.
+class hop_reader
+{
+	public:
+
+		explicit hop_reader(const std::string& path);
+
+		~hop_reader();
+
+		uint64_t size() const
+		{
+			return records_;
+		}
+
+		std::size_t block_count() const
+		{
+			return index_.size();
+		}
+
+		hop_block block(std::size_t i) const
+		{
+			return hop_block(data_ + index_[i].offset, index_[i].count, index_[i].first_record);
+		}
+
+		const hop_index_entry& index(std::size_t i) const
+		{
+			return index_[i];
+		}
+
+		///@brief Blocks that may hold records of target, judged by their index entries.
+		std::vector<std::size_t> blocks_for(const boost::asio::ip::address_v4& target) const;
+
+	private:
+
+		hop_reader(const hop_reader&);
+
+		hop_reader& operator=(const hop_reader&);
+
+		void load_index(const std::string& path);
+
+		void scan_blocks(const std::string& path);
+
+		const uint8_t* data_;
+		std::size_t length_;
+		uint64_t records_;
+		std::vector<hop_index_entry> index_;
+};
+
+///@brief Write all records as CSV with a header line.
+void write_csv(const hop_reader& reader, std::ostream& os);
+
+///@brief Write all records as a JSON array of objects, one per line.
+void write_json(const hop_reader& reader, std::ostream& os);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef RESULTS_HOP_WRITER
+#define RESULTS_HOP_WRITER
+
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <hop_format.hpp>
+
+/// @brief Writes hop records to a binary hop record file.
+///
+/// Records are gathered column by column and written a block at a time, the
+/// index and the final header follow on close(). Engines on several workers
+/// may share one writer, append() takes a lock per call.
+class hop_writer
+{
+	public:
+
+		hop_writer(const std::string& path, uint32_t block_capacity = 65536);
+
+		~hop_writer();
+
+		void append(const std::vector<hop_record>& records);
+
+		///@brief Write the last block, the index and the header, the file is complete afterwards.
+		void close();
+
+	private:
+
+		hop_writer(const hop_writer&);
+
+		hop_writer& operator=(const hop_writer&);
+
+		void write_block();
+
+		void write(const void* data, std::size_t length);
+
+		template <typename Value>
+		void write_column(std::vector<Value>& column);
+
+		std::mutex mutex_;
+		std::FILE* file_;
+		std::string path_;
+		hop_file_header header_;
+		uint64_t offset_;
+		std::vector<hop_index_entry> index_;
+
+		std::vector<uint64_t> rtt_ns_;
+		std::vector<uint32_t> target_;
+		std::vector<uint32_t> responder_;
+		std::vector<uint8_t> ttl_;
+		std::vector<uint8_t> icmp_type_;
+		std::vector<uint8_t> icmp_code_;
+		std::vector<uint8_t> reply_ttl_;
+		std::vector<uint8_t> flags_;
+};
+
+#endif
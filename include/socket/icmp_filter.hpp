@@ -0,0 +1,152 @@
+#ifndef SOCKET_ICMP_FILTER
+#define SOCKET_ICMP_FILTER
+
+#include <vector>
+#include <linux/filter.h>
+#include <linux/if_packet.h>
+#include <sys/socket.h>
+
+#include <boost/cstdint.hpp>
+
+/// @brief Classic BPF program that keeps the ICMP replies to our own probes and drops the rest in the kernel.
+///
+/// Echo replies pass if their identifier is in the range. Time exceeded and
+/// destination unreachable messages pass if the header they quote is one of
+/// our ICMP echo requests with an identifier in the range, or one of our UDP
+/// datagrams with a source port in it and, if one is given, the destination
+/// port of the shard. The range may wrap around 65535. The
+/// program reads the packet from the IPv4 header on, where raw ICMP sockets
+/// and SOCK_DGRAM packet sockets both start, so the userspace checks of the
+/// receivers stay as they are and only see less.
+class icmp_filter
+{
+	public:
+
+		enum probe_type { icmp, udp };
+
+		///@brief Replies to probes of type with identifiers, or UDP source ports, from first to last, to UDP destination port unless it is 0.
+		icmp_filter(probe_type type, uint16_t first, uint16_t last, uint16_t port = 0)
+		: type_(type),
+		  first_(first),
+		  last_(last),
+		  port_(port)
+		{
+		}
+
+		///@brief The program, packet sockets also drop what is not addressed to this host.
+		std::vector<sock_filter> program(bool packet_socket = false) const
+		{
+			std::vector<sock_filter> code;
+			std::vector<std::size_t> jumps;
+			std::size_t marks[labels] = { 0 };
+
+			if(packet_socket)
+			{
+				// the ring sees our own probes leave as well
+				emit(code, BPF_LD | BPF_B | BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE);
+				jump(code, jumps, BPF_JEQ, PACKET_HOST, next, drop);
+			}
+			emit(code, BPF_LD | BPF_B | BPF_ABS, 9);
+			jump(code, jumps, BPF_JEQ, 1, next, drop);
+			// X is the length of the outer IPv4 header, the ICMP header follows
+			emit(code, BPF_LDX | BPF_B | BPF_MSH, 0);
+			emit(code, BPF_LD | BPF_B | BPF_IND, 0);
+			jump(code, jumps, BPF_JEQ, 0, type_ == icmp ? echo : drop, next);
+			jump(code, jumps, BPF_JEQ, 11, quoted, next);
+			jump(code, jumps, BPF_JEQ, 3, quoted, drop);
+
+			marks[echo] = code.size();
+			emit(code, BPF_LD | BPF_H | BPF_IND, 4);
+			range(code, jumps, accept);
+
+			// the quoted IPv4 header starts 8 bytes into the ICMP message, its protocol is byte 9
+			marks[quoted] = code.size();
+			emit(code, BPF_LD | BPF_B | BPF_IND, 8 + 9);
+			jump(code, jumps, BPF_JEQ, type_ == icmp ? 1 : 17, next, drop);
+			emit(code, BPF_LD | BPF_B | BPF_IND, 8);
+			emit(code, BPF_ALU | BPF_AND | BPF_K, 0x0F);
+			emit(code, BPF_ALU | BPF_LSH | BPF_K, 2);
+			emit(code, BPF_ALU | BPF_ADD | BPF_X, 0);
+			emit(code, BPF_ALU | BPF_ADD | BPF_K, 8);
+			emit(code, BPF_MISC | BPF_TAX, 0);
+			// the echo identifier is at 4, the UDP source port at 0 of the quoted payload
+			emit(code, BPF_LD | BPF_H | BPF_IND, type_ == icmp ? 4 : 0);
+			range(code, jumps, type_ == udp && port_ != 0 ? port : accept);
+
+			// the UDP destination port is at 2
+			marks[port] = code.size();
+			if(type_ == udp && port_ != 0)
+			{
+				emit(code, BPF_LD | BPF_H | BPF_IND, 2);
+				jump(code, jumps, BPF_JEQ, port_, accept, drop);
+			}
+
+			marks[accept] = code.size();
+			emit(code, BPF_RET | BPF_K, 0xFFFF);
+			marks[drop] = code.size();
+			emit(code, BPF_RET | BPF_K, 0);
+
+			// jumps count the instructions skipped after the jump itself
+			for(std::size_t i = 0; i < jumps.size(); ++i)
+			{
+				sock_filter& instruction = code[jumps[i]];
+				std::size_t from = jumps[i] + 1;
+				label targets[2] = { static_cast<label>(instruction.jt), static_cast<label>(instruction.jf) };
+				instruction.jt = static_cast<uint8_t>(targets[0] == next ? 0 : marks[targets[0]] - from);
+				instruction.jf = static_cast<uint8_t>(targets[1] == next ? 0 : marks[targets[1]] - from);
+			}
+			return code;
+		}
+
+		///@brief Attach the program to the socket fd before the first probe leaves. False if the kernel refused it.
+		bool attach(int fd, bool packet_socket = false) const
+		{
+			std::vector<sock_filter> code = program(packet_socket);
+			sock_fprog program;
+			program.len = static_cast<unsigned short>(code.size());
+			program.filter = &code[0];
+			if(::setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)) != 0)
+				return false;
+
+			// what the socket queued since it was opened passed no filter, a ring is walked in userspace anyway
+			uint8_t discarded[64];
+			while(!packet_socket && ::recv(fd, discarded, sizeof(discarded), MSG_DONTWAIT | MSG_TRUNC) >= 0)
+				;
+			return true;
+		}
+
+	private:
+
+		enum label { next, echo, quoted, port, accept, drop, labels };
+
+		static void emit(std::vector<sock_filter>& code, uint16_t opcode, uint32_t k)
+		{
+			sock_filter instruction = { opcode, 0, 0, k };
+			code.push_back(instruction);
+		}
+
+		///@brief A conditional jump, the targets are resolved once the program is complete.
+		static void jump(std::vector<sock_filter>& code, std::vector<std::size_t>& jumps, uint16_t condition, uint32_t k, label taken, label not_taken)
+		{
+			sock_filter instruction = { static_cast<uint16_t>(BPF_JMP | condition | BPF_K), static_cast<uint8_t>(taken), static_cast<uint8_t>(not_taken), k };
+			jumps.push_back(code.size());
+			code.push_back(instruction);
+		}
+
+		///@brief Go on to taken if the loaded half word is in the range, drop otherwise.
+		void range(std::vector<sock_filter>& code, std::vector<std::size_t>& jumps, label taken) const
+		{
+			if(first_ <= last_)
+				jump(code, jumps, BPF_JGE, first_, next, drop);
+			else
+				jump(code, jumps, BPF_JGE, first_, taken, next);
+			jump(code, jumps, BPF_JGT, last_, drop, taken);
+		}
+
+		probe_type type_;
+		uint16_t first_;
+		uint16_t last_;
+		uint16_t port_;
+};
+
+#endif
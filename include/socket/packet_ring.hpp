@@ -0,0 +1,200 @@
+#ifndef SOCKET_PACKET_RING
+#define SOCKET_PACKET_RING
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include <boost/asio.hpp>
+#include <boost/bind/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <icmp_filter.hpp>
+#include <receive_ring.hpp>
+#include <timestamping.hpp>
+
+/// @brief Receive path for ICMP replies over an AF_PACKET socket with a TPACKET_V3 block ring.
+///
+/// The kernel fills the blocks of a ring mapped into the process with the
+/// IPv4 packets of one interface, or of all of them, and hands a block over
+/// once it is full or its retire timeout passed. Every block is walked in
+/// place, the ICMP packets addressed to this host go to the handler as views
+/// into the ring, then the block goes back to the kernel. As a block may be
+/// handed over late, the receive time of a packet is always the kernel stamp
+/// in its frame header.
+class packet_ring
+{
+	public:
+		typedef boost::function<void (const received_datagram* datagrams, std::size_t count)> handler_type;
+
+		static const std::size_t block_size = 256 * 1024;
+
+		///@brief A ring of size bytes, retire_timeout milliseconds at most before a block that is not full is handed over.
+		packet_ring(boost::asio::io_context& io_context, const std::string& interface, std::size_t size, uint32_t retire_timeout, timestamping::mode stamps = timestamping::none)
+		: descriptor_(io_context),
+		  ring_(0),
+		  block_count_(std::max<std::size_t>(2, size / block_size)),
+		  next_block_(0),
+		  running_(false)
+		{
+			int fd = ::socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_IP));
+			if(fd < 0)
+				fail("AF_PACKET socket");
+			descriptor_.assign(fd);
+
+			int version = TPACKET_V3;
+			if(::setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0)
+				fail("TPACKET_V3");
+			if(stamps == timestamping::hardware)
+			{
+				// falls back to software stamps per frame where the device has none, the frame status tells which it is
+				int source = SOF_TIMESTAMPING_RAW_HARDWARE;
+				::setsockopt(fd, SOL_PACKET, PACKET_TIMESTAMP, &source, sizeof(source));
+			}
+
+			tpacket_req3 request;
+			std::memset(&request, 0, sizeof(request));
+			request.tp_block_size = block_size;
+			request.tp_block_nr = static_cast<unsigned int>(block_count_);
+			request.tp_frame_size = 2048;
+			request.tp_frame_nr = static_cast<unsigned int>(block_size / 2048 * block_count_);
+			request.tp_retire_blk_tov = std::max<uint32_t>(1, retire_timeout);
+			if(::setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &request, sizeof(request)) != 0)
+				fail("PACKET_RX_RING");
+
+			void* ring = ::mmap(0, block_size * block_count_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, fd, 0);
+			if(ring == MAP_FAILED)
+				// locked pages may be over the limit of the user, the ring works without
+				ring = ::mmap(0, block_size * block_count_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if(ring == MAP_FAILED)
+				fail("mmap of the packet ring");
+			ring_ = static_cast<uint8_t*>(ring);
+
+			sockaddr_ll address;
+			std::memset(&address, 0, sizeof(address));
+			address.sll_family = AF_PACKET;
+			address.sll_protocol = htons(ETH_P_IP);
+			if(!interface.empty() && (address.sll_ifindex = static_cast<int>(::if_nametoindex(interface.c_str()))) == 0)
+				fail("interface " + interface);
+			if(::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+				fail("bind of the packet ring");
+
+			// a full block of the smallest ICMP packets
+			datagrams_.reserve(block_size / 64);
+		}
+
+		~packet_ring()
+		{
+			if(ring_)
+				::munmap(ring_, block_size * block_count_);
+		}
+
+		///@brief Start walking the ring, handler is called once per block with ICMP packets in it.
+		void start(const handler_type& handler)
+		{
+			handler_ = handler;
+			running_ = true;
+			async_wait();
+		}
+
+		///@brief Keep only what filter keeps in the ring, the ring sees every IPv4 packet of the interface otherwise.
+		bool filter(const icmp_filter& filter)
+		{
+			return filter.attach(descriptor_.native_handle(), true);
+		}
+
+		///@brief Stop after the current block, also from within the handler.
+		void stop()
+		{
+			running_ = false;
+			descriptor_.cancel();
+		}
+
+	private:
+		packet_ring(const packet_ring&);
+
+		packet_ring& operator=(const packet_ring&);
+
+		void fail(const std::string& what)
+		{
+			boost::system::error_code error(errno, boost::system::system_category());
+			// the destructor does not run for a ring that throws, the descriptor closes itself
+			if(ring_)
+				::munmap(ring_, block_size * block_count_);
+			ring_ = 0;
+			throw boost::system::system_error(error, "Cannot set up " + what);
+		}
+
+		void async_wait()
+		{
+			descriptor_.async_wait(boost::asio::posix::stream_descriptor::wait_read, boost::bind(&packet_ring::handle_readable, this, boost::placeholders::_1));
+		}
+
+		void handle_readable(const boost::system::error_code& error)
+		{
+			if(error || !running_)
+				return;
+
+			// at most one round over the ring keeps other handlers from starving
+			offset_.sample();
+			for(std::size_t round = 0; round < block_count_ && running_; ++round)
+			{
+				tpacket_block_desc* block = reinterpret_cast<tpacket_block_desc*>(ring_ + next_block_ * block_size);
+				if(!(block->hdr.bh1.block_status & TP_STATUS_USER))
+					break;
+				// the frames are only complete once the status says so
+				std::atomic_thread_fence(std::memory_order_acquire);
+				walk(block);
+				std::atomic_thread_fence(std::memory_order_release);
+				block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+				next_block_ = (next_block_ + 1) % block_count_;
+			}
+
+			if(running_)
+				async_wait();
+		}
+
+		void walk(const tpacket_block_desc* block)
+		{
+			datagrams_.clear();
+			const uint8_t* frame = reinterpret_cast<const uint8_t*>(block) + block->hdr.bh1.offset_to_first_pkt;
+			for(uint32_t i = 0; i < block->hdr.bh1.num_pkts; ++i)
+			{
+				const tpacket3_hdr* header = reinterpret_cast<const tpacket3_hdr*>(frame);
+				const sockaddr_ll* link = reinterpret_cast<const sockaddr_ll*>(frame + TPACKET_ALIGN(sizeof(tpacket3_hdr)));
+				const uint8_t* packet = frame + header->tp_net;
+				// the socket sees our own probes leave as well, only ICMP to this host is a reply
+				if(link->sll_pkttype == PACKET_HOST && header->tp_snaplen >= 20 && packet[9] == IPPROTO_ICMP)
+				{
+					timespec stamp;
+					stamp.tv_sec = header->tp_sec;
+					stamp.tv_nsec = header->tp_nsec;
+					received_datagram datagram = { packet, header->tp_snaplen, offset_.to_steady(stamp, (header->tp_status & TP_STATUS_TS_RAW_HARDWARE) != 0) };
+					datagrams_.push_back(datagram);
+				}
+				frame += header->tp_next_offset;
+			}
+			if(!datagrams_.empty())
+				handler_(&datagrams_[0], datagrams_.size());
+		}
+
+		boost::asio::posix::stream_descriptor descriptor_;
+		uint8_t* ring_;
+		std::size_t block_count_;
+		std::size_t next_block_;
+		std::vector<received_datagram> datagrams_;
+		timestamping::clock_offset offset_;
+		handler_type handler_;
+		bool running_;
+};
+
+#endif
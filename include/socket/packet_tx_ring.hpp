@@ -0,0 +1,388 @@
+#ifndef SOCKET_PACKET_TX_RING
+#define SOCKET_PACKET_TX_RING
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <arpa/inet.h>
+#include <linux/if_arp.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <net/if.h>
+#include <net/route.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include <boost/asio.hpp>
+#include <boost/bind/bind.hpp>
+#include <boost/cstdint.hpp>
+
+/// @brief Send path for whole IPv4 datagrams over an AF_PACKET socket with a PACKET_TX_RING.
+///
+/// Every datagram gets an Ethernet header and is written into the next free
+/// frame of a ring mapped into the process. The kernel is kicked once
+/// batch_size frames are waiting, or when the flush deadline after the
+/// first one passes, and sends all of them in one call. The link header
+/// is resolved once, for the destination of the first datagram, from the
+/// routing and neighbour tables of the interface, so all datagrams of a run
+/// have to leave through the same next hop. A kick the kernel turns away
+/// for lack of send buffer is repeated once the socket is writable, or after
+/// a growing backoff if the device queue is full, the frames stay requested
+/// in the ring until then. If a kick fails for another reason the requested
+/// frames are released and count as dropped. A datagram offered while its
+/// frame is still in use is dropped.
+class packet_tx_ring
+{
+	public:
+
+		static const std::size_t block_size = 64 * 1024;
+
+		///@brief A ring of size bytes on interface, with frames for datagrams of up to packet_size bytes.
+		packet_tx_ring(boost::asio::io_context& io_context, const std::string& interface, std::size_t size, std::size_t packet_size, std::size_t batch_size, boost::asio::chrono::microseconds flush_deadline, bool qdisc_bypass)
+		: descriptor_(io_context),
+		  flush_timer_(io_context),
+		  backoff_timer_(io_context),
+		  backoff_(min_backoff()),
+		  interface_(interface),
+		  frame_size_(frame_size(packet_size)),
+		  block_size_(frame_size_ > block_size ? frame_size_ : block_size),
+		  frame_count_(std::max<std::size_t>(2, size / block_size_) * (block_size_ / frame_size_)),
+		  ring_(0),
+		  next_frame_(0),
+		  batch_size_(std::max<std::size_t>(1, batch_size)),
+		  flush_deadline_(flush_deadline),
+		  queued_(0),
+		  waiting_(false),
+		  failed_(false),
+		  resolved_(false),
+		  unresolved_(false),
+		  dropped_(0)
+		{
+			if(interface.empty())
+				throw std::runtime_error("The tx ring needs an interface");
+			std::memset(link_header_, 0, sizeof(link_header_));
+			int fd = ::socket(AF_PACKET, SOCK_RAW, 0);
+			if(fd < 0)
+				fail("AF_PACKET socket");
+			descriptor_.assign(fd);
+
+			int version = TPACKET_V2;
+			if(::setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0)
+				fail("TPACKET_V2");
+			// a frame the device refuses is skipped instead of stopping the ring
+			int loss = 1;
+			::setsockopt(fd, SOL_PACKET, PACKET_LOSS, &loss, sizeof(loss));
+			int bypass = qdisc_bypass ? 1 : 0;
+			if(qdisc_bypass && ::setsockopt(fd, SOL_PACKET, PACKET_QDISC_BYPASS, &bypass, sizeof(bypass)) != 0)
+				std::cerr << "Cannot bypass the qdisc of " << interface << ", sending through it" << std::endl;
+
+			ifreq request;
+			std::memset(&request, 0, sizeof(request));
+			std::strncpy(request.ifr_name, interface.c_str(), IFNAMSIZ - 1);
+			if(::ioctl(fd, SIOCGIFHWADDR, &request) != 0)
+				fail("interface " + interface);
+			if(request.ifr_hwaddr.sa_family != ARPHRD_ETHER && request.ifr_hwaddr.sa_family != ARPHRD_LOOPBACK)
+				throw std::runtime_error("The tx ring needs an Ethernet interface, " + interface + " is none");
+			loopback_ = request.ifr_hwaddr.sa_family == ARPHRD_LOOPBACK;
+			std::memcpy(link_header_ + ETH_ALEN, request.ifr_hwaddr.sa_data, ETH_ALEN);
+			link_header_[12] = ETH_P_IP >> 8;
+			link_header_[13] = ETH_P_IP & 0xFF;
+
+			tpacket_req ring;
+			ring.tp_block_size = static_cast<unsigned int>(block_size_);
+			ring.tp_block_nr = static_cast<unsigned int>(frame_count_ / (block_size_ / frame_size_));
+			ring.tp_frame_size = static_cast<unsigned int>(frame_size_);
+			ring.tp_frame_nr = static_cast<unsigned int>(frame_count_);
+			if(::setsockopt(fd, SOL_PACKET, PACKET_TX_RING, &ring, sizeof(ring)) != 0)
+				fail("PACKET_TX_RING");
+			void* mapped = ::mmap(0, frame_count_ * frame_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if(mapped == MAP_FAILED)
+				fail("mmap of the tx ring");
+			ring_ = static_cast<uint8_t*>(mapped);
+
+			// the kick names interface and protocol, the socket is never bound and receives nothing
+			std::memset(&address_, 0, sizeof(address_));
+			address_.sll_family = AF_PACKET;
+			address_.sll_protocol = htons(ETH_P_IP);
+			address_.sll_ifindex = static_cast<int>(::if_nametoindex(interface.c_str()));
+			address_.sll_halen = ETH_ALEN;
+		}
+
+		~packet_tx_ring()
+		{
+			if(ring_)
+				::munmap(ring_, frame_count_ * frame_size_);
+		}
+
+		///@brief Queue a datagram, false if it was dropped because its frame is in use or there is no next hop.
+		bool send(const uint8_t* data, std::size_t length)
+		{
+			if(length < 20 || length > frame_size_ - data_offset - ETH_HLEN || !resolve(data))
+			{
+				++dropped_;
+				return false;
+			}
+
+			tpacket2_hdr* frame = reinterpret_cast<tpacket2_hdr*>(ring_ + next_frame_ * frame_size_);
+			if(frame->tp_status != TP_STATUS_AVAILABLE)
+			{
+				// the ring came round to frames the kernel has not sent yet, they may be requested before the last kick
+				flush_timer_.cancel();
+				kick();
+				if(frame->tp_status != TP_STATUS_AVAILABLE)
+				{
+					++dropped_;
+					return false;
+				}
+			}
+			std::atomic_thread_fence(std::memory_order_acquire);
+			uint8_t* link = reinterpret_cast<uint8_t*>(frame) + data_offset;
+			std::memcpy(link, link_header_, ETH_HLEN);
+			std::memcpy(link + ETH_HLEN, data, length);
+			frame->tp_len = static_cast<uint32_t>(ETH_HLEN + length);
+			std::atomic_thread_fence(std::memory_order_release);
+			frame->tp_status = TP_STATUS_SEND_REQUEST;
+			next_frame_ = (next_frame_ + 1) % frame_count_;
+
+			if(++queued_ >= batch_size_)
+				flush();
+			else if(queued_ == 1)
+			{
+				flush_timer_.expires_after(flush_deadline_);
+				flush_timer_.async_wait(boost::bind(&packet_tx_ring::handle_flush_timer, this, boost::placeholders::_1));
+			}
+			return true;
+		}
+
+		///@brief Kick the kernel to send every queued frame now.
+		void flush()
+		{
+			if(queued_ == 0)
+				return;
+			flush_timer_.cancel();
+			kick();
+		}
+
+		///@brief Frames requested in the ring that no kick has handed to the kernel yet.
+		std::size_t pending() const
+		{
+			return queued_;
+		}
+
+		std::size_t dropped() const
+		{
+			return dropped_;
+		}
+
+	private:
+
+		packet_tx_ring(const packet_tx_ring&);
+
+		packet_tx_ring& operator=(const packet_tx_ring&);
+
+		///@brief The frame header leaves room for the address the kernel fills in on receive only.
+		static const std::size_t data_offset = TPACKET2_HDRLEN - sizeof(sockaddr_ll);
+
+		///@brief Bounds of the wait for a full device queue, it doubles while the queue stays full.
+		static boost::asio::chrono::microseconds min_backoff()
+		{
+			return boost::asio::chrono::microseconds(50);
+		}
+
+		static boost::asio::chrono::microseconds max_backoff()
+		{
+			return boost::asio::chrono::microseconds(10000);
+		}
+
+		static std::size_t frame_size(std::size_t packet_size)
+		{
+			std::size_t size = 2048;
+			while(size < data_offset + ETH_HLEN + packet_size)
+				size *= 2;
+			return size;
+		}
+
+		void fail(const std::string& what)
+		{
+			boost::system::error_code error(errno, boost::system::system_category());
+			if(ring_)
+				::munmap(ring_, frame_count_ * frame_size_);
+			ring_ = 0;
+			throw boost::system::system_error(error, "Cannot set up " + what);
+		}
+
+		void handle_flush_timer(const boost::system::error_code& error)
+		{
+			if(!error)
+				flush();
+		}
+
+		///@brief Have the kernel send every requested frame in the ring, refused ones are skipped.
+		void kick()
+		{
+			if(waiting_)
+				return;
+			if(::sendto(descriptor_.native_handle(), 0, 0, MSG_DONTWAIT, reinterpret_cast<const sockaddr*>(&address_), sizeof(address_)) >= 0)
+			{
+				queued_ = 0;
+				backoff_ = min_backoff();
+				return;
+			}
+
+			// the frames stay requested, the next kick takes them along
+			int error = errno;
+			if(error == ENOBUFS)
+			{
+				// the socket stays writable while the device queue is full, waiting for that would spin
+				waiting_ = true;
+				backoff_timer_.expires_after(backoff_);
+				backoff_timer_.async_wait(boost::bind(&packet_tx_ring::handle_writable, this, boost::placeholders::_1));
+				backoff_ = std::min(backoff_ * 2, max_backoff());
+				return;
+			}
+			if(error == EAGAIN || error == EWOULDBLOCK)
+			{
+				waiting_ = true;
+				descriptor_.async_wait(boost::asio::posix::stream_descriptor::wait_write, boost::bind(&packet_tx_ring::handle_writable, this, boost::placeholders::_1));
+				return;
+			}
+			if(!failed_)
+				std::cerr << "Cannot kick the tx ring of " << interface_ << ": " << std::strerror(error) << ", dropping its frames" << std::endl;
+			failed_ = true;
+			release();
+		}
+
+		///@brief Give the frames still requested back to the ring, as dropped, after a kick failed for good.
+		void release()
+		{
+			for(std::size_t i = 0; i < frame_count_; ++i)
+			{
+				tpacket2_hdr* frame = reinterpret_cast<tpacket2_hdr*>(ring_ + i * frame_size_);
+				if(frame->tp_status == TP_STATUS_SEND_REQUEST)
+				{
+					frame->tp_status = TP_STATUS_AVAILABLE;
+					++dropped_;
+				}
+			}
+			queued_ = 0;
+		}
+
+		void handle_writable(const boost::system::error_code& error)
+		{
+			if(error)
+				return;
+			waiting_ = false;
+			kick();
+		}
+
+		///@brief Fill in the destination MAC for the next hop towards the destination of datagram, once.
+		bool resolve(const uint8_t* datagram)
+		{
+			if(resolved_)
+				return true;
+			if(unresolved_)
+				return false;
+
+			uint32_t destination;
+			std::memcpy(&destination, datagram + 16, sizeof(destination));
+			uint32_t hop = destination;
+			if(loopback_ || (next_hop(destination, hop) && neighbour(hop)))
+			{
+				// the loopback device takes any destination MAC, zeros like its own
+				std::memcpy(address_.sll_addr, link_header_, ETH_ALEN);
+				resolved_ = true;
+				return true;
+			}
+			in_addr address = { hop };
+			std::cerr << "No neighbour entry for " << ::inet_ntoa(address) << " on " << interface_ << ", dropping the datagrams of the tx ring" << std::endl;
+			unresolved_ = true;
+			return false;
+		}
+
+		///@brief The gateway of the most specific route on the interface, or destination itself if it is on link.
+		bool next_hop(uint32_t destination, uint32_t& hop) const
+		{
+			// addresses and masks are in network order, printed as hex host integers
+			std::ifstream routes("/proc/net/route");
+			std::string line;
+			std::getline(routes, line);
+			bool found = false;
+			uint32_t best_mask = 0;
+			while(std::getline(routes, line))
+			{
+				std::istringstream fields(line);
+				std::string name;
+				unsigned int network, gateway, flags, references, use, metric, mask;
+				if(!(fields >> name >> std::hex >> network >> gateway >> flags >> std::dec >> references >> use >> metric >> std::hex >> mask))
+					continue;
+				if(name != interface_ || !(flags & RTF_UP) || (destination & mask) != network)
+					continue;
+				if(!found || ntohl(mask) > ntohl(best_mask))
+				{
+					found = true;
+					best_mask = mask;
+					hop = (flags & RTF_GATEWAY) ? gateway : destination;
+				}
+			}
+			return found;
+		}
+
+		///@brief Look up the MAC of address on the interface in the neighbour table.
+		bool neighbour(uint32_t address)
+		{
+			std::ifstream neighbours("/proc/net/arp");
+			std::string line;
+			std::getline(neighbours, line);
+			in_addr wanted = { address };
+			std::string wanted_address = ::inet_ntoa(wanted);
+			while(std::getline(neighbours, line))
+			{
+				std::istringstream fields(line);
+				std::string ip, type, flags, mac, mask, device;
+				if(!(fields >> ip >> type >> flags >> mac >> mask >> device) || ip != wanted_address || device != interface_)
+					continue;
+				unsigned int bytes[ETH_ALEN];
+				if(std::strtoul(flags.c_str(), 0, 16) == 0 || std::sscanf(mac.c_str(), "%x:%x:%x:%x:%x:%x", &bytes[0], &bytes[1], &bytes[2], &bytes[3], &bytes[4], &bytes[5]) != ETH_ALEN)
+					return false;
+				for(int i = 0; i < ETH_ALEN; ++i)
+					link_header_[i] = static_cast<uint8_t>(bytes[i]);
+				return true;
+			}
+			return false;
+		}
+
+		boost::asio::posix::stream_descriptor descriptor_;
+		boost::asio::steady_timer flush_timer_;
+		///@brief ENOBUFS leaves the socket writable, the next kick waits on the timer instead.
+		boost::asio::steady_timer backoff_timer_;
+		boost::asio::chrono::microseconds backoff_;
+		std::string interface_;
+		std::size_t frame_size_;
+		std::size_t block_size_;
+		std::size_t frame_count_;
+		uint8_t* ring_;
+		std::size_t next_frame_;
+		std::size_t batch_size_;
+		boost::asio::chrono::microseconds flush_deadline_;
+		std::size_t queued_;
+		///@brief A kick was turned away and the next one waits for the socket to become writable.
+		bool waiting_;
+		bool failed_;
+		sockaddr_ll address_;
+		///@brief Destination MAC, source MAC and EtherType put in front of every datagram.
+		uint8_t link_header_[ETH_HLEN];
+		bool loopback_;
+		bool resolved_;
+		bool unresolved_;
+		std::size_t dropped_;
+};
+
+#endif
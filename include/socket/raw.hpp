@@ -3,13 +3,20 @@
 #define RAW
 
 #include <algorithm>
+#include <cerrno>
+#include <cstring>
 #include <iostream>
 #include <numeric>
+#include <vector>
+#include <sys/socket.h>
 
 #include <boost/array.hpp>
 #include <boost/asio.hpp>
+#include <boost/bind/bind.hpp>
 #include <boost/cstdint.hpp>
 
+class raw_batch_sender;
+
 /// @brief raw socket provides the protocol for raw socket.
 class raw
 {
@@ -23,6 +30,9 @@ class raw
 		///@brief The raw resolver type.
 		typedef boost::asio::ip::basic_resolver<raw> resolver;
 
+		///@brief The batched transmit queue for a raw socket.
+		typedef raw_batch_sender batch_sender;
+
 		///@brief Construct to represent the IPv4 RAW protocol.
 		static raw v4()
 		{
@@ -81,5 +91,150 @@ class raw
 		int family_;
 };
 
-#endif
+/// @brief Batched transmit path for a raw socket.
+///
+/// Datagrams are copied into a preallocated queue and handed to the kernel
+/// with one sendmmsg call once batch_size of them are waiting, or when the
+/// flush deadline after the first queued datagram passes. If the socket
+/// buffer is full the rest of the batch waits for the socket to become
+/// writable, if the device queue is full it is tried again after the flush
+/// deadline. Datagrams offered meanwhile into a full queue are dropped.
+class raw_batch_sender
+{
+	public:
+		raw_batch_sender(raw::socket& socket, std::size_t batch_size, boost::asio::chrono::microseconds flush_deadline, std::size_t packet_size)
+		: socket_(socket),
+		  flush_timer_(socket.get_executor()),
+		  batch_size_(std::max<std::size_t>(1, batch_size)),
+		  packet_size_(packet_size),
+		  flush_deadline_(flush_deadline),
+		  storage_(batch_size_ * packet_size),
+		  iovecs_(batch_size_),
+		  messages_(batch_size_),
+		  destinations_(batch_size_),
+		  queued_(0),
+		  sent_(0),
+		  waiting_(false),
+		  dropped_(0),
+		  errors_(0)
+		{}
+
+		///@brief Queue a datagram, false if it was dropped because the queue is full.
+		bool send_to(const boost::asio::const_buffer& packet, const raw::endpoint& destination)
+		{
+			std::size_t size = boost::asio::buffer_size(packet);
+			if(queued_ == batch_size_ || size > packet_size_)
+			{
+				++dropped_;
+				return false;
+			}
+
+			uint8_t* slot = &storage_[queued_ * packet_size_];
+			boost::asio::buffer_copy(boost::asio::buffer(slot, packet_size_), packet);
+			destinations_[queued_] = destination;
+			iovecs_[queued_].iov_base = slot;
+			iovecs_[queued_].iov_len = size;
+			std::memset(&messages_[queued_], 0, sizeof(mmsghdr));
+			messages_[queued_].msg_hdr.msg_name = destinations_[queued_].data();
+			messages_[queued_].msg_hdr.msg_namelen = static_cast<socklen_t>(destinations_[queued_].size());
+			messages_[queued_].msg_hdr.msg_iov = &iovecs_[queued_];
+			messages_[queued_].msg_hdr.msg_iovlen = 1;
+
+			if(++queued_ == batch_size_)
+			{
+				flush();
+			}
+			else if(queued_ == 1 && !waiting_)
+			{
+				flush_timer_.expires_after(flush_deadline_);
+				flush_timer_.async_wait(boost::bind(&raw_batch_sender::handle_flush_timer, this, boost::placeholders::_1));
+			}
+			return true;
+		}
+
+		///@brief Hand everything queued to the kernel now.
+		void flush()
+		{
+			if(waiting_)
+				return;
+			flush_timer_.cancel();
+
+			while(sent_ < queued_)
+			{
+				int result = ::sendmmsg(socket_.native_handle(), &messages_[sent_], static_cast<unsigned int>(queued_ - sent_), MSG_DONTWAIT);
+				if(result > 0)
+				{
+					sent_ += result;
+				}
+				else if(result < 0 && errno == ENOBUFS)
+				{
+					// the device queue is full and the socket stays writable, try again after a while instead of spinning
+					waiting_ = true;
+					flush_timer_.expires_after(flush_deadline_);
+					flush_timer_.async_wait(boost::bind(&raw_batch_sender::handle_writable, this, boost::placeholders::_1));
+					return;
+				}
+				else if(result == 0 || errno == EAGAIN || errno == EWOULDBLOCK)
+				{
+					// the socket buffer is full, continue once it drained; nothing sent is not a refusal either
+					waiting_ = true;
+					socket_.async_wait(raw::socket::wait_write, boost::bind(&raw_batch_sender::handle_writable, this, boost::placeholders::_1));
+					return;
+				}
+				else
+				{
+					// result < 0, the first datagram was refused, skip it like a failed async_send_to would
+					++errors_;
+					++sent_;
+				}
+			}
+			queued_ = 0;
+			sent_ = 0;
+		}
 
+		std::size_t pending() const
+		{
+			return queued_ - sent_;
+		}
+
+		std::size_t dropped() const
+		{
+			return dropped_;
+		}
+
+		std::size_t errors() const
+		{
+			return errors_;
+		}
+
+	private:
+		void handle_flush_timer(const boost::system::error_code& error)
+		{
+			if(!error)
+				flush();
+		}
+
+		void handle_writable(const boost::system::error_code& error)
+		{
+			waiting_ = false;
+			if(!error)
+				flush();
+		}
+
+		raw::socket& socket_;
+		boost::asio::steady_timer flush_timer_;
+		std::size_t batch_size_;
+		std::size_t packet_size_;
+		boost::asio::chrono::microseconds flush_deadline_;
+		std::vector<uint8_t> storage_;
+		std::vector<iovec> iovecs_;
+		std::vector<mmsghdr> messages_;
+		std::vector<raw::endpoint> destinations_;
+		std::size_t queued_;
+		std::size_t sent_;
+		bool waiting_;
+		std::size_t dropped_;
+		std::size_t errors_;
+};
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef SOCKET_RECEIVE_RING
+#define SOCKET_RECEIVE_RING
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+#include <sys/socket.h>
+
+#include <boost/asio.hpp>
+#include <boost/bind/bind.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <timestamping.hpp>
+
+///@brief One datagram of a received batch, it points into the ring and is valid during the handler only.
+struct received_datagram
+{
+	const uint8_t* data;
+	std::size_t length;
+	boost::asio::chrono::steady_clock::time_point received_at;
+};
+
+/// @brief Batched receive path for a datagram socket.
+///
+/// Waits for the socket to become readable and drains it with recvmmsg into
+/// a ring of fixed-size buffers, each starting on its own cache line. Every
+/// batch is handed to the handler in one call, the ring is reused for the
+/// next batch once the handler returned. With timestamping the receive time
+/// of a datagram is the kernel stamp, otherwise the time the batch was read.
+template <typename Socket>
+class receive_ring
+{
+	public:
+		typedef boost::function<void (const received_datagram* datagrams, std::size_t count)> handler_type;
+
+		static const std::size_t cache_line_size = 64;
+
+		static const std::size_t control_size = CMSG_SPACE(sizeof(scm_timestamping));
+
+		receive_ring(Socket& socket, std::size_t slots = 64, std::size_t slot_size = 2048, timestamping::mode stamps = timestamping::none)
+		: socket_(socket),
+		  stamps_(stamps),
+		  slots_(std::max<std::size_t>(1, slots)),
+		  slot_size_((std::max<std::size_t>(1, slot_size) + cache_line_size - 1) & ~(cache_line_size - 1)),
+		  storage_(slots_ * slot_size_ + cache_line_size),
+		  iovecs_(slots_),
+		  messages_(slots_),
+		  datagrams_(slots_),
+		  controls_(stamps == timestamping::none ? 0 : slots_ * control_size),
+		  running_(false)
+		{
+			std::size_t offset = reinterpret_cast<std::size_t>(&storage_[0]) & (cache_line_size - 1);
+			uint8_t* first = &storage_[0] + (offset == 0 ? 0 : cache_line_size - offset);
+			for(std::size_t slot = 0; slot < slots_; ++slot)
+			{
+				iovecs_[slot].iov_base = first + slot * slot_size_;
+				iovecs_[slot].iov_len = slot_size_;
+				datagrams_[slot].data = first + slot * slot_size_;
+			}
+		}
+
+		///@brief Start draining the socket, handler is called once per batch.
+		void start(const handler_type& handler)
+		{
+			handler_ = handler;
+			running_ = true;
+			async_wait();
+		}
+
+		///@brief Stop after the current batch, also from within the handler.
+		void stop()
+		{
+			running_ = false;
+			socket_.cancel();
+		}
+
+	private:
+		void async_wait()
+		{
+			socket_.async_wait(Socket::wait_read, boost::bind(&receive_ring::handle_readable, this, boost::placeholders::_1));
+		}
+
+		void handle_readable(const boost::system::error_code& error)
+		{
+			if(error || !running_)
+				return;
+
+			// a full batch means more may be waiting, a few rounds keep other handlers from starving
+			for(int round = 0; round < 4 && running_; ++round)
+			{
+				for(std::size_t slot = 0; slot < slots_; ++slot)
+				{
+					std::memset(&messages_[slot].msg_hdr, 0, sizeof(msghdr));
+					messages_[slot].msg_hdr.msg_iov = &iovecs_[slot];
+					messages_[slot].msg_hdr.msg_iovlen = 1;
+					if(!controls_.empty())
+					{
+						messages_[slot].msg_hdr.msg_control = &controls_[slot * control_size];
+						messages_[slot].msg_hdr.msg_controllen = control_size;
+					}
+				}
+
+				int result = ::recvmmsg(socket_.native_handle(), &messages_[0], static_cast<unsigned int>(slots_), MSG_DONTWAIT, 0);
+				if(result <= 0)
+					break;
+
+				boost::asio::chrono::steady_clock::time_point now = boost::asio::chrono::steady_clock::now();
+				if(!controls_.empty())
+					offset_.sample();
+				for(int i = 0; i < result; ++i)
+				{
+					timespec stamp;
+					datagrams_[i].length = std::min<std::size_t>(messages_[i].msg_len, slot_size_);
+					datagrams_[i].received_at = !controls_.empty() && timestamping::find(messages_[i].msg_hdr, stamps_, stamp) ? offset_.to_steady(stamp, stamps_ == timestamping::hardware) : now;
+				}
+				handler_(&datagrams_[0], static_cast<std::size_t>(result));
+
+				if(static_cast<std::size_t>(result) < slots_)
+					break;
+			}
+
+			if(running_)
+				async_wait();
+		}
+
+		Socket& socket_;
+		timestamping::mode stamps_;
+		std::size_t slots_;
+		std::size_t slot_size_;
+		std::vector<uint8_t> storage_;
+		std::vector<iovec> iovecs_;
+		std::vector<mmsghdr> messages_;
+		std::vector<received_datagram> datagrams_;
+		std::vector<uint8_t> controls_;
+		timestamping::clock_offset offset_;
+		handler_type handler_;
+		bool running_;
+};
+
+#endif
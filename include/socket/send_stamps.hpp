@@ -0,0 +1,127 @@
+#ifndef SOCKET_SEND_STAMPS
+#define SOCKET_SEND_STAMPS
+
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <boost/array.hpp>
+#include <boost/asio.hpp>
+#include <boost/bind/bind.hpp>
+#include <boost/function.hpp>
+#include <ipv4_header.hpp>
+#include <raw.hpp>
+#include <timestamping.hpp>
+
+/// @brief Kernel send stamps of the datagrams that left on a raw socket.
+///
+/// The kernel queues every send stamp on the error queue of the socket
+/// together with a copy of the packet. The queue is drained whenever it
+/// becomes readable, and on read(), which receivers call before they match a
+/// batch of replies, as the stamps of the probes answered may still wait.
+/// Every datagram of the source address goes to the handler with its send
+/// time on the steady clock.
+class send_stamps
+{
+	public:
+		typedef boost::function<void (const ipv4_header_view& sent, boost::asio::chrono::steady_clock::time_point sent_at)> handler_type;
+
+		///@brief Stamps for socket if it is there and the kernel agrees, 0 otherwise, the times of the send calls stay in use then.
+		static send_stamps* open(raw::socket* socket, timestamping::mode stamps, const boost::asio::ip::address_v4& source)
+		{
+			if(stamps == timestamping::none || !socket)
+				return 0;
+			if(!timestamping::enable(socket->native_handle(), stamps, true, false))
+			{
+				std::cerr << "Kernel send timestamps are not available, using the time of the send calls" << std::endl;
+				return 0;
+			}
+			return new send_stamps(*socket, stamps, source);
+		}
+
+		void start(const handler_type& handler)
+		{
+			handler_ = handler;
+			running_ = true;
+			async_wait();
+		}
+
+		///@brief Stop waiting for stamps, the socket no longer keeps the io_context busy.
+		void stop()
+		{
+			running_ = false;
+			socket_.cancel();
+		}
+
+		///@brief Hand the stamps queued so far to the handler.
+		void read()
+		{
+			clock_offset_.sample();
+			for(;;)
+			{
+				iovec data = { buffer_.data(), buffer_.size() };
+				msghdr message;
+				std::memset(&message, 0, sizeof(message));
+				message.msg_iov = &data;
+				message.msg_iovlen = 1;
+				message.msg_control = control_.data();
+				message.msg_controllen = control_.size();
+
+				ssize_t length = ::recvmsg(socket_.native_handle(), &message, MSG_ERRQUEUE | MSG_DONTWAIT);
+				if(length < 0)
+					return;
+
+				timespec stamp;
+				if(!timestamping::find(message, stamps_, stamp))
+					continue;
+
+				// the looped packet starts with the link layer header, if the device has one
+				static const std::size_t link_offsets[] = { 0, 14, 18 };
+				for(std::size_t i = 0; i < sizeof(link_offsets) / sizeof(link_offsets[0]); ++i)
+				{
+					if(link_offsets[i] >= static_cast<std::size_t>(length))
+						break;
+					ipv4_header_view sent(buffer_.data() + link_offsets[i], length - link_offsets[i]);
+					if(!sent.valid() || sent.source_address() != source_)
+						continue;
+					handler_(sent, clock_offset_.to_steady(stamp, stamps_ == timestamping::hardware));
+					break;
+				}
+			}
+		}
+
+	private:
+		send_stamps(raw::socket& socket, timestamping::mode stamps, const boost::asio::ip::address_v4& source)
+		: socket_(socket),
+		  stamps_(stamps),
+		  source_(source),
+		  running_(false)
+		{}
+
+		send_stamps(const send_stamps&);
+
+		send_stamps& operator=(const send_stamps&);
+
+		void async_wait()
+		{
+			socket_.async_wait(raw::socket::wait_error, boost::bind(&send_stamps::handle_error_queue, this, boost::placeholders::_1));
+		}
+
+		void handle_error_queue(const boost::system::error_code& error)
+		{
+			if(error || !running_)
+				return;
+			read();
+			async_wait();
+		}
+
+		raw::socket& socket_;
+		timestamping::mode stamps_;
+		boost::asio::ip::address_v4 source_;
+		handler_type handler_;
+		timestamping::clock_offset clock_offset_;
+		boost::array<uint8_t, 2048> buffer_;
+		boost::array<uint8_t, 512> control_;
+		bool running_;
+};
+
+#endif
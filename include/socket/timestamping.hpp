@@ -0,0 +1,184 @@
+#ifndef SOCKET_TIMESTAMPING
+#define SOCKET_TIMESTAMPING
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <fcntl.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <linux/errqueue.h>
+#include <linux/ethtool.h>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
+
+#include <boost/asio.hpp>
+
+/// @brief Kernel timestamps of sent and received packets (SO_TIMESTAMPING).
+///
+/// Software stamps are taken by the kernel when a packet enters the stack
+/// and by the driver right before it is handed to the device, on the system
+/// clock. Hardware stamps come from the PTP clock of the NIC, they are read
+/// against that clock once open_hardware_clock() found it, so they line up
+/// with software stamps and with the steady clock whether or not phc2sys
+/// keeps the two in step.
+namespace timestamping
+{
+	enum mode
+	{
+		none,
+		software,
+		hardware
+	};
+
+	inline mode parse_mode(const std::string& name)
+	{
+		if(name == "software")
+			return software;
+		if(name == "hardware")
+			return hardware;
+		return none;
+	}
+
+	///@brief Ask for stamps on a socket, send stamps are queued on its error queue.
+	inline bool enable(int socket, mode stamps, bool transmit, bool receive)
+	{
+		if(stamps == none)
+			return true;
+
+		int flags = 0;
+		if(stamps == software)
+		{
+			flags |= SOF_TIMESTAMPING_SOFTWARE;
+			if(transmit)
+				flags |= SOF_TIMESTAMPING_TX_SOFTWARE;
+			if(receive)
+				flags |= SOF_TIMESTAMPING_RX_SOFTWARE;
+		}
+		else
+		{
+			flags |= SOF_TIMESTAMPING_RAW_HARDWARE;
+			if(transmit)
+				flags |= SOF_TIMESTAMPING_TX_HARDWARE;
+			if(receive)
+				flags |= SOF_TIMESTAMPING_RX_HARDWARE;
+		}
+		return ::setsockopt(socket, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0;
+	}
+
+	///@brief Switch on NIC stamping for all packets of an interface, needs CAP_NET_ADMIN.
+	inline bool enable_interface(int socket, const std::string& interface)
+	{
+		hwtstamp_config config;
+		std::memset(&config, 0, sizeof(config));
+		config.tx_type = HWTSTAMP_TX_ON;
+		config.rx_filter = HWTSTAMP_FILTER_ALL;
+
+		ifreq request;
+		std::memset(&request, 0, sizeof(request));
+		std::strncpy(request.ifr_name, interface.c_str(), IFNAMSIZ - 1);
+		request.ifr_data = reinterpret_cast<char*>(&config);
+		return ::ioctl(socket, SIOCSHWTSTAMP, &request) == 0;
+	}
+
+	///@brief The clock hardware stamps are taken on, the system clock until open_hardware_clock() found the one of the NIC.
+	inline clockid_t& hardware_clock()
+	{
+		static clockid_t clock = CLOCK_REALTIME;
+		return clock;
+	}
+
+	///@brief Read hardware stamps against the PTP clock of interface from now on, false if it has none or it cannot be opened.
+	inline bool open_hardware_clock(int socket, const std::string& interface)
+	{
+		ethtool_ts_info info;
+		std::memset(&info, 0, sizeof(info));
+		info.cmd = ETHTOOL_GET_TS_INFO;
+
+		ifreq request;
+		std::memset(&request, 0, sizeof(request));
+		std::strncpy(request.ifr_name, interface.c_str(), IFNAMSIZ - 1);
+		request.ifr_data = reinterpret_cast<char*>(&info);
+		if(::ioctl(socket, SIOCETHTOOL, &request) != 0 || info.phc_index < 0)
+			return false;
+
+		char path[32];
+		std::snprintf(path, sizeof(path), "/dev/ptp%d", info.phc_index);
+		int clock = ::open(path, O_RDONLY);
+		if(clock < 0)
+			return false;
+		// a dynamic POSIX clock is named by its file descriptor, FD_TO_CLOCKID of the kernel
+		hardware_clock() = static_cast<clockid_t>((~static_cast<unsigned int>(clock) << 3) | 3);
+		return true;
+	}
+
+	///@brief Find the stamp of the given mode in the control messages, false if there is none.
+	inline bool find(const msghdr& message, mode stamps, timespec& stamp)
+	{
+		for(cmsghdr* control = CMSG_FIRSTHDR(const_cast<msghdr*>(&message)); control != 0; control = CMSG_NXTHDR(const_cast<msghdr*>(&message), control))
+		{
+			if(control->cmsg_level != SOL_SOCKET || control->cmsg_type != SO_TIMESTAMPING)
+				continue;
+
+			scm_timestamping stamps_found;
+			std::memcpy(&stamps_found, CMSG_DATA(control), sizeof(stamps_found));
+			// ts[0] holds the software stamp, ts[2] the raw hardware one
+			const timespec& found = stamps == hardware ? stamps_found.ts[2] : stamps_found.ts[0];
+			if(found.tv_sec == 0 && found.tv_nsec == 0)
+				return false;
+			stamp = found;
+			return true;
+		}
+		return false;
+	}
+
+	/// @brief Maps kernel stamps onto the steady clock.
+	///
+	/// Software stamps are mapped through the system clock, hardware stamps
+	/// through the hardware clock, so both end up on the same time line. The
+	/// offsets are sampled once per batch, so stamps of sent and received
+	/// packets share them up to the slew of the clocks in between.
+	class clock_offset
+	{
+		public:
+			clock_offset()
+			{
+				sample();
+			}
+
+			void sample()
+			{
+				timespec system;
+				::clock_gettime(CLOCK_REALTIME, &system);
+				steady_ = boost::asio::chrono::steady_clock::now();
+				system_ns_ = nanoseconds(system);
+				hardware_ns_ = system_ns_;
+				if(hardware_clock() != CLOCK_REALTIME)
+				{
+					timespec hardware;
+					if(::clock_gettime(hardware_clock(), &hardware) == 0)
+						hardware_ns_ = nanoseconds(hardware);
+				}
+			}
+
+			boost::asio::chrono::steady_clock::time_point to_steady(const timespec& stamp, bool hardware = false) const
+			{
+				int64_t reference_ns = hardware ? hardware_ns_ : system_ns_;
+				return steady_ - boost::asio::chrono::duration_cast<boost::asio::chrono::steady_clock::duration>(boost::asio::chrono::nanoseconds(reference_ns - nanoseconds(stamp)));
+			}
+
+		private:
+			static int64_t nanoseconds(const timespec& time)
+			{
+				return static_cast<int64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+			}
+
+			boost::asio::chrono::steady_clock::time_point steady_;
+			int64_t system_ns_;
+			int64_t hardware_ns_;
+	};
+}
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef STATS_HDR_HISTOGRAM
+#define STATS_HDR_HISTOGRAM
+
+#include <algorithm>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+/// @brief Log-bucketed histogram of non-negative values in the style of HdrHistogram.
+///
+/// Values below 256 have a bucket each, above that every power of two is
+/// split into 128 buckets, so a value is known to better than 1% over the
+/// whole range up to 2^48. The bucket math is static, so counters elsewhere,
+/// for example atomics written by another thread, can be loaded into a
+/// histogram with add().
+class hdr_histogram
+{
+	public:
+
+		static const std::size_t sub_bucket_bits = 7;
+		static const std::size_t sub_buckets = 1 << sub_bucket_bits;
+		static const std::size_t max_bits = 48;
+		static const std::size_t bucket_count = (max_bits - sub_bucket_bits + 1) * sub_buckets;
+
+		hdr_histogram() :
+			counts_(bucket_count, 0),
+			total_(0),
+			max_(0)
+		{
+		}
+
+		///@brief Bucket of value, values beyond the range land in the last one.
+		static std::size_t bucket(uint64_t value)
+		{
+			if(value < 2 * sub_buckets)
+				return static_cast<std::size_t>(value);
+			std::size_t magnitude = 63 - __builtin_clzll(value);
+			if(magnitude >= max_bits)
+				return bucket_count - 1;
+			std::size_t shift = magnitude - sub_bucket_bits;
+			return shift * sub_buckets + static_cast<std::size_t>(value >> shift);
+		}
+
+		///@brief Lowest value of a bucket.
+		static uint64_t lowest_value(std::size_t bucket)
+		{
+			if(bucket < 2 * sub_buckets)
+				return bucket;
+			std::size_t shift = bucket / sub_buckets - 1;
+			return static_cast<uint64_t>(bucket - shift * sub_buckets) << shift;
+		}
+
+		///@brief Highest value of a bucket.
+		static uint64_t highest_value(std::size_t bucket)
+		{
+			if(bucket < 2 * sub_buckets)
+				return bucket;
+			std::size_t shift = bucket / sub_buckets - 1;
+			return lowest_value(bucket) + (uint64_t(1) << shift) - 1;
+		}
+
+		void record(uint64_t value)
+		{
+			add(bucket(value), 1);
+			max_ = std::max(max_, value);
+		}
+
+		void add(std::size_t bucket, uint64_t count)
+		{
+			counts_[bucket] += count;
+			total_ += count;
+		}
+
+		///@brief Raise the exact maximum, add() only knows the buckets.
+		void max(uint64_t value)
+		{
+			max_ = std::max(max_, value);
+		}
+
+		void merge(const hdr_histogram& other)
+		{
+			for(std::size_t i = 0; i < bucket_count; ++i)
+				counts_[i] += other.counts_[i];
+			total_ += other.total_;
+			max_ = std::max(max_, other.max_);
+		}
+
+		///@brief Remove the counts of an earlier snapshot, what is left is the interval in between.
+		void subtract(const hdr_histogram& earlier)
+		{
+			for(std::size_t i = 0; i < bucket_count; ++i)
+				counts_[i] -= std::min(counts_[i], earlier.counts_[i]);
+			total_ -= std::min(total_, earlier.total_);
+		}
+
+		void reset()
+		{
+			std::fill(counts_.begin(), counts_.end(), 0);
+			total_ = 0;
+			max_ = 0;
+		}
+
+		uint64_t count() const
+		{
+			return total_;
+		}
+
+		///@brief Highest value recorded, at most the top of the highest bucket in use.
+		uint64_t max() const
+		{
+			for(std::size_t i = bucket_count; i > 0; --i)
+			{
+				if(counts_[i - 1] != 0)
+					return std::min(max_, highest_value(i - 1));
+			}
+			return 0;
+		}
+
+		///@brief Smallest value at least the given share of all values is not above, share in [0, 1].
+		uint64_t percentile(double share) const
+		{
+			if(total_ == 0)
+				return 0;
+			uint64_t rank = static_cast<uint64_t>(share * total_ + 0.5);
+			rank = std::max<uint64_t>(1, std::min(rank, total_));
+			uint64_t seen = 0;
+			for(std::size_t i = 0; i < bucket_count; ++i)
+			{
+				seen += counts_[i];
+				if(seen >= rank)
+					return std::min(max_, highest_value(i));
+			}
+			return max_;
+		}
+
+	private:
+
+		std::vector<uint64_t> counts_;
+		uint64_t total_;
+		uint64_t max_;
+};
+
+#endif
@@ -0,0 +1,188 @@
+#ifndef STATS_TX_STATS
+#define STATS_TX_STATS
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+#include <boost/asio.hpp>
+#include <hdr_histogram.hpp>
+
+/// @brief Counters of one tx flow, written by the worker of the flow and read by the reporter.
+///
+/// Every counter has a single writer, so it is bumped with a relaxed load and
+/// store instead of a locked read-modify-write. The reporter loads them from
+/// another thread at any time, values only grow.
+class tx_counters
+{
+	public:
+
+		tx_counters();
+
+		void sent(std::size_t bytes)
+		{
+			bump(sent_packets_, 1);
+			bump(sent_bytes_, bytes);
+		}
+
+		void received(uint64_t rtt_ns)
+		{
+			bump(received_, 1);
+			bump(rtt_[hdr_histogram::bucket(rtt_ns)], 1);
+			if(rtt_ns > rtt_max_.load(std::memory_order_relaxed))
+				rtt_max_.store(rtt_ns, std::memory_order_relaxed);
+		}
+
+		void lost()
+		{
+			bump(lost_, 1);
+		}
+
+		void duplicate()
+		{
+			bump(duplicates_, 1);
+		}
+
+		void reordered()
+		{
+			bump(reordered_, 1);
+		}
+
+		void late()
+		{
+			bump(late_, 1);
+		}
+
+	private:
+
+		friend class tx_stats;
+
+		static void bump(std::atomic<uint64_t>& counter, uint64_t value)
+		{
+			counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+		}
+
+		std::atomic<uint64_t> sent_packets_;
+		std::atomic<uint64_t> sent_bytes_;
+		std::atomic<uint64_t> received_;
+		std::atomic<uint64_t> lost_;
+		std::atomic<uint64_t> duplicates_;
+		std::atomic<uint64_t> reordered_;
+		std::atomic<uint64_t> late_;
+		std::atomic<uint64_t> rtt_max_;
+		std::unique_ptr<std::atomic<uint64_t>[]> rtt_;
+};
+
+/// @brief Matches replies of one tx flow to its packets.
+///
+/// Every flow owns a range of the 16-bit sequence space, out of which its
+/// packets are numbered in turn. A packet is retired once it is older than
+/// the late threshold or its number is needed again, unanswered it counts as
+/// lost. Replies to retired packets count as late, second replies as
+/// duplicates and replies to packets older than the newest one answered as
+/// reordered.
+class flow_tracker
+{
+	public:
+
+		typedef boost::asio::chrono::steady_clock::time_point time_point;
+
+		flow_tracker(uint16_t shard, uint16_t shards, tx_counters* counters, boost::asio::chrono::milliseconds late);
+
+		///@brief Sequence number for the next packet, sent now.
+		uint16_t next(time_point now, std::size_t bytes);
+
+		///@brief Move the send time of a sequence number still in flight to its kernel stamp.
+		void restamp(uint16_t sequence, time_point sent_at);
+
+		///@brief Account the reply to a sequence number, false if it is not of this flow.
+		bool reply(uint16_t sequence, time_point now, boost::asio::chrono::steady_clock::duration& rtt);
+
+		///@brief Retire the packets older than the late threshold.
+		void expire(time_point now);
+
+		///@brief True once every packet sent is retired.
+		bool idle() const
+		{
+			return oldest_ == sent_;
+		}
+
+	private:
+
+		void retire();
+
+		uint16_t base_;
+		uint32_t range_;
+		tx_counters* counters_;
+		boost::asio::chrono::milliseconds late_;
+		///@brief Packets sent so far, oldest one not retired and newest one answered, counted from 0.
+		uint64_t sent_;
+		uint64_t oldest_;
+		uint64_t newest_answered_;
+		bool answered_any_;
+		std::vector<time_point> sent_at_;
+		std::vector<uint8_t> answered_;
+};
+
+/// @brief Merges the counters of all tx flows and reports them.
+///
+/// Flows register before the workers run. Every report shows the interval
+/// since the one before: packet and bit rates, losses, duplicates,
+/// reordering, late replies and round trip time percentiles.
+class tx_stats
+{
+	public:
+
+		tx_stats(uint32_t interval, uint32_t late);
+
+		boost::asio::chrono::milliseconds interval() const
+		{
+			return interval_;
+		}
+
+		boost::asio::chrono::milliseconds late() const
+		{
+			return late_;
+		}
+
+		tx_counters* add_flow();
+
+		///@brief A flow sent everything and retired all its packets.
+		void finish_flow()
+		{
+			finished_.fetch_add(1, std::memory_order_acq_rel);
+		}
+
+		bool finished() const;
+
+		///@brief Report the interval since the last report, with total the whole run.
+		void report(std::ostream& os, bool total);
+
+	private:
+
+		struct snapshot
+		{
+			uint64_t sent_packets;
+			uint64_t sent_bytes;
+			uint64_t received;
+			uint64_t lost;
+			uint64_t duplicates;
+			uint64_t reordered;
+			uint64_t late;
+			hdr_histogram rtt;
+		};
+
+		void load(snapshot& current);
+
+		boost::asio::chrono::milliseconds interval_;
+		boost::asio::chrono::milliseconds late_;
+		std::mutex flows_mutex_;
+		std::vector<std::unique_ptr<tx_counters> > flows_;
+		std::atomic<std::size_t> finished_;
+		boost::asio::chrono::steady_clock::time_point started_;
+		boost::asio::chrono::steady_clock::time_point reported_;
+		snapshot previous_;
+};
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef TOPOLOGY_TOPOLOGY_FORMAT
+#define TOPOLOGY_TOPOLOGY_FORMAT
+
+#include <cstddef>
+#include <boost/cstdint.hpp>
+
+/*
+	Topology store file
+
+	+------------------------+
+	| topology_file_header   |  64 bytes, capacity and count of every section
+	+------------------------+
+	| topology_interface[]   |  interface_capacity entries, the id of an interface is its index + 1
+	| uint32_t[]             |  hash index of the interfaces, 2 * interface_capacity ids
+	| topology_link[]        |  link_capacity entries
+	| uint32_t[]             |  hash index of the links
+	| topology_destination[] |  destination_capacity entries
+	| uint32_t[]             |  hash index of the destinations
+	| uint32_t[]             |  path_capacity words of paths
+	+------------------------+
+
+	All sections have a fixed size given by the capacities in the header, so
+	a reader maps the file and uses it in place. The hash indexes hold the
+	entry number + 1 of an entry, 0 marks a free slot, and are probed
+	linearly from the multiplicative hash of the key. A path is a word with
+	its length n followed by n interface ids, one per TTL from 1, 0 where
+	no answer is known, because the hop was silent or a Doubletree trace
+	skipped it. A destination points to its latest path, a path
+	that changed is appended and the old one is left behind until the store
+	grows and is rewritten. A path a Doubletree trace cut short at the stop
+	set is marked partial, it never replaces a complete one. Values are in the byte order of the host that
+	wrote the file, addresses as the host order integer of the IPv4 address,
+	times in nanoseconds since the epoch.
+*/
+
+namespace topology_format
+{
+	static const char magic[8] = { 'R', 'T', 'I', 'T', 'O', 'P', 'O', 0 };
+	static const uint32_t version = 1;
+	static const uint32_t byte_order = 0x01020304;
+	///@brief Round trip times kept per link for its median.
+	static const std::size_t recent_samples = 7;
+}
+
+namespace topology_path_flags
+{
+	///@brief TTLs the stop set knew were not probed, the path is complete without the flag.
+	static const uint32_t partial = 1;
+}
+
+struct topology_file_header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t interface_capacity;
+	uint32_t interface_count;
+	uint32_t link_capacity;
+	uint32_t link_count;
+	uint32_t destination_capacity;
+	uint32_t destination_count;
+	uint64_t path_capacity;
+	uint64_t path_used;
+	uint64_t updated;
+};
+
+struct topology_interface
+{
+	uint32_t address;
+	///@brief Lowest round trip time to the interface in microseconds.
+	uint32_t min_rtt_us;
+	uint64_t first_seen;
+	uint64_t last_seen;
+};
+
+///@brief Two interfaces answered at neighbouring TTLs, from in front of to.
+struct topology_link
+{
+	uint32_t from;
+	uint32_t to;
+	uint64_t last_seen;
+	///@brief Round trip times to the far end of the link in microseconds.
+	uint32_t min_rtt_us;
+	uint32_t samples;
+	///@brief The latest samples, sample n at n % recent_samples.
+	uint32_t recent_rtt_us[topology_format::recent_samples];
+	uint32_t reserved;
+};
+
+struct topology_destination
+{
+	uint32_t address;
+	///@brief topology_path_flags of the latest path.
+	uint32_t flags;
+	///@brief Word offset of the latest path + 1, 0 without one.
+	uint64_t path;
+	uint64_t updated;
+};
+
+///@brief Offsets of the sections of a store with the capacities of header, from the start of the file.
+struct topology_layout
+{
+	explicit topology_layout(const topology_file_header& header)
+	{
+		interfaces = sizeof(topology_file_header);
+		interface_index = interfaces + align(header.interface_capacity * sizeof(topology_interface));
+		links = interface_index + align(2 * static_cast<std::size_t>(header.interface_capacity) * sizeof(uint32_t));
+		link_index = links + align(header.link_capacity * sizeof(topology_link));
+		destinations = link_index + align(2 * static_cast<std::size_t>(header.link_capacity) * sizeof(uint32_t));
+		destination_index = destinations + align(header.destination_capacity * sizeof(topology_destination));
+		paths = destination_index + align(2 * static_cast<std::size_t>(header.destination_capacity) * sizeof(uint32_t));
+		size = paths + align(header.path_capacity * sizeof(uint32_t));
+	}
+
+	static std::size_t align(std::size_t length)
+	{
+		return (length + 7) & ~static_cast<std::size_t>(7);
+	}
+
+	std::size_t interfaces;
+	std::size_t interface_index;
+	std::size_t links;
+	std::size_t link_index;
+	std::size_t destinations;
+	std::size_t destination_index;
+	std::size_t paths;
+	std::size_t size;
+};
+
+#endif
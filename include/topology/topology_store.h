@@ -0,0 +1,163 @@
+#ifndef TOPOLOGY_TOPOLOGY_STORE
+#define TOPOLOGY_TOPOLOGY_STORE
+
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <boost/asio/ip/address_v4.hpp>
+#include <hop_format.hpp>
+#include <topology_format.hpp>
+
+/// @brief Interfaces, links and paths learned by traces, kept in a memory-mapped file.
+///
+/// Opening maps the file and checks its header, nothing is read up front. A
+/// missing file is created empty, unless the store is opened read only to
+/// look at it, which leaves the file as it is. Traces are merged in with add_trace(),
+/// every call takes a lock, so engines on several workers may share one
+/// store. A section that runs full makes the store rewrite itself into a
+/// file of twice the capacity, which replaces the old one. Damaged or
+/// foreign files throw std::runtime_error.
+class topology_store
+{
+	public:
+
+		explicit topology_store(const std::string& path, bool read_only = false);
+
+		~topology_store();
+
+		///@brief Merge the answered hops of a trace to one target, in TTL order as trace_session::records gives them.
+		///
+		/// A partial trace, which left out TTLs the Doubletree stop set knew,
+		/// adds its interfaces and links, but keeps a complete path to the
+		/// target in place.
+		void add_trace(const std::vector<hop_record>& hops, bool partial = false);
+
+		///@brief Write the mapped pages back to the file.
+		void flush();
+
+		uint32_t interface_count() const
+		{
+			return header_->interface_count;
+		}
+
+		///@brief The interface with id, ids run from 1 to interface_count.
+		const topology_interface& interface(uint32_t id) const
+		{
+			return interfaces()[id - 1];
+		}
+
+		uint32_t link_count() const
+		{
+			return header_->link_count;
+		}
+
+		const topology_link& link(uint32_t i) const
+		{
+			return links()[i];
+		}
+
+		uint32_t destination_count() const
+		{
+			return header_->destination_count;
+		}
+
+		const topology_destination& destination(uint32_t i) const
+		{
+			return destinations()[i];
+		}
+
+		///@brief The entry of a destination, 0 if it was never traced.
+		const topology_destination* find_destination(const boost::asio::ip::address_v4& destination) const;
+
+		///@brief Interface ids of the latest path to destination by TTL from 1, 0 where no answer is known, false if there is none.
+		bool path(const boost::asio::ip::address_v4& destination, std::vector<uint32_t>& hops) const;
+
+		bool path(const topology_destination& destination, std::vector<uint32_t>& hops) const;
+		
+		///@brief Addresses of the latest path to destination by TTL from 1, like path() but safe while other engines add traces.
+		bool route(const boost::asio::ip::address_v4& destination, std::vector<uint32_t>& addresses) const;
+
+		///@brief Median of the recent round trip times of a link in microseconds.
+		static uint32_t median_rtt_us(const topology_link& link);
+
+	private:
+
+		topology_store(const topology_store&);
+
+		topology_store& operator=(const topology_store&);
+
+		void create(const std::string& path);
+
+		void map(const std::string& path, int fd, std::size_t length);
+
+		void unmap();
+
+		///@brief Make room for as many new entries and path words, growing the store if needed.
+		void reserve(uint32_t interfaces, uint32_t links, uint32_t destinations, uint64_t words);
+
+		void grow(const topology_file_header& capacities);
+
+		///@brief Id of the interface with address, its time and round trip are only taken if seen.
+		uint32_t intern_interface(uint32_t address, uint32_t rtt_us, uint64_t now, bool seen);
+
+		void add_link(uint32_t from, uint32_t to, uint32_t rtt_us, uint64_t now);
+
+		void set_path(uint32_t address, const std::vector<uint32_t>& hops, bool partial, uint64_t now);
+
+		topology_interface* interfaces() const
+		{
+			return reinterpret_cast<topology_interface*>(data_ + layout_.interfaces);
+		}
+
+		uint32_t* interface_index() const
+		{
+			return reinterpret_cast<uint32_t*>(data_ + layout_.interface_index);
+		}
+
+		topology_link* links() const
+		{
+			return reinterpret_cast<topology_link*>(data_ + layout_.links);
+		}
+
+		uint32_t* link_index() const
+		{
+			return reinterpret_cast<uint32_t*>(data_ + layout_.link_index);
+		}
+
+		topology_destination* destinations() const
+		{
+			return reinterpret_cast<topology_destination*>(data_ + layout_.destinations);
+		}
+
+		uint32_t* destination_index() const
+		{
+			return reinterpret_cast<uint32_t*>(data_ + layout_.destination_index);
+		}
+
+		uint32_t* paths() const
+		{
+			return reinterpret_cast<uint32_t*>(data_ + layout_.paths);
+		}
+
+		///@brief Slot of key in an index of 2 * capacity slots, the one holding it or the free one it belongs in.
+		template <typename Match>
+		static std::size_t find(const uint32_t* index, uint32_t capacity, uint64_t key, Match match);
+
+		std::string path_;
+		bool read_only_;
+		uint8_t* data_;
+		std::size_t length_;
+		topology_file_header* header_;
+		topology_layout layout_;
+		mutable std::mutex mutex_;
+		std::vector<uint32_t> hops_;
+};
+
+///@brief Write every link with its round trip times, one per line.
+void write_links(const topology_store& store, std::ostream& os);
+
+///@brief Write the latest path to destination, one hop per line.
+void write_path(const topology_store& store, const boost::asio::ip::address_v4& destination, std::ostream& os);
+
+#endif
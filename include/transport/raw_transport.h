@@ -0,0 +1,70 @@
+#ifndef TRANSPORT_RAW_TRANSPORT
+#define TRANSPORT_RAW_TRANSPORT
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <packet_ring.hpp>
+#include <packet_tx_ring.hpp>
+#include <raw.hpp>
+#include <receive_ring.hpp>
+#include <timestamping.hpp>
+#include <transport.hpp>
+
+/// @brief Transport over a raw IPv4 send socket and an ICMP receive socket.
+///
+/// Without batching a datagram is handed to the kernel right away, only if
+/// the socket buffer is full it is copied and sent once the socket is
+/// writable again. With a batch size above one datagrams go through a
+/// raw_batch_sender. Replies are drained in batches through a receive_ring,
+/// with kernel receive stamps if asked for, or with a ring size taken from a
+/// packet_ring on interface, all of them if it is empty, without a copy.
+/// With a tx ring size datagrams leave as Ethernet frames through a
+/// packet_tx_ring on interface instead of the raw socket, batch size and
+/// flush deadline then apply to the kicks of the ring.
+class raw_transport : public transport
+{
+	public:
+
+		raw_transport(boost::asio::io_context& io_context, uint16_t batch_size = 1, uint32_t flush_deadline = 1000, std::size_t packet_size = 2048, timestamping::mode stamps = timestamping::none, int receive_buffer = 0, std::size_t ring_size = 0, uint32_t retire_timeout = 10, const std::string& interface = "", std::size_t tx_ring_size = 0, bool qdisc_bypass = false);
+
+		virtual bool send(const uint8_t* data, std::size_t length);
+
+		virtual std::size_t pending() const;
+
+		virtual void start(receive_handler handler);
+
+		virtual void stop();
+
+		virtual bool filter(const icmp_filter& filter);
+
+		virtual raw::socket* socket()
+		{
+			return &raw_socket_;
+		}
+
+	private:
+
+		///@brief Continue the backlog once the socket buffer drained, or after a backoff if the device queue is full.
+		void wait_writable(int error);
+
+		void handle_writable(const boost::system::error_code& error);
+
+		raw::socket raw_socket_;
+		///@brief Either the ICMP socket with its receive_ring or the packet_ring is there.
+		std::unique_ptr<boost::asio::ip::icmp::socket> receive_socket_;
+		std::unique_ptr<receive_ring<boost::asio::ip::icmp::socket> > receive_ring_;
+		std::unique_ptr<packet_ring> packet_ring_;
+		std::unique_ptr<raw::batch_sender> batch_;
+		std::unique_ptr<packet_tx_ring> tx_ring_;
+		///@brief Datagrams waiting for the socket buffer to drain, in the order they were sent.
+		std::deque<std::vector<uint8_t> > backlog_;
+		bool waiting_;
+		///@brief ENOBUFS leaves the socket writable, the backlog waits on the timer instead.
+		boost::asio::steady_timer backoff_timer_;
+		boost::asio::chrono::microseconds backoff_;
+};
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef TRANSPORT_SIMULATED_NETWORK
+#define TRANSPORT_SIMULATED_NETWORK
+
+#include <deque>
+#include <random>
+#include <vector>
+#include <boost/asio.hpp>
+#include <transport.hpp>
+
+/// @brief A chain of routers in front of every destination, simulated in process.
+///
+/// A datagram with TTL t is answered by router t with time exceeded, or, if
+/// t is beyond the last router, by its destination with an echo reply for an
+/// echo request and port unreachable for UDP. Every hop adds its delay in
+/// both directions and may lose the datagram on the way out and the reply on
+/// the way back. Each responder limits its ICMP messages with a token bucket,
+/// like the rate limiting of real routers. Replies are delivered on the
+/// io_context when they are due, stamped with the exact due time. The token
+/// buckets run on simulated time, which advances by the time every datagram
+/// takes on the link of the sender at bandwidth, and at least to the due
+/// time of every reply delivered, so runs with the same seed and the same
+/// sends give the same results whatever the scheduling of the host. No
+/// sockets and no privileges are needed.
+class simulated_network : public transport
+{
+	public:
+
+		struct hop
+		{
+			hop() :
+				delay(boost::asio::chrono::microseconds(1000)),
+				loss(0),
+				rate(0),
+				burst(50)
+			{
+			}
+
+			///@brief One way delay of the link in front of the hop.
+			boost::asio::chrono::steady_clock::duration delay;
+			///@brief Chance of losing a datagram in each direction, 0 to 1.
+			double loss;
+			///@brief ICMP messages per second the hop sends at most, 0 for no limit.
+			uint32_t rate;
+			uint32_t burst;
+		};
+
+		///@brief Routers, then the hop that stands for every destination, bandwidth of the link of the sender in bit/s.
+		simulated_network(boost::asio::io_context& io_context, const std::vector<hop>& routers, const hop& destination, uint64_t seed = 1, uint64_t bandwidth = 1000000000);
+
+		virtual bool send(const uint8_t* data, std::size_t length);
+
+		virtual void start(receive_handler handler);
+
+		virtual void stop();
+
+		///@brief Address of router ttl, taken from 100.64.0.0/10.
+		static boost::asio::ip::address_v4 router_address(uint16_t ttl);
+
+		uint64_t lost() const
+		{
+			return lost_;
+		}
+
+		uint64_t limited() const
+		{
+			return limited_;
+		}
+
+	private:
+
+		struct reply
+		{
+			boost::asio::chrono::steady_clock::time_point due;
+			///@brief Due time in simulated time.
+			boost::asio::chrono::steady_clock::time_point simulated;
+			uint32_t slot;
+		};
+
+		struct responder
+		{
+			hop link;
+			///@brief Round trip time to the hop.
+			boost::asio::chrono::steady_clock::duration round_trip;
+			double tokens;
+			boost::asio::chrono::steady_clock::time_point refilled;
+			///@brief Replies in flight, due in the order they were sent since the delay is fixed.
+			std::deque<reply> replies;
+		};
+
+		bool lose(const hop& link);
+
+		bool allow(responder& target, boost::asio::chrono::steady_clock::time_point now);
+
+		///@brief Build the reply to a datagram in a slot, none if it gets no reply.
+		uint32_t answer(const uint8_t* data, std::size_t length, std::size_t distance, const boost::asio::ip::address_v4& from);
+
+		uint32_t allocate(std::size_t length);
+
+		void schedule();
+
+		void handle_timer(const boost::system::error_code& error);
+
+		boost::asio::steady_timer timer_;
+		bool armed_;
+		boost::asio::chrono::steady_clock::time_point armed_at_;
+		bool running_;
+		///@brief Simulated time, the token buckets are refilled on it.
+		boost::asio::chrono::steady_clock::time_point clock_;
+		uint64_t bandwidth_;
+		receive_handler handler_;
+		std::vector<responder> responders_;
+		std::mt19937_64 random_;
+		std::uniform_real_distribution<double> uniform_;
+		std::vector<std::vector<uint8_t> > slots_;
+		std::vector<uint32_t> free_slots_;
+		std::vector<received_datagram> batch_;
+		std::vector<uint32_t> batch_slots_;
+		uint64_t lost_;
+		uint64_t limited_;
+};
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef TRANSPORT_TRANSPORT
+#define TRANSPORT_TRANSPORT
+
+#include <boost/function.hpp>
+#include <icmp_filter.hpp>
+#include <raw.hpp>
+#include <receive_ring.hpp>
+
+/// @brief Where probes and tx packets go and ICMP replies come from.
+///
+/// A transport takes complete IPv4 datagrams, the destination is the one in
+/// the header, and hands every ICMP datagram that comes back to the receive
+/// handler in batches. raw_transport puts them on the wire, the
+/// simulated_network answers them in process. All calls and handlers run on
+/// the io_context the transport was created on.
+class transport
+{
+	public:
+
+		typedef boost::function<void(const received_datagram* datagrams, std::size_t count)> receive_handler;
+
+		virtual ~transport()
+		{
+		}
+
+		///@brief Send a datagram, data only has to stay valid for the call. False if it was dropped.
+		virtual bool send(const uint8_t* data, std::size_t length) = 0;
+
+		///@brief Datagrams queued but not handed on yet.
+		virtual std::size_t pending() const
+		{
+			return 0;
+		}
+
+		///@brief Start handing received datagrams to handler.
+		virtual void start(receive_handler handler) = 0;
+
+		///@brief Stop receiving, the transport no longer keeps the io_context busy.
+		virtual void stop() = 0;
+
+		///@brief Have the kernel drop the received datagrams filter does not keep, false if they all still come.
+		virtual bool filter(const icmp_filter&)
+		{
+			return false;
+		}
+
+		///@brief The raw socket datagrams leave on, 0 if there is none.
+		virtual raw::socket* socket()
+		{
+			return 0;
+		}
+};
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef TRANSPORT_URING_TRANSPORT
+#define TRANSPORT_URING_TRANSPORT
+
+#include <vector>
+#include <boost/asio.hpp>
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <raw.hpp>
+#include <transport.hpp>
+
+/// @brief Transport that sends and receives through an io_uring instead of readiness notifications.
+///
+/// The ring is set up with the raw syscalls. Datagrams are copied into send
+/// slots and queued as send requests, which are submitted together once
+/// batch_size of them are queued, or when a ring timeout of the flush deadline
+/// started by the first of them completes. A datagram offered while every
+/// slot is in flight is dropped. Replies come from one multishot receive on
+/// the ICMP socket, or from a few single receives on kernels without it,
+/// into buffers the ring picks from a provided buffer ring and that go back
+/// to it once the handler returned. The ring signals completions on an
+/// eventfd the io_context waits on, so timers and handlers of the rest of
+/// the program keep running on the io_context.
+class uring_transport : public transport
+{
+	public:
+
+		uring_transport(boost::asio::io_context& io_context, uint16_t batch_size = 1, uint32_t flush_deadline = 1000, std::size_t packet_size = 2048, int receive_buffer = 0);
+
+		virtual ~uring_transport();
+
+		virtual bool send(const uint8_t* data, std::size_t length);
+
+		virtual std::size_t pending() const
+		{
+			return queued_;
+		}
+
+		virtual void start(receive_handler handler);
+
+		virtual void stop();
+
+		virtual bool filter(const icmp_filter& filter);
+
+		virtual raw::socket* socket()
+		{
+			return &raw_socket_;
+		}
+
+	private:
+
+		uring_transport(const uring_transport&);
+
+		uring_transport& operator=(const uring_transport&);
+
+		///@brief Unmap the rings and close the io_uring.
+		void release();
+
+		///@brief The next free submission queue entry, 0 if the queue is full.
+		io_uring_sqe* next_entry();
+
+		///@brief Hand the entries queued since the last call to the kernel.
+		void submit();
+
+		///@brief Keep the multishot receive, or the single receives, in flight.
+		void arm_receive();
+
+		void arm_flush_timeout();
+
+		void wait_completions();
+
+		void handle_completions(const boost::system::error_code& error);
+
+		///@brief Collect the completions and hand the replies that arrived since the last round to the handler in one batch.
+		void reap();
+
+		///@brief Work through the completion queue, sends free their slots and replies are kept for reap.
+		void collect();
+
+		///@brief Give the receive buffers of the last batch back to the buffer ring.
+		void recycle();
+
+		raw::socket raw_socket_;
+		boost::asio::ip::icmp::socket receive_socket_;
+		boost::asio::posix::stream_descriptor completions_;
+
+		int ring_fd_;
+		io_uring_params params_;
+		uint8_t* sq_ring_;
+		std::size_t sq_ring_size_;
+		uint8_t* cq_ring_;
+		std::size_t cq_ring_size_;
+		io_uring_sqe* entries_;
+		unsigned* sq_head_;
+		unsigned* sq_tail_;
+		unsigned* sq_mask_;
+		unsigned* sq_array_;
+		unsigned* sq_flags_;
+		unsigned* cq_head_;
+		unsigned* cq_tail_;
+		unsigned* cq_mask_;
+		io_uring_cqe* cqes_;
+		///@brief Entries written to the submission queue but not submitted yet.
+		unsigned unsubmitted_;
+
+		///@brief One datagram per slot with its address, free slots are listed in free_slots_.
+		std::size_t packet_size_;
+		std::vector<uint8_t> send_storage_;
+		std::vector<sockaddr_in> send_addresses_;
+		std::vector<iovec> send_iovecs_;
+		std::vector<msghdr> send_messages_;
+		std::vector<uint16_t> free_slots_;
+		std::size_t batch_size_;
+		__kernel_timespec flush_deadline_;
+		std::size_t queued_;
+		bool flush_armed_;
+
+		io_uring_buf_ring* buffer_ring_;
+		std::size_t buffer_ring_size_;
+		std::vector<uint8_t> receive_storage_;
+		std::vector<received_datagram> arrived_;
+		std::vector<uint16_t> arrived_buffers_;
+		std::vector<received_datagram> datagrams_;
+		std::vector<uint16_t> used_buffers_;
+		receive_handler handler_;
+		///@brief Receives armed whose last completion is still to come.
+		std::size_t receives_;
+		bool multishot_;
+		bool receive_failed_;
+		bool running_;
+		uint64_t dropped_;
+};
+
+#endif
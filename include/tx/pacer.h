@@ -0,0 +1,52 @@
+#ifndef TX_PACER
+#define TX_PACER
+
+#include <boost/asio.hpp>
+#include <boost/function.hpp>
+
+/// @brief Paces a packet stream to a target rate with a token bucket.
+///
+/// Send times are derived from the start of the stream, never from the
+/// previous wake-up, so timer jitter does not add up. A late wake-up is made
+/// good by sending the packets that became due meanwhile, at most burst of
+/// them at once. With a spin tail the timer fires that much early and the
+/// rest of the gap is busy-waited for microsecond accuracy.
+class pacer
+{
+	public:
+		
+		///@brief Called with the number of packets due, returns how many were sent.
+		typedef boost::function<uint32_t (uint32_t allowance)> handler_type;
+		
+		pacer(boost::asio::io_context& io_context, uint32_t rate, uint32_t burst, boost::asio::chrono::microseconds spin);
+		
+		void start(const handler_type& handler);
+		
+		void stop();
+		
+		uint64_t sent() const
+		{
+			return sent_;
+		}
+
+	private:
+		
+		void schedule(boost::asio::chrono::steady_clock::time_point next);
+		
+		void handle_timer(const boost::system::error_code& error);
+		
+		///@brief Time at which the given number of packets is due in total.
+		boost::asio::chrono::steady_clock::time_point due_at(uint64_t packets) const;
+		
+		boost::asio::steady_timer timer_;
+		double rate_;
+		uint32_t burst_;
+		boost::asio::chrono::microseconds spin_;
+		handler_type handler_;
+		boost::asio::chrono::steady_clock::time_point start_;
+		boost::asio::chrono::steady_clock::time_point next_;
+		uint64_t sent_;
+		bool running_;
+};
+
+#endif
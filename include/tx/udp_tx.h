@@ -1,39 +1,69 @@
 #ifndef UDP_TX
 #define UDP_TX
 
+#include <memory>
+#include <vector>
+#include <boost/array.hpp>
 #include <boost/asio.hpp>
-#include <raw.hpp>
+#include <packet_template.hpp>
+#include <pacer.h>
+#include <send_stamps.hpp>
+#include <transport.hpp>
+#include <tx_stats.h>
 
 class udp_tx
 {
 	public:
 		
-		udp_tx(boost::asio::io_context& io_context, const char* destination, uint16_t port, uint8_t hops, uint32_t number_of_packets, uint32_t send_interval, uint16_t payload_size);
+		///@brief The flow takes ownership of network and sends from source.
+		udp_tx(boost::asio::io_context& io_context, transport* network, const boost::asio::ip::address_v4& source, const char* destination, uint16_t port, uint8_t hops, uint32_t number_of_packets, uint32_t send_interval, uint16_t payload_size, uint16_t batch_size = 1, uint32_t rate = 0, uint32_t burst = 1, uint32_t spin = 0, uint16_t shard = 0, uint16_t shards = 1, tx_stats* stats = 0, timestamping::mode stamps = timestamping::none);
 		
-		void start();
+		///@brief Start sending, with receive false replies are left to another flow.
+		void start(bool receive = true);
 
 	private:
 		
 		void send_packet();
 		
-		void handle_send(const boost::system::error_code& error, std::size_t bytes_transferred);
-	
-		void handle_receive(const boost::system::error_code& error, size_t length);
+		///@brief Pacer handler, sends up to allowance packets and returns how many went out.
+		uint32_t send_paced(uint32_t allowance);
+		
+		void transmit(uint32_t count);
+		
+		void handle_receive(const received_datagram* datagrams, std::size_t count);
+		
+		void handle_reply(const uint8_t* data, std::size_t length, boost::asio::chrono::steady_clock::time_point now);
+		
+		///@brief Move the send time of a packet to its kernel stamp.
+		void handle_send_stamp(const ipv4_header_view& sent, boost::asio::chrono::steady_clock::time_point sent_at);
+		
+		///@brief Retire old packets, finish the flow once it is done and, on the first flow, report.
+		void handle_stats(const boost::system::error_code& error);
 
-		boost::asio::basic_raw_socket<raw> raw_socket_;
+		std::unique_ptr<transport> transport_;
 		std::string remote_end_point_;
 		uint16_t remote_end_point_port_;
+		///@brief One per shard, replies are steered to the shard by their quoted source port.
+		uint16_t source_port_;
 		uint8_t ttl_;
 		uint32_t number_of_packets_to_send_;
 		uint32_t send_interval_;
 		int16_t payload_size_;
+		packet_template packet_;
+		///@brief Numbers the packets by their IP identification, replies quote it.
+		flow_tracker tracker_;
+		uint16_t batch_size_;
+		std::unique_ptr<pacer> pacer_;
+		///@brief 0 without kernel send stamps.
+		std::unique_ptr<send_stamps> send_stamps_;
 
-		boost::asio::ip::icmp::socket receive_socket_;
-		boost::asio::streambuf receive_buffer_;
-
-		boost::asio::io_service::strand strand_;
 		boost::asio::steady_timer send_timer_; 
+		///@brief Wait while the batch is full, it doubles until the sender has room again.
+		boost::asio::chrono::microseconds backoff_;
 		boost::asio::steady_timer stats_timer_; 
+		tx_stats* stats_;
+		bool reporter_;
+		bool finished_;
 			
 };
 
@@ -0,0 +1,296 @@
+#include <incremental_trace.h>
+
+#include <algorithm>
+
+namespace
+{
+	// silent hops in a row after which a segment is given up
+	const uint8_t gap_limit = 5;
+}
+
+incremental_trace::incremental_trace(const std::vector<uint32_t>& cached, uint32_t destination, uint8_t max_ttl, uint8_t window) :
+	cached_(cached),
+	destination_(destination),
+	max_ttl_(max_ttl),
+	window_(std::max<uint8_t>(1, window)),
+	phase_(sentinels),
+	state_(max_ttl + 1, unprobed),
+	observed_(max_ttl + 1, 0),
+	sent_(max_ttl + 1),
+	in_flight_(0),
+	cursor_(0),
+	sent_up_to_(0),
+	diverged_at_(0),
+	silent_(0)
+{
+	if(cached_.size() > max_ttl_)
+		cached_.resize(max_ttl_);
+}
+
+void incremental_trace::start(time_point now, std::vector<uint8_t>& probes)
+{
+	// the sentinels are spread evenly, the last one at the end of the cached path
+	uint8_t length = static_cast<uint8_t>(cached_.size());
+	for(uint8_t i = 0; i < window_ && i < length; ++i)
+	{
+		uint8_t ttl = static_cast<uint8_t>(length - i * length / window_);
+		if(sentinels_.empty() || sentinels_.back() != ttl)
+			sentinels_.push_back(ttl);
+	}
+	std::reverse(sentinels_.begin(), sentinels_.end());
+
+	if(sentinels_.empty())
+	{
+		// nothing is cached, trace from the start
+		phase_ = segment;
+		cursor_ = 1;
+		advance(now, probes);
+		return;
+	}
+	for(std::size_t i = 0; i < sentinels_.size(); ++i)
+		send(sentinels_[i], now, probes);
+}
+
+void incremental_trace::answer(uint8_t ttl, uint32_t address, time_point now, std::vector<uint8_t>& probes)
+{
+	resolve(ttl, address, now, probes);
+}
+
+void incremental_trace::expire(time_point cutoff, time_point now, std::vector<uint8_t>& probes)
+{
+	for(uint16_t ttl = 1; ttl <= max_ttl_ && phase_ != finished; ++ttl)
+	{
+		if(state_[ttl] == in_flight && sent_[ttl] <= cutoff)
+			resolve(static_cast<uint8_t>(ttl), 0, now, probes);
+	}
+}
+
+incremental_trace::time_point incremental_trace::oldest() const
+{
+	time_point oldest = time_point::max();
+	for(uint16_t ttl = 1; ttl <= max_ttl_; ++ttl)
+	{
+		if(state_[ttl] == in_flight)
+			oldest = std::min(oldest, sent_[ttl]);
+	}
+	return oldest;
+}
+
+void incremental_trace::send(uint8_t ttl, time_point now, std::vector<uint8_t>& probes)
+{
+	state_[ttl] = in_flight;
+	sent_[ttl] = now;
+	++in_flight_;
+	probes.push_back(ttl);
+}
+
+void incremental_trace::resolve(uint8_t ttl, uint32_t address, time_point now, std::vector<uint8_t>& probes)
+{
+	// late answers to probes given up on are dropped
+	if(ttl == 0 || ttl > max_ttl_ || state_[ttl] != in_flight || phase_ == finished)
+		return;
+	state_[ttl] = resolved;
+	observed_[ttl] = address;
+	--in_flight_;
+
+	if(phase_ == segment)
+		advance(now, probes);
+	else if(in_flight_ == 0 && !next_segment(0, now, probes) && !extend(now, probes))
+		// every sentinel is where it was
+		finish();
+}
+
+uint32_t incremental_trace::cached_at(uint16_t ttl, int shift) const
+{
+	int cached_ttl = static_cast<int>(ttl) - shift;
+	if(cached_ttl < 1 || cached_ttl > static_cast<int>(cached_.size()))
+		return 0;
+	return cached_[cached_ttl - 1];
+}
+
+uint8_t incremental_trace::cached_ttl(uint32_t address) const
+{
+	std::vector<uint32_t>::const_iterator hop = std::find(cached_.begin(), cached_.end(), address);
+	return hop == cached_.end() ? 0 : static_cast<uint8_t>(hop - cached_.begin() + 1);
+}
+
+bool incremental_trace::conflicts(uint8_t ttl, int shift) const
+{
+	// a silent hop or one that is not cached says nothing either way
+	uint32_t expected = cached_at(ttl, shift);
+	return observed_[ttl] != 0 && expected != 0 && observed_[ttl] != expected;
+}
+
+bool incremental_trace::next_segment(uint8_t ttl, time_point now, std::vector<uint8_t>& probes)
+{
+	int shift = shifts_.empty() ? 0 : shifts_.back().second;
+	uint8_t start = ttl;
+	for(std::size_t i = 0; i < sentinels_.size(); ++i)
+	{
+		uint8_t sentinel = sentinels_[i];
+		if(sentinel <= ttl)
+			continue;
+		if(conflicts(sentinel, shift))
+		{
+			// the path changed somewhere between the last sentinel that agreed and this one
+			phase_ = segment;
+			cursor_ = static_cast<uint16_t>(start + 1);
+			sent_up_to_ = std::max<uint16_t>(sent_up_to_, start);
+			diverged_at_ = 0;
+			silent_ = 0;
+			advance(now, probes);
+			return true;
+		}
+		if(observed_[sentinel] != 0 && observed_[sentinel] == cached_at(sentinel, shift))
+			start = sentinel;
+	}
+	return false;
+}
+
+bool incremental_trace::extend(time_point now, std::vector<uint8_t>& probes)
+{
+	int shift = shifts_.empty() ? 0 : shifts_.back().second;
+	int first = static_cast<int>(cached_.size()) + shift + 1;
+	if((!cached_.empty() && cached_.back() == destination_) || first < 1 || first > max_ttl_)
+		return false;
+
+	phase_ = segment;
+	cursor_ = static_cast<uint16_t>(first);
+	sent_up_to_ = std::max<uint16_t>(sent_up_to_, static_cast<uint16_t>(first - 1));
+	diverged_at_ = 0;
+	silent_ = 0;
+	advance(now, probes);
+	return true;
+}
+
+void incremental_trace::advance(time_point now, std::vector<uint8_t>& probes)
+{
+	while(phase_ == segment && cursor_ <= max_ttl_ && state_[cursor_] == resolved)
+	{
+		uint8_t ttl = static_cast<uint8_t>(cursor_);
+		uint32_t address = observed_[ttl];
+		int shift = shifts_.empty() ? 0 : shifts_.back().second;
+
+		if(address == 0)
+		{
+			if(++silent_ >= gap_limit)
+			{
+				if(diverged_at_ != 0)
+					add_change(diverged_at_, diverged_at_ - shift, static_cast<int>(cached_.size()));
+				finish();
+				return;
+			}
+			++cursor_;
+			continue;
+		}
+		silent_ = 0;
+
+		// beyond the end of the cached path every hop is new, but none is a change
+		bool beyond = static_cast<int>(ttl) - shift > static_cast<int>(cached_.size());
+		if(diverged_at_ == 0 && (address == cached_at(ttl, shift) || beyond))
+		{
+			if(address == destination_)
+			{
+				finish();
+				return;
+			}
+			++cursor_;
+			continue;
+		}
+
+		uint8_t rejoin = cached_ttl(address);
+		if(rejoin != 0)
+		{
+			// back on the cached path, beyond this hop it is the cached one at the new shift
+			uint8_t first = diverged_at_ != 0 ? diverged_at_ : ttl;
+			add_change(first, first - shift, rejoin - 1);
+			shifts_.push_back(std::make_pair(ttl, static_cast<int>(ttl) - rejoin));
+			diverged_at_ = 0;
+			if(address == destination_ || (!next_segment(ttl, now, probes) && !extend(now, probes)))
+				finish();
+			return;
+		}
+
+		if(diverged_at_ == 0)
+			diverged_at_ = ttl;
+		if(address == destination_ || ttl == max_ttl_)
+		{
+			// the cached path never reached the destination here, everything from the divergence on is new
+			add_change(diverged_at_, diverged_at_ - shift, static_cast<int>(cached_.size()));
+			finish();
+			return;
+		}
+		++cursor_;
+	}
+
+	if(phase_ != segment)
+		return;
+	// every TTL up to max_ttl is answered or given up on, nothing is in flight any more
+	if(cursor_ > max_ttl_)
+	{
+		finish();
+		return;
+	}
+	// keep a window of probes in flight ahead of the cursor
+	while(sent_up_to_ < max_ttl_ && sent_up_to_ < cursor_ + window_ - 1)
+	{
+		++sent_up_to_;
+		if(state_[sent_up_to_] == unprobed)
+			send(static_cast<uint8_t>(sent_up_to_), now, probes);
+	}
+}
+
+void incremental_trace::add_change(uint8_t ttl, int cached_first, int cached_last)
+{
+	change result;
+	result.ttl = ttl;
+	for(int i = std::max(1, cached_first); i <= cached_last && i <= static_cast<int>(cached_.size()); ++i)
+		result.before.push_back(cached_[i - 1]);
+	for(uint16_t i = ttl; i < cursor_ && i <= max_ttl_; ++i)
+		result.after.push_back(observed_[i]);
+	// the answer that ended the segment is new as well, unless it rejoined the cached path
+	if(cursor_ <= max_ttl_ && observed_[cursor_] != 0 && cached_ttl(observed_[cursor_]) == 0)
+		result.after.push_back(observed_[cursor_]);
+	if(!result.before.empty() || !result.after.empty())
+		changes_.push_back(result);
+}
+
+void incremental_trace::finish()
+{
+	phase_ = finished;
+
+	// the path runs to the destination, where it was answered or cached at the last shift
+	uint16_t length = 0;
+	for(uint16_t ttl = 1; ttl <= max_ttl_; ++ttl)
+	{
+		if(state_[ttl] == resolved && observed_[ttl] == destination_)
+		{
+			length = ttl;
+			break;
+		}
+	}
+	if(length == 0)
+	{
+		int shift = shifts_.empty() ? 0 : shifts_.back().second;
+		int end = static_cast<int>(cached_.size()) + shift;
+		for(uint16_t ttl = 1; ttl <= max_ttl_; ++ttl)
+		{
+			if(state_[ttl] == resolved && observed_[ttl] != 0)
+				end = std::max<int>(end, ttl);
+		}
+		length = static_cast<uint16_t>(std::max(0, std::min<int>(end, max_ttl_)));
+	}
+
+	path_.assign(length, 0);
+	std::size_t next_shift = 0;
+	int shift = 0;
+	for(uint16_t ttl = 1; ttl <= length; ++ttl)
+	{
+		while(next_shift < shifts_.size() && shifts_[next_shift].first <= ttl)
+			shift = shifts_[next_shift++].second;
+		if(state_[ttl] == resolved && observed_[ttl] != 0)
+			path_[ttl - 1] = observed_[ttl];
+		else
+			path_[ttl - 1] = cached_at(ttl, shift);
+	}
+}
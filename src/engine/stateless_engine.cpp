@@ -0,0 +1,258 @@
+#include <stateless_engine.h>
+
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <ostream>
+#include <random>
+#include <sstream>
+#include <logger.h>
+#include <utils.hpp>
+#include <boost/bind/bind.hpp>
+
+namespace
+{
+	// engines on other workers print their hops as well
+	std::mutex output_mutex;
+	// resolution of the send stamps
+	const boost::asio::chrono::microseconds stamp_unit(100);
+	// bounds of the wait while the transport takes no probes
+	const boost::asio::chrono::microseconds min_backoff(50);
+	const boost::asio::chrono::microseconds max_backoff(10000);
+	// time without a probe taken after which the rest are given up
+	const boost::asio::chrono::seconds stall_limit(5);
+
+	uint64_t greatest_common_divisor(uint64_t a, uint64_t b)
+	{
+		while(b != 0)
+		{
+			uint64_t rest = a % b;
+			a = b;
+			b = rest;
+		}
+		return a;
+	}
+
+	uint64_t random_64()
+	{
+		std::random_device device;
+		return static_cast<uint64_t>(device()) << 32 | device();
+	}
+}
+
+stateless_engine::stateless_engine(boost::asio::io_context& io_context, transport* network, const boost::asio::ip::address_v4& source, probe_codec::probe_type type, uint8_t max_ttl, uint32_t deadline, uint32_t rate, uint32_t burst, uint32_t spin, uint16_t batch_size, uint16_t shard, hop_writer* results) :
+	transport_(network),
+	send_timer_(io_context),
+	deadline_timer_(io_context),
+	type_(type),
+	// every shard probes with its own ICMP identifier or UDP destination port
+	identifier_(type == probe_codec::udp ? static_cast<uint16_t>(33434 + shard) : static_cast<uint16_t>(get_identifier() + shard)),
+	// the key keeps replies to an earlier run, or to someone else's scan, from validating
+	codec_(type, random_64(), identifier_, source),
+	total_(0),
+	remaining_(0),
+	step_(1),
+	position_(0),
+	results_(results),
+	backoff_(min_backoff),
+	sent_(0),
+	refused_(0),
+	answered_(0),
+	rejected_(0),
+	draining_(false)
+{
+	max_ttl_ = max_ttl == 0 ? 30 : max_ttl;
+	deadline_ = deadline;
+	batch_size_ = batch_size == 0 ? 1 : batch_size;
+
+	if(rate > 0)
+		pacer_.reset(new pacer(io_context, rate, burst, boost::asio::chrono::microseconds(spin)));
+}
+
+void stateless_engine::add_destination(const std::string& destination)
+{
+	boost::system::error_code error;
+	boost::asio::ip::address_v4 address = boost::asio::ip::make_address_v4(destination, error);
+	if(error)
+		std::cerr << "Skipping invalid destination " << destination << std::endl;
+	else
+		destinations_.push_back(address.to_uint());
+}
+
+void stateless_engine::start()
+{
+	total_ = static_cast<uint64_t>(destinations_.size()) * max_ttl_;
+	if(total_ == 0)
+		return;
+
+	// any step coprime to the number of probes visits each of them once before the walk comes back
+	step_ = total_ > 1 ? 1 + random_64() % (total_ - 1) : 1;
+	while(greatest_common_divisor(step_, total_) != 1)
+		step_ = step_ % (total_ - 1) + 1;
+	position_ = random_64() % total_;
+	remaining_ = total_;
+
+	// UDP probes leave from source ports with the high bit set to the port of the shard, ICMP probes carry the identifier of the shard
+	if(type_ == probe_codec::udp)
+		transport_->filter(icmp_filter(icmp_filter::udp, 32768, 65535, identifier_));
+	else
+		transport_->filter(icmp_filter(icmp_filter::icmp, identifier_, identifier_));
+	transport_->start(boost::bind(&stateless_engine::handle_receive, this, boost::placeholders::_1, boost::placeholders::_2));
+
+	epoch_ = boost::asio::chrono::steady_clock::now();
+	last_sent_ = epoch_;
+	if(pacer_)
+		pacer_->start(boost::bind(&stateless_engine::send_paced, this, boost::placeholders::_1));
+	else
+		send_batch();
+}
+
+void stateless_engine::send_batch()
+{
+	// every wake-up fills the free part of the batch, the receive handler runs in between
+	uint64_t count = std::min<uint64_t>(batch_size_ - std::min<std::size_t>(transport_->pending(), batch_size_), remaining_);
+	uint32_t sent = transmit(static_cast<uint32_t>(count));
+
+	if(stalled(sent) || remaining_ == 0)
+	{
+		drain();
+		return;
+	}
+	if(sent > 0)
+	{
+		backoff_ = min_backoff;
+		send_timer_.expires_after(boost::asio::chrono::milliseconds(0));
+	}
+	else
+	{
+		// the batch is full or the transport refused, a zero wait would spin until it drained
+		send_timer_.expires_after(backoff_);
+		backoff_ = std::min(backoff_ * 2, max_backoff);
+	}
+	send_timer_.async_wait(boost::bind(&stateless_engine::send_batch, this));
+}
+
+uint32_t stateless_engine::send_paced(uint32_t allowance)
+{
+	uint32_t count = static_cast<uint32_t>(std::min<uint64_t>(allowance, remaining_));
+	if(batch_size_ > 1)
+		count = std::min<uint32_t>(count, batch_size_ - std::min<std::size_t>(transport_->pending(), batch_size_));
+
+	count = transmit(count);
+	if(stalled(count) || remaining_ == 0)
+	{
+		pacer_->stop();
+		drain();
+	}
+	return count;
+}
+
+uint32_t stateless_engine::transmit(uint32_t count)
+{
+	uint32_t sent = 0;
+	for(; sent < count && remaining_ > 0; ++sent)
+	{
+		uint32_t destination = destinations_[position_ / max_ttl_];
+		uint8_t ttl = static_cast<uint8_t>(position_ % max_ttl_ + 1);
+		const packet_template& packet = codec_.encode(destination, ttl, stamp(boost::asio::chrono::steady_clock::now()));
+		if(!transport_->send(packet.data(), packet.size()))
+		{
+			// the probe stays next in the permutation and is encoded again, with a fresh stamp
+			++refused_;
+			break;
+		}
+
+		position_ = (position_ + step_) % total_;
+		--remaining_;
+	}
+	sent_ += sent;
+	return sent;
+}
+
+bool stateless_engine::stalled(uint32_t sent)
+{
+	boost::asio::chrono::steady_clock::time_point now = boost::asio::chrono::steady_clock::now();
+	if(sent > 0 || remaining_ == 0)
+	{
+		last_sent_ = now;
+		return false;
+	}
+	if(now - last_sent_ < stall_limit)
+		return false;
+
+	log_info("stateless: the transport took no probe for {} s, giving up on the {} left", stall_limit.count(), remaining_);
+	remaining_ = 0;
+	return true;
+}
+
+void stateless_engine::drain()
+{
+	if(draining_)
+		return;
+	draining_ = true;
+	deadline_timer_.expires_after(boost::asio::chrono::milliseconds(deadline_));
+	deadline_timer_.async_wait(boost::bind(&stateless_engine::handle_deadline, this, boost::asio::placeholders::error));
+}
+
+void stateless_engine::handle_deadline(const boost::system::error_code& error)
+{
+	if(error)
+		return;
+
+	transport_->stop();
+	log_info("stateless: {} probes, {} replies, {} rejected, {} refused", sent_, answered_, rejected_, refused_);
+}
+
+void stateless_engine::handle_receive(const received_datagram* datagrams, std::size_t count)
+{
+	std::ostringstream output;
+	records_.clear();
+	for(std::size_t i = 0; i < count; ++i)
+	{
+		probe_codec::reply reply;
+		if(!codec_.decode(datagrams[i].data, datagrams[i].length, reply) || reply.ttl > max_ttl_)
+		{
+			++rejected_;
+			continue;
+		}
+		++answered_;
+
+		// the stamp difference is right as long as the reply comes back within one wrap of the stamp
+		boost::asio::chrono::steady_clock::duration rtt = stamp_unit * static_cast<uint16_t>(stamp(datagrams[i].received_at) - reply.stamp);
+		if(results_)
+		{
+			hop_record record;
+			record.target = reply.target;
+			record.responder = reply.responder;
+			record.rtt_ns = static_cast<uint64_t>(boost::asio::chrono::duration_cast<boost::asio::chrono::nanoseconds>(rtt).count());
+			record.ttl = reply.ttl;
+			record.icmp_type = reply.icmp_type;
+			record.icmp_code = reply.icmp_code;
+			record.reply_ttl = reply.reply_ttl;
+			record.flags = static_cast<uint8_t>((type_ == probe_codec::udp ? hop_flags::udp : 0) | (reply.destination ? hop_flags::destination : 0));
+			records_.push_back(record);
+		}
+		else
+			output << boost::asio::ip::address_v4(reply.target).to_string() << " " << +reply.ttl << ": "
+				<< boost::asio::ip::address_v4(reply.responder).to_string()
+				<< ", time = "
+				<< boost::asio::chrono::duration<double, std::milli>(rtt).count()
+				<< std::endl;
+	}
+
+	if(results_)
+	{
+		if(!records_.empty())
+			results_->append(records_);
+	}
+	else if(output.tellp() > 0)
+	{
+		std::lock_guard<std::mutex> lock(output_mutex);
+		std::cout << output.str() << std::flush;
+	}
+}
+
+uint16_t stateless_engine::stamp(boost::asio::chrono::steady_clock::time_point time) const
+{
+	return static_cast<uint16_t>((time - epoch_) / stamp_unit);
+}
@@ -0,0 +1,33 @@
+#include <stop_set.h>
+
+#include <algorithm>
+
+stop_set::stop_set(uint8_t prefix_length) :
+	mask_(prefix_length == 0 ? 0 : 0xFFFFFFFFu << (32 - std::min<uint8_t>(prefix_length, 32)))
+{
+}
+
+bool stop_set::add_interface(const boost::asio::ip::address_v4& interface)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return !interfaces_.insert(interface.to_uint()).second;
+}
+
+bool stop_set::add_path(const boost::asio::ip::address_v4& interface, const boost::asio::ip::address_v4& destination)
+{
+	uint64_t key = (static_cast<uint64_t>(interface.to_uint()) << 32) | (destination.to_uint() & mask_);
+	std::lock_guard<std::mutex> lock(mutex_);
+	return !paths_.insert(key).second;
+}
+
+std::size_t stop_set::interfaces() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return interfaces_.size();
+}
+
+std::size_t stop_set::paths() const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return paths_.size();
+}
@@ -0,0 +1,496 @@
+#include <trace_engine.h>
+
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <icmp_header.hpp>
+#include <ipv4_header.hpp>
+#include <logger.h>
+#include <packet_template.hpp>
+#include <udp_header.hpp>
+#include <boost/bind/bind.hpp>
+
+namespace
+{
+	// engines on other workers print their sessions as well
+	std::mutex output_mutex;
+	// silent hops in a row after which a Doubletree trace stops probing forwards
+	const uint8_t gap_limit = 5;
+}
+
+trace_engine::trace_engine(boost::asio::io_context& io_context, transport* network, const boost::asio::ip::address_v4& source, probe_type type, uint8_t max_ttl, uint32_t deadline, uint16_t concurrency, uint16_t shard, uint16_t shards, timestamping::mode stamps, hop_writer* results) :
+	io_context_(io_context),
+	tick_timer_(io_context),
+	timers_(boost::asio::chrono::milliseconds(1), boost::asio::chrono::steady_clock::now()),
+	ticking_(false),
+	transport_(network),
+	probes_(static_cast<std::size_t>(std::max<uint16_t>(1, concurrency)) * (max_ttl == 0 ? 30 : max_ttl)),
+	results_(results),
+	topology_(0),
+	stops_(0),
+	first_ttl_(0),
+	window_(0),
+	probes_sent_(0)
+{
+	type_ = type;
+	max_ttl_ = max_ttl == 0 ? 30 : max_ttl;
+	deadline_ = deadline;
+	next_destination_ = 0;
+	source_address_ = source;
+	
+	// kernel stamps leave the io_context scheduling delay out of the round trip times, receive stamps are up to the transport
+	send_stamps_.reset(send_stamps::open(transport_->socket(), stamps, source_address_));
+	
+	// identifiers of all slots of all shards have to stay distinct, UDP source ports also out of the well known range
+	shards = std::max<uint16_t>(1, shards);
+	concurrency = std::max<uint16_t>(1, std::min<uint16_t>(concurrency, 16384 / shards));
+	identifier_base_ = type_ == udp ? static_cast<uint16_t>(32768 + get_identifier() % 16384) : get_identifier();
+	identifier_base_ = static_cast<uint16_t>(identifier_base_ + shard * concurrency);
+	slots_.resize(concurrency);
+	for(uint16_t slot = concurrency; slot > 0; --slot)
+		free_slots_.push_back(slot - 1);
+}
+
+void trace_engine::add_destination(const std::string& destination)
+{
+	boost::system::error_code error;
+	boost::asio::ip::address_v4 address = boost::asio::ip::make_address_v4(destination, error);
+	if(error)
+		std::cerr << "Skipping invalid destination " << destination << std::endl;
+	else
+		destinations_.push_back(address);
+}
+
+void trace_engine::doubletree(stop_set* stops, uint8_t first_ttl)
+{
+	stops_ = stops;
+	first_ttl_ = std::max<uint8_t>(1, std::min(first_ttl, max_ttl_));
+}
+
+void trace_engine::topology(topology_store* store)
+{
+	topology_ = store;
+}
+
+void trace_engine::incremental(uint8_t window)
+{
+	window_ = window;
+}
+
+void trace_engine::start()
+{
+	// replies quote the identifier or source port of a slot, everything else is not ours
+	transport_->filter(icmp_filter(type_ == udp ? icmp_filter::udp : icmp_filter::icmp, identifier_base_, static_cast<uint16_t>(identifier_base_ + slots_.size() - 1)));
+	transport_->start(boost::bind(&trace_engine::handle_receive, this, boost::placeholders::_1, boost::placeholders::_2));
+	if(send_stamps_)
+		send_stamps_->start(boost::bind(&trace_engine::handle_send_stamp, this, boost::placeholders::_1, boost::placeholders::_2));
+	start_sessions();
+}
+
+void trace_engine::start_sessions()
+{
+	probes_.expire(boost::asio::steady_timer::clock_type::now() - boost::asio::chrono::milliseconds(deadline_));
+	
+	while(!free_slots_.empty() && next_destination_ < destinations_.size())
+	{
+		uint16_t slot = free_slots_.back();
+		free_slots_.pop_back();
+		uint32_t serial = static_cast<uint32_t>(next_destination_);
+		slots_[slot].reset(new trace_session(destinations_[next_destination_++], static_cast<uint16_t>(identifier_base_ + slot), serial, max_ttl_));
+		
+		trace_session& session = *slots_[slot];
+		if(window_ > 0 && topology_ && topology_->route(session.destination(), cached_))
+		{
+			// the cached path tells which few TTLs are worth probing
+			session.incremental(new incremental_trace(cached_, session.destination().to_uint(), max_ttl_, window_));
+			ttls_.clear();
+			session.incremental()->start(boost::asio::chrono::steady_clock::now(), ttls_);
+			continue_incremental(slot);
+		}
+		else if(stops_)
+		{
+			// both directions start at once, backwards from the hop in front of the first TTL
+			boost::asio::chrono::steady_clock::time_point now = boost::asio::chrono::steady_clock::now();
+			session.forward(first_ttl_, now);
+			send_probes(session, first_ttl_, first_ttl_);
+			if(first_ttl_ > 1)
+			{
+				session.backward(static_cast<uint8_t>(first_ttl_ - 1), now);
+				send_probes(session, static_cast<uint8_t>(first_ttl_ - 1), static_cast<uint8_t>(first_ttl_ - 1));
+			}
+			schedule_probe_timeout(slot);
+		}
+		else
+		{
+			send_probes(session, 1, session.max_ttl());
+			schedule_deadline(slot, boost::asio::chrono::steady_clock::now() + boost::asio::chrono::milliseconds(deadline_));
+		}
+	}
+	
+	if(free_slots_.size() == slots_.size() && next_destination_ == destinations_.size())
+	{
+		if(stops_)
+			log_debug("{} probes for {} destinations, {} interfaces known", probes_sent_, destinations_.size(), stops_->interfaces());
+		else
+			log_debug("{} probes for {} destinations", probes_sent_, destinations_.size());
+		// all traces are done, let the io_context run out of work
+		transport_->stop();
+		if(send_stamps_)
+			send_stamps_->stop();
+	}
+}
+
+void trace_engine::send_probes(trace_session& session, uint8_t first, uint8_t last)
+{
+	// the datagram is built once per session, every TTL only patches the fields that differ
+	packet_template packet;
+	// a zero identification would be replaced by the kernel, UDP probes are matched on it
+	uint16_t identification = static_cast<uint16_t>(session.serial() % 0xFFFF + 1);
+	if(type_ == udp)
+		// the source port names the session
+		packet.udp(source_address_, session.destination(), session.identifier(), 33434, 0, 0);
+	else
+		// the identifier names the session
+		packet.icmp_echo(source_address_, session.destination(), session.identifier(), 0, 0, 0);
+	packet.identification(identification);
+	
+	for(uint16_t ttl = first; ttl <= last; ++ttl)
+	{
+		uint64_t key = 0;
+		packet.time_to_live(static_cast<uint8_t>(ttl));
+		
+		if(type_ == udp)
+		{
+			uint16_t port = static_cast<uint16_t>(33434 + ttl);
+			packet.destination_port(port);
+			key = probe_table::udp_key(session.identifier(), port, identification);
+		}
+		else
+		{
+			// the sequence number tells the probe apart from those of the previous session in the slot
+			uint16_t sequence_number = static_cast<uint16_t>(((session.serial() & 0xFF) << 8) | ttl);
+			packet.sequence_number(sequence_number);
+			key = probe_table::icmp_key(session.identifier(), sequence_number);
+		}
+		
+		// the transport copies what it cannot send right away, so the template is patched again for the next TTL
+		probes_.insert(key, boost::asio::steady_timer::clock_type::now(), static_cast<uint8_t>(ttl), session.serial());
+		transport_->send(packet.data(), packet.size());
+		++probes_sent_;
+	}
+}
+
+void trace_engine::handle_receive(const received_datagram* datagrams, std::size_t count)
+{
+	// stamps of the probes answered in this batch may still wait in the error queue
+	if(send_stamps_)
+		send_stamps_->read();
+	
+	for(std::size_t i = 0; i < count; ++i)
+		handle_reply(datagrams[i].data, datagrams[i].length, datagrams[i].received_at);
+}
+
+void trace_engine::handle_send_stamp(const ipv4_header_view& sent, boost::asio::chrono::steady_clock::time_point sent_at)
+{
+	uint64_t key = probe_table::sent_key(sent);
+	if(key != 0)
+		probes_.restamp(key, sent_at);
+}
+
+void trace_engine::handle_reply(const uint8_t* data, std::size_t length, boost::asio::chrono::steady_clock::time_point now)
+{
+	ipv4_header_view received_ipv4_header_1(data, length);
+	if(!received_ipv4_header_1.valid() || received_ipv4_header_1.protocol() != ipv4_header::protocol::icmp) 
+		return;
+	
+	icmp_header_view received_icmp_header_1(received_ipv4_header_1.payload(), received_ipv4_header_1.payload_length());
+	if(!received_icmp_header_1.valid())
+		return;
+	
+	if(received_icmp_header_1.type() == icmp_header::icmp_type::time_exceeded || received_icmp_header_1.type() == icmp_header::icmp_type::destination_unreachable) 
+	{
+		ipv4_header_view received_ipv4_header_2(received_icmp_header_1.payload(), received_icmp_header_1.payload_length());
+		if(!received_ipv4_header_2.valid())
+			return;
+		
+		if(type_ == udp && received_ipv4_header_2.protocol() == ipv4_header::protocol::udp)
+		{
+			udp_header_view received_udp_header(received_ipv4_header_2.payload(), received_ipv4_header_2.payload_length());
+			if(received_udp_header.valid())
+				record_hop(received_udp_header.source_port(), probe_table::udp_key(received_udp_header.source_port(), received_udp_header.destination_port(), received_ipv4_header_2.identification()), received_ipv4_header_1, received_icmp_header_1, now);
+		}
+		else if(type_ == icmp && received_ipv4_header_2.protocol() == ipv4_header::protocol::icmp)
+		{
+			icmp_header_view received_icmp_header_2(received_ipv4_header_2.payload(), received_ipv4_header_2.payload_length());
+			if(received_icmp_header_2.valid())
+				record_hop(received_icmp_header_2.identifier(), probe_table::icmp_key(received_icmp_header_2.identifier(), received_icmp_header_2.sequence_number()), received_ipv4_header_1, received_icmp_header_1, now);
+		}
+	}
+	else if(type_ == icmp && received_icmp_header_1.type() == icmp_header::icmp_type::echo_reply)
+	{
+		record_hop(received_icmp_header_1.identifier(), probe_table::icmp_key(received_icmp_header_1.identifier(), received_icmp_header_1.sequence_number()), received_ipv4_header_1, received_icmp_header_1, now);
+	}
+}
+
+void trace_engine::record_hop(uint16_t identifier, uint64_t key, const ipv4_header_view& reply, const icmp_header_view& icmp, boost::asio::chrono::steady_clock::time_point now)
+{
+	uint16_t slot = static_cast<uint16_t>(identifier - identifier_base_);
+	if(slot >= slots_.size() || !slots_[slot])
+		return;
+	
+	probe_table::entry probe;
+	if(!probes_.take(key, probe) || probe.session != slots_[slot]->serial())
+		return;
+	
+	trace_session& session = *slots_[slot];
+	if(!session.record_hop(probe.ttl, reply.source_address(), now - probe.sent_at, icmp.type(), icmp.code(), reply.time_to_live()))
+		return;
+	
+	if(session.incremental())
+	{
+		ttls_.clear();
+		session.incremental()->answer(probe.ttl, reply.source_address().to_uint(), now, ttls_);
+		continue_incremental(slot);
+		return;
+	}
+	
+	if(stops_)
+	{
+		advance(slot, probe.ttl, reply.source_address(), icmp.type() == icmp_header::destination_unreachable);
+		return;
+	}
+	
+	if(session.destination_ttl() == 0)
+		return;
+	
+	if(session.complete())
+	{
+		finish(slot);
+		return;
+	}
+	
+	// the destination answered, give the missing hops as long again as its round trip
+	boost::asio::chrono::steady_clock::time_point grace = now + session.destination_rtt();
+	if(grace < session.deadline())
+	{
+		timers_.cancel(session.deadline_timer());
+		schedule_deadline(slot, grace);
+	}
+}
+
+void trace_engine::advance(uint16_t slot, uint8_t ttl, const boost::asio::ip::address_v4& address, bool unreachable)
+{
+	trace_session& session = *slots_[slot];
+	boost::asio::chrono::steady_clock::time_point now = boost::asio::chrono::steady_clock::now();
+	
+	// every interface goes into the stop set, whichever direction found it
+	bool known_interface = stops_->add_interface(address);
+	bool known_path = stops_->add_path(address, session.destination());
+	
+	if(ttl == session.forward_ttl())
+	{
+		// beyond a hop seen on the way to the same prefix the path is known already
+		session.gap(0);
+		if(address == session.destination() || unreachable || ttl >= session.max_ttl())
+			session.forward(0, now);
+		else if(known_path)
+		{
+			session.cut();
+			session.forward(0, now);
+		}
+		else
+		{
+			session.forward(static_cast<uint8_t>(ttl + 1), now);
+			send_probes(session, static_cast<uint8_t>(ttl + 1), static_cast<uint8_t>(ttl + 1));
+		}
+	}
+	else if(ttl == session.backward_ttl())
+	{
+		// in front of a known interface the path is shared with an earlier trace
+		if(known_interface || ttl == 1)
+			session.backward(0, now);
+		else
+		{
+			session.backward(static_cast<uint8_t>(ttl - 1), now);
+			send_probes(session, static_cast<uint8_t>(ttl - 1), static_cast<uint8_t>(ttl - 1));
+		}
+	}
+	else
+		// a late answer to a probe that was given up on
+		return;
+	
+	if(session.forward_ttl() == 0 && session.backward_ttl() == 0)
+		finish(slot);
+	else
+		schedule_probe_timeout(slot);
+}
+
+void trace_engine::handle_probe_timeout(uint16_t slot)
+{
+	trace_session& session = *slots_[slot];
+	boost::asio::chrono::steady_clock::time_point now = boost::asio::chrono::steady_clock::now();
+	boost::asio::chrono::milliseconds timeout(deadline_);
+	
+	if(session.forward_ttl() != 0 && now - session.forward_sent() >= timeout)
+	{
+		// silent routers are stepped over, a run of them ends the path
+		session.gap(static_cast<uint8_t>(session.gap() + 1));
+		if(session.gap() >= gap_limit || session.forward_ttl() >= session.max_ttl())
+			session.forward(0, now);
+		else
+		{
+			uint8_t ttl = static_cast<uint8_t>(session.forward_ttl() + 1);
+			session.forward(ttl, now);
+			send_probes(session, ttl, ttl);
+		}
+	}
+	
+	if(session.backward_ttl() != 0 && now - session.backward_sent() >= timeout)
+	{
+		if(session.backward_ttl() == 1)
+			session.backward(0, now);
+		else
+		{
+			uint8_t ttl = static_cast<uint8_t>(session.backward_ttl() - 1);
+			session.backward(ttl, now);
+			send_probes(session, ttl, ttl);
+		}
+	}
+	
+	if(session.forward_ttl() == 0 && session.backward_ttl() == 0)
+		finish(slot);
+	else
+		schedule_probe_timeout(slot);
+}
+
+void trace_engine::schedule_probe_timeout(uint16_t slot)
+{
+	// one timer per session, due when the older of the probes in flight times out
+	trace_session& session = *slots_[slot];
+	timers_.cancel(session.deadline_timer());
+	boost::asio::chrono::steady_clock::time_point sent = session.forward_ttl() != 0 ? session.forward_sent() : session.backward_sent();
+	if(session.backward_ttl() != 0 && session.backward_sent() < sent)
+		sent = session.backward_sent();
+	schedule_deadline(slot, sent + boost::asio::chrono::milliseconds(deadline_));
+}
+
+void trace_engine::continue_incremental(uint16_t slot)
+{
+	trace_session& session = *slots_[slot];
+	for(std::size_t i = 0; i < ttls_.size(); ++i)
+		send_probes(session, ttls_[i], ttls_[i]);
+	
+	// without a probe in flight no answer or timeout would move the trace on
+	boost::asio::chrono::steady_clock::time_point oldest = session.incremental()->oldest();
+	if(session.incremental()->done() || oldest == boost::asio::chrono::steady_clock::time_point::max())
+	{
+		finish(slot);
+		return;
+	}
+	// one timer per session, due when the oldest probe in flight times out
+	timers_.cancel(session.deadline_timer());
+	schedule_deadline(slot, oldest + boost::asio::chrono::milliseconds(deadline_));
+}
+
+void trace_engine::merge_incremental(trace_session& session)
+{
+	const incremental_trace& trace = *session.incremental();
+	for(std::size_t i = 0; i < trace.changes().size(); ++i)
+	{
+		const incremental_trace::change& change = trace.changes()[i];
+		std::ostringstream before, after;
+		for(std::size_t hop = 0; hop < change.before.size(); ++hop)
+			before << (hop == 0 ? "" : " ") << (change.before[hop] == 0 ? "*" : boost::asio::ip::address_v4(change.before[hop]).to_string());
+		for(std::size_t hop = 0; hop < change.after.size(); ++hop)
+			after << (hop == 0 ? "" : " ") << (change.after[hop] == 0 ? "*" : boost::asio::ip::address_v4(change.after[hop]).to_string());
+		log_info("route change to {} at ttl {}: [{}] -> [{}]", session.destination().to_string(), +change.ttl, before.str(), after.str());
+	}
+	
+	for(std::size_t ttl = 1; ttl <= trace.path().size(); ++ttl)
+	{
+		if(trace.path()[ttl - 1] != 0 && !trace.observed(static_cast<uint8_t>(ttl)))
+			session.cached_hop(static_cast<uint16_t>(ttl), boost::asio::ip::address_v4(trace.path()[ttl - 1]));
+	}
+}
+
+void trace_engine::schedule_deadline(uint16_t slot, boost::asio::chrono::steady_clock::time_point expiry)
+{
+	// the cookie names slot and session, a timer of an earlier session in the slot is ignored when it fires
+	trace_session& session = *slots_[slot];
+	session.deadline(expiry, timers_.schedule(expiry, (static_cast<uint64_t>(slot) << 32) | session.serial()));
+	
+	if(!ticking_)
+	{
+		ticking_ = true;
+		tick_timer_.expires_at(timers_.next_tick());
+		tick_timer_.async_wait(boost::bind(&trace_engine::handle_tick, this, boost::placeholders::_1));
+	}
+}
+
+void trace_engine::handle_tick(const boost::system::error_code& error)
+{
+	if(error)
+	{
+		ticking_ = false;
+		return;
+	}
+	
+	timers_.advance(boost::asio::chrono::steady_clock::now(), boost::bind(&trace_engine::handle_deadline, this, boost::placeholders::_1));
+	
+	// the tick stops while no session waits for its deadline, so the io_context can run out of work
+	ticking_ = timers_.size() > 0;
+	if(ticking_)
+	{
+		tick_timer_.expires_at(timers_.next_tick());
+		tick_timer_.async_wait(boost::bind(&trace_engine::handle_tick, this, boost::placeholders::_1));
+	}
+}
+
+void trace_engine::handle_deadline(uint64_t cookie)
+{
+	uint16_t slot = static_cast<uint16_t>(cookie >> 32);
+	uint32_t serial = static_cast<uint32_t>(cookie & 0xFFFFFFFF);
+	if(!slots_[slot] || slots_[slot]->serial() != serial)
+		return;
+	
+	if(slots_[slot]->incremental())
+	{
+		ttls_.clear();
+		boost::asio::chrono::steady_clock::time_point now = boost::asio::chrono::steady_clock::now();
+		slots_[slot]->incremental()->expire(now - boost::asio::chrono::milliseconds(deadline_), now, ttls_);
+		continue_incremental(slot);
+	}
+	else if(stops_)
+		handle_probe_timeout(slot);
+	else
+		finish(slot);
+}
+
+void trace_engine::finish(uint16_t slot)
+{
+	timers_.cancel(slots_[slot]->deadline_timer());
+	if(slots_[slot]->incremental())
+		merge_incremental(*slots_[slot]);
+	
+	if(results_ || topology_)
+	{
+		records_.clear();
+		slots_[slot]->records(records_, static_cast<uint8_t>((type_ == udp ? hop_flags::udp : 0) | (send_stamps_ ? hop_flags::kernel_time : 0)));
+		if(results_)
+			results_->append(records_);
+		if(topology_)
+			topology_->add_trace(records_, slots_[slot]->partial());
+	}
+	if(!results_)
+	{
+		std::ostringstream output;
+		slots_[slot]->print(output);
+		std::lock_guard<std::mutex> lock(output_mutex);
+		std::cout << output.str() << std::flush;
+	}
+	slots_[slot].reset();
+	free_slots_.push_back(slot);
+	start_sessions();
+}
@@ -0,0 +1,121 @@
+#include <trace_session.h>
+
+#include <ratio>
+
+trace_session::trace_session(const boost::asio::ip::address_v4& destination, uint16_t identifier, uint32_t serial, uint8_t max_ttl) :
+	destination_(destination),
+	identifier_(identifier),
+	serial_(serial),
+	max_ttl_(max_ttl),
+	destination_ttl_(0),
+	deadline_timer_(timing_wheel::invalid_timer),
+	hop_rtt_(max_ttl + 1),
+	hop_address_(max_ttl + 1),
+	hop_answered_(max_ttl + 1, false),
+	hop_cached_(max_ttl + 1, false),
+	hop_icmp_type_(max_ttl + 1),
+	hop_icmp_code_(max_ttl + 1),
+	hop_reply_ttl_(max_ttl + 1),
+	forward_ttl_(0),
+	backward_ttl_(0),
+	gap_(0),
+	lowest_ttl_(0),
+	highest_ttl_(0),
+	cut_(false)
+{
+}
+
+bool trace_session::record_hop(uint16_t ttl, const boost::asio::ip::address_v4& address, boost::asio::chrono::steady_clock::duration rtt, uint8_t icmp_type, uint8_t icmp_code, uint8_t reply_ttl)
+{
+	if(ttl == 0 || ttl > max_ttl_ || hop_answered_[ttl])
+		return false;
+	
+	hop_answered_[ttl] = true;
+	hop_address_[ttl] = address;
+	hop_rtt_[ttl] = rtt;
+	hop_icmp_type_[ttl] = icmp_type;
+	hop_icmp_code_[ttl] = icmp_code;
+	hop_reply_ttl_[ttl] = reply_ttl;
+	
+	if(address == destination_ && (destination_ttl_ == 0 || ttl < destination_ttl_))
+		destination_ttl_ = ttl;
+	return true;
+}
+
+bool trace_session::cached_hop(uint16_t ttl, const boost::asio::ip::address_v4& address)
+{
+	if(ttl == 0 || ttl > max_ttl_ || hop_answered_[ttl])
+		return false;
+	
+	hop_answered_[ttl] = true;
+	hop_cached_[ttl] = true;
+	hop_address_[ttl] = address;
+	hop_rtt_[ttl] = boost::asio::chrono::steady_clock::duration::zero();
+	hop_icmp_type_[ttl] = 0;
+	hop_icmp_code_[ttl] = 0;
+	hop_reply_ttl_[ttl] = 0;
+	
+	if(address == destination_ && (destination_ttl_ == 0 || ttl < destination_ttl_))
+		destination_ttl_ = ttl;
+	return true;
+}
+
+bool trace_session::complete() const
+{
+	if(destination_ttl_ == 0)
+		return false;
+	for(uint16_t ttl = 1; ttl < destination_ttl_; ++ttl)
+	{
+		if(!hop_answered_[ttl])
+			return false;
+	}
+	return true;
+}
+
+void trace_session::print(std::ostream& os) const
+{
+	os << "trace to " << destination_.to_string() << std::endl;
+	uint8_t first_ttl = lowest_ttl_ == 0 ? 1 : lowest_ttl_;
+	uint8_t last_ttl = destination_ttl_ != 0 ? destination_ttl_ : highest_ttl_ != 0 ? highest_ttl_ : max_ttl_;
+	for(uint16_t ttl = first_ttl; ttl <= last_ttl; ++ttl)
+	{
+		// an incremental trace leaves TTLs out that it neither probed nor took from the cached path
+		if(incremental_ && !hop_cached_[ttl] && !hop_answered_[ttl] && !incremental_->probed(static_cast<uint8_t>(ttl)))
+			continue;
+		if(hop_cached_[ttl])
+			os << +ttl << ": " << hop_address_[ttl].to_string() << ", cached" << std::endl;
+		else if(hop_answered_[ttl])
+			os << +ttl << ": " 
+				<< hop_address_[ttl].to_string()
+				<< ", time = "
+				// fractions of a millisecond matter once the stamps come from the kernel
+				<< boost::asio::chrono::duration<double, std::milli>(hop_rtt_[ttl]).count()
+				<< std::endl;
+		else
+			os << +ttl << ": *" << std::endl;
+	}
+}
+
+void trace_session::records(std::vector<hop_record>& records, uint8_t flags) const
+{
+	for(uint16_t ttl = 1; ttl <= max_ttl_; ++ttl)
+	{
+		if(!hop_answered_[ttl])
+			continue;
+		
+		hop_record record;
+		record.target = destination_.to_uint();
+		record.responder = hop_address_[ttl].to_uint();
+		record.rtt_ns = static_cast<uint64_t>(boost::asio::chrono::duration_cast<boost::asio::chrono::nanoseconds>(hop_rtt_[ttl]).count());
+		record.ttl = static_cast<uint8_t>(ttl);
+		record.icmp_type = hop_icmp_type_[ttl];
+		record.icmp_code = hop_icmp_code_[ttl];
+		record.reply_ttl = hop_reply_ttl_[ttl];
+		record.flags = flags;
+		if(hop_address_[ttl] == destination_)
+			record.flags |= hop_flags::destination;
+		if(hop_cached_[ttl])
+			record.flags |= hop_flags::cached;
+		records.push_back(record);
+	}
+}
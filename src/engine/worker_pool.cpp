@@ -0,0 +1,88 @@
+#include <worker_pool.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <pthread.h>
+#include <sched.h>
+
+worker_pool::worker_pool(std::size_t threads, const std::vector<int>& cpus) :
+	cpus_(cpus),
+	errors_(std::max<std::size_t>(1, threads))
+{
+	for(std::size_t worker = 0; worker < std::max<std::size_t>(1, threads); ++worker)
+		// a hint of one lets asio drop the locking inside the io_context
+		io_contexts_.push_back(std::unique_ptr<boost::asio::io_context>(new boost::asio::io_context(1)));
+}
+
+void worker_pool::run()
+{
+	std::vector<std::thread> threads;
+	for(std::size_t worker = 1; worker < io_contexts_.size(); ++worker)
+		threads.push_back(std::thread(&worker_pool::run_worker, this, worker));
+	
+	// the calling thread is the first worker
+	run_worker(0);
+	
+	for(std::size_t i = 0; i < threads.size(); ++i)
+		threads[i].join();
+	
+	for(std::size_t worker = 0; worker < errors_.size(); ++worker)
+	{
+		if(errors_[worker])
+			std::rethrow_exception(errors_[worker]);
+	}
+}
+
+void worker_pool::run_worker(std::size_t worker)
+{
+	if(!cpus_.empty())
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpus_[worker % cpus_.size()], &set);
+		int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if(error != 0)
+			std::cerr << "Cannot pin worker " << worker << " to cpu " << cpus_[worker % cpus_.size()] << std::endl;
+	}
+	
+	// an exception must not end the process from a thread, nor leave the other threads unjoined, run() throws it again
+	try
+	{
+		io_contexts_[worker]->run();
+	}
+	catch(...)
+	{
+		errors_[worker] = std::current_exception();
+	}
+}
+
+std::vector<int> worker_pool::parse_cpu_list(const std::string& list)
+{
+	std::vector<int> cpus;
+	std::istringstream stream(list);
+	std::string range;
+	while(std::getline(stream, range, ','))
+	{
+		if(range.empty())
+			continue;
+		std::string::size_type dash = range.find('-');
+		int first = std::atoi(range.substr(0, dash).c_str());
+		int last = dash == std::string::npos ? first : std::atoi(range.substr(dash + 1).c_str());
+		for(int cpu = first; cpu <= last; ++cpu)
+			cpus.push_back(cpu);
+	}
+	return cpus;
+}
+
+std::vector<int> worker_pool::interface_cpus(const std::string& interface)
+{
+	std::ifstream file(("/sys/class/net/" + interface + "/device/local_cpulist").c_str());
+	std::string list;
+	if(!file || !std::getline(file, list))
+		return std::vector<int>();
+	return parse_cpu_list(list);
+}
@@ -1 +1,186 @@
+#include <logger.h>
 
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+
+namespace
+{
+	const char* const level_names[] = { "error", "warning", "info", "debug", "trace" };
+}
+
+log_ring::log_ring(std::size_t capacity) :
+	head_(0),
+	tail_cache_(0),
+	tail_(0)
+{
+	std::size_t size = 1;
+	while(size < capacity)
+		size <<= 1;
+	records_.resize(size);
+	mask_ = size - 1;
+}
+
+logger::logger() :
+	threshold_(info),
+	running_(false),
+	dropped_(0)
+{
+}
+
+logger::~logger()
+{
+	stop();
+}
+
+logger& logger::instance()
+{
+	static logger instance;
+	return instance;
+}
+
+void logger::start(level threshold)
+{
+	threshold_.store(threshold, std::memory_order_relaxed);
+	if(running_.exchange(true))
+		return;
+	writer_ = std::thread(&logger::run, this);
+}
+
+void logger::stop()
+{
+	if(!running_.exchange(false))
+		return;
+	writer_.join();
+
+	uint64_t dropped = dropped_.exchange(0);
+	if(dropped > 0)
+		std::fprintf(stderr, "logger dropped %llu records\n", static_cast<unsigned long long>(dropped));
+}
+
+int64_t logger::now()
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+log_ring& logger::thread_ring()
+{
+	// the ring of a thread lives as long as the logger, threads come and go rarely
+	static thread_local log_ring* ring = 0;
+	if(ring == 0)
+		ring = &add_ring();
+	return *ring;
+}
+
+log_ring& logger::add_ring()
+{
+	std::lock_guard<std::mutex> lock(rings_mutex_);
+	rings_.push_back(std::unique_ptr<log_ring>(new log_ring(4096)));
+	return *rings_.back();
+}
+
+void logger::run()
+{
+	std::string output;
+	std::string errors;
+	for(;;)
+	{
+		bool stopping = !running_.load(std::memory_order_acquire);
+		if(!drain(output, errors))
+		{
+			// nothing was waiting, the rings are drained one last time before the thread ends
+			if(stopping)
+				break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+}
+
+bool logger::drain(std::string& output, std::string& errors)
+{
+	output.clear();
+	errors.clear();
+
+	std::vector<log_ring*> rings;
+	{
+		std::lock_guard<std::mutex> lock(rings_mutex_);
+		for(std::size_t i = 0; i < rings_.size(); ++i)
+			rings.push_back(rings_[i].get());
+	}
+
+	bool found = false;
+	for(std::size_t i = 0; i < rings.size(); ++i)
+	{
+		while(const log_record* record = rings[i]->front())
+		{
+			format(*record, record->level <= warning ? errors : output);
+			rings[i]->release();
+			found = true;
+		}
+	}
+
+	// one write per batch instead of one flush per line
+	if(!output.empty())
+	{
+		std::fwrite(output.data(), 1, output.size(), stdout);
+		std::fflush(stdout);
+	}
+	if(!errors.empty())
+	{
+		std::fwrite(errors.data(), 1, errors.size(), stderr);
+		std::fflush(stderr);
+	}
+	return found;
+}
+
+void logger::format(const log_record& record, std::string& output)
+{
+	char buffer[64];
+	if(record.level != info)
+	{
+		std::time_t seconds = static_cast<std::time_t>(record.time / 1000000);
+		std::tm local;
+		localtime_r(&seconds, &local);
+		std::size_t length = std::strftime(buffer, sizeof(buffer), "%H:%M:%S", &local);
+		std::snprintf(buffer + length, sizeof(buffer) - length, ".%06lld %s: ", static_cast<long long>(record.time % 1000000), level_names[record.level]);
+		output += buffer;
+	}
+
+	std::size_t argument = 0;
+	for(const char* cursor = record.format; *cursor != 0; ++cursor)
+	{
+		if(cursor[0] != '{' || cursor[1] != '}' || argument >= record.count)
+		{
+			output += *cursor;
+			continue;
+		}
+
+		const log_record::argument& value = record.arguments[argument];
+		switch(record.types[argument])
+		{
+			case log_record::signed_integer:
+				std::snprintf(buffer, sizeof(buffer), "%lld", static_cast<long long>(value.signed_value));
+				output += buffer;
+				break;
+			case log_record::unsigned_integer:
+				std::snprintf(buffer, sizeof(buffer), "%llu", static_cast<unsigned long long>(value.unsigned_value));
+				output += buffer;
+				break;
+			case log_record::floating_point:
+				std::snprintf(buffer, sizeof(buffer), "%g", value.floating_value);
+				output += buffer;
+				break;
+			case log_record::address:
+				std::snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u", value.address_value >> 24, (value.address_value >> 16) & 0xFF, (value.address_value >> 8) & 0xFF, value.address_value & 0xFF);
+				output += buffer;
+				break;
+			case log_record::text:
+				output.append(record.texts + value.text_value.offset, value.text_value.length);
+				break;
+		}
+		++argument;
+		++cursor;
+	}
+	output += '\n';
+}
@@ -5,75 +5,92 @@
 #include <ostream>
 #include <icmp_header.hpp>
 #include <ipv4_header.hpp>
+#include <logger.h>
+#include <packet_template.hpp>
 #include <udp_header.hpp>
 #include <boost/bind/bind.hpp>
 
 
-udp_probe::udp_probe(boost::asio::io_context& io_context, const char* destination) : 
-	raw_socket_(io_context, raw::endpoint(raw::v4(), 12345)),
-	receive_socket_(io_context, boost::asio::ip::icmp::v4()), 
-	receive_timeout_(io_context)
+udp_probe::udp_probe(boost::asio::io_context& io_context, transport* network, const boost::asio::ip::address_v4& source, const char* destination, uint8_t max_ttl, uint32_t deadline, bool parallel, timestamping::mode stamps) : 
+	transport_(network),
+	receive_timeout_(io_context),
+	probes_(256)
 {	
 	remote_end_point_ = std::string(destination);
 	remote_end_point_port_ = 33434;
 	ttl_ = 0;
 	retries_ = 0;
+	max_ttl_ = max_ttl == 0 ? 30 : max_ttl;
+	deadline_ = deadline;
+	parallel_ = parallel;
+	done_ = false;
+	destination_ttl_ = 0;
+	hop_answered_.fill(false);
+	
+	remote_address_ = boost::asio::ip::address::from_string(remote_end_point_).to_v4();
+	send_stamps_.reset(send_stamps::open(transport_->socket(), stamps, source));
+	packet_.udp(source, remote_address_, 12345, remote_end_point_port_, udp_payload_, sizeof(udp_payload_));
 }
 
 void udp_probe::start() 
 {
-	start_receive();
-	send_packet();
+	transport_->filter(icmp_filter(icmp_filter::udp, 12345, 12345));
+	transport_->start(boost::bind(&udp_probe::handle_receive, this, boost::placeholders::_1, boost::placeholders::_2));
+	if(send_stamps_)
+		send_stamps_->start(boost::bind(&udp_probe::handle_send_stamp, this, boost::placeholders::_1, boost::placeholders::_2));
+	if(parallel_)
+		send_burst();
+	else
+		send_packet();
 }
 
 void udp_probe::send_packet()
 {
-	udp_header udp;
-	udp.source_port(12345);
-	udp.destination_port(++remote_end_point_port_);
-	udp.length(udp.size() + sizeof(udp_payload_));
-	udp.checksum(0);
-	
-	ipv4_header ip;
-	ip.version(4);
-	ip.header_length(ip.size() / 4);
-	ip.type_of_service(0);
-	ip.total_length(ip.size() + udp.length());
-	ip.identification(0);
-	ip.dont_fragment(false);
-	ip.more_fragments(false);
-	ip.fragment_offset(0);
-	ip.time_to_live(++ttl_);
-	// change to get available IPv4 Endpoint !!!
-	ip.source_address(boost::asio::ip::address::from_string("192.168.178.35").to_v4());
-	ip.destination_address(boost::asio::ip::address::from_string(remote_end_point_).to_v4());
-	ip.protocol(IPPROTO_UDP);	
-	ip.calculate_checksum();
-
-	boost::array<boost::asio::const_buffer, 3> buffers = {{
-		boost::asio::buffer(ip.data()),
-		boost::asio::buffer(udp.data()),
-		boost::asio::buffer(udp_payload_, sizeof(udp_payload_))
-	}};
+	packet_.destination_port(++remote_end_point_port_);
+	packet_.time_to_live(++ttl_);
+	// a zero identification would be replaced by the kernel, replies are matched on it
+	packet_.identification(ttl_);
 	
-	raw_socket_.async_send_to(buffers, 
-		raw::endpoint(boost::asio::ip::address::from_string(remote_end_point_), remote_end_point_port_),
-		boost::bind(&udp_probe::handle_send, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
-			
+	uint64_t key = probe_table::udp_key(12345, remote_end_point_port_, ttl_);
 	timestamp_ = boost::asio::steady_timer::clock_type::now();
+	probes_.expire(timestamp_ - boost::asio::chrono::seconds(5));
+	probes_.insert(key, timestamp_, ttl_, 0);
+	transport_->send(packet_.data(), packet_.size());
 
 	receive_timeout_.expires_at(timestamp_ + boost::asio::chrono::seconds(5));
 	receive_timeout_.async_wait(boost::bind(&udp_probe::handle_timeout, this, boost::placeholders::_1));	
 }
 		
-void udp_probe::start_receive()
+void udp_probe::send_burst()
 {
-	receive_buffer_.consume(receive_buffer_.size());
-	receive_socket_.async_receive(receive_buffer_.prepare(65536), boost::bind(&udp_probe::handle_receive, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+	for(uint16_t ttl = 1; ttl <= max_ttl_; ++ttl)
+	{
+		// the destination port carries the TTL, ICMP errors quote it back
+		uint16_t port = static_cast<uint16_t>(remote_end_point_port_ + ttl);
+		packet_.destination_port(port);
+		packet_.time_to_live(static_cast<uint8_t>(ttl));
+		// a zero identification would be replaced by the kernel, replies are matched on it
+		packet_.identification(ttl);
+		
+		probes_.insert(probe_table::udp_key(12345, port, ttl), boost::asio::steady_timer::clock_type::now(), static_cast<uint8_t>(ttl), 0);
+		transport_->send(packet_.data(), packet_.size());
+	}
+	
+	receive_timeout_.expires_after(boost::asio::chrono::milliseconds(deadline_));
+	receive_timeout_.async_wait(boost::bind(&udp_probe::handle_deadline, this, boost::placeholders::_1));
 }
 
-void udp_probe::handle_send(const boost::system::error_code& error, std::size_t bytes_transferred) 
+void udp_probe::handle_receive(const received_datagram* datagrams, std::size_t count)
 {
+	if(send_stamps_)
+		send_stamps_->read();
+	for(std::size_t i = 0; i < count && !done_; ++i)
+	{
+		if(parallel_)
+			handle_burst_reply(datagrams[i].data, datagrams[i].length, datagrams[i].received_at);
+		else
+			handle_reply(datagrams[i].data, datagrams[i].length, datagrams[i].received_at);
+	}
 }
 
 void udp_probe::handle_timeout(const boost::system::error_code& error) 
@@ -81,7 +98,7 @@ void udp_probe::handle_timeout(const boost::system::error_code& error)
 	if(!error) {
 		retries_++;
 		// this need to be handled somehow ...
-		std::cout << "Request timed out" << std::endl;
+		log_info("request timed out");
 		if(retries_ < 3)
 		{
 			--ttl_;
@@ -90,59 +107,141 @@ void udp_probe::handle_timeout(const boost::system::error_code& error)
 	}
 }
 		
-void udp_probe::handle_receive(const boost::system::error_code& error, std::size_t length) 
+void udp_probe::handle_reply(const uint8_t* data, std::size_t length, boost::asio::chrono::steady_clock::time_point now) 
 {
-	std::cout << "packet received " << std::endl;
-	ipv4_header received_ipv4_header_1, received_ipv4_header_2;
-	icmp_header received_icmp_header;
-	udp_header received_udp_header;
-	
-	receive_buffer_.commit(length);
+	log_trace("packet received, {} bytes", length);
 
-	// debug(receive_buffer_, length);
+	// debug(data, length);
 
-	std::istream is(&receive_buffer_);
-	is >> received_ipv4_header_1;
-	if(received_ipv4_header_1.protocol() == ipv4_header::protocol::icmp) 
+	ipv4_header_view received_ipv4_header_1(data, length);
+	ipv4_header_view received_ipv4_header_2;
+	icmp_header_view received_icmp_header;
+	udp_header_view received_udp_header;
+	
+	if(received_ipv4_header_1.valid() && received_ipv4_header_1.protocol() == ipv4_header::protocol::icmp) 
 	{
-		is >> received_icmp_header >> received_ipv4_header_2;
-		if(received_ipv4_header_2.protocol() == ipv4_header::protocol::udp)
-			is >> received_udp_header;
+		received_icmp_header = icmp_header_view(received_ipv4_header_1.payload(), received_ipv4_header_1.payload_length());
+		if(received_icmp_header.valid())
+			received_ipv4_header_2 = ipv4_header_view(received_icmp_header.payload(), received_icmp_header.payload_length());
+		if(received_ipv4_header_2.valid() && received_ipv4_header_2.protocol() == ipv4_header::protocol::udp)
+			received_udp_header = udp_header_view(received_ipv4_header_2.payload(), received_ipv4_header_2.payload_length());
 	}
-	/*
-	int qq;
-	std::cin >> qq;
-	*/
 			
-	if (is && (received_icmp_header.type() == icmp_header::time_exceeded || received_icmp_header.type() == icmp_header::destination_unreachable) && (received_udp_header.source_port() == 12345)) // && received_udp_header.destination_port() == remote_end_point_port_)) 
+	// replies to earlier probes for this TTL are still in the table and count as well
+	probe_table::entry probe;
+	if (received_udp_header.valid() && (received_icmp_header.type() == icmp_header::time_exceeded || received_icmp_header.type() == icmp_header::destination_unreachable) && probes_.take(probe_table::udp_key(received_udp_header.source_port(), received_udp_header.destination_port(), received_ipv4_header_2.identification()), probe) && probe.ttl == ttl_)
 	{
-		boost::asio::chrono::steady_clock::time_point now = boost::asio::chrono::steady_clock::now();
-		boost::asio::chrono::steady_clock::duration elapsed = now - timestamp_;
-		std::cout << +ttl_ << ": " 
-			<< received_ipv4_header_1.source_address().to_string()
-			<< ", time = "
-			<< boost::asio::chrono::duration_cast<boost::asio::chrono::milliseconds>(elapsed).count()
-			<< std::endl;
+		boost::asio::chrono::steady_clock::duration elapsed = now - probe.sent_at;
+		log_info("{}: {}, time = {}", ttl_, received_ipv4_header_1.source_address(), boost::asio::chrono::duration_cast<boost::asio::chrono::milliseconds>(elapsed).count());
 	
 		receive_timeout_.cancel();
 	}
 	
 	retries_ = 0;
 	
-	if(received_ipv4_header_1.source_address().to_string() != remote_end_point_)
-	{
-		start_receive();
+	if(!received_ipv4_header_1.valid() || received_ipv4_header_1.source_address() != remote_address_)
 		send_packet();
+	else
+	{
+		// the destination answered, nothing is left to receive
+		done_ = true;
+		transport_->stop();
+		if(send_stamps_)
+			send_stamps_->stop();
 	}
 }
 		
+void udp_probe::handle_send_stamp(const ipv4_header_view& sent, boost::asio::chrono::steady_clock::time_point sent_at)
+{
+	uint64_t key = probe_table::sent_key(sent);
+	if(key)
+		probes_.restamp(key, sent_at);
+}
+
+void udp_probe::handle_deadline(const boost::system::error_code& error)
+{
+	if(!error)
+		finish();
+}
+
+void udp_probe::handle_burst_reply(const uint8_t* data, std::size_t length, boost::asio::chrono::steady_clock::time_point now)
+{
+	ipv4_header_view received_ipv4_header_1(data, length);
+	if(received_ipv4_header_1.valid() && received_ipv4_header_1.protocol() == ipv4_header::protocol::icmp) 
+	{
+		icmp_header_view received_icmp_header(received_ipv4_header_1.payload(), received_ipv4_header_1.payload_length());
+		if(received_icmp_header.valid() && (received_icmp_header.type() == icmp_header::time_exceeded || received_icmp_header.type() == icmp_header::destination_unreachable))
+		{
+			ipv4_header_view received_ipv4_header_2(received_icmp_header.payload(), received_icmp_header.payload_length());
+			if(received_ipv4_header_2.valid() && received_ipv4_header_2.protocol() == ipv4_header::protocol::udp)
+			{
+				udp_header_view received_udp_header(received_ipv4_header_2.payload(), received_ipv4_header_2.payload_length());
+				probe_table::entry probe;
+				if(received_udp_header.valid() && probes_.take(probe_table::udp_key(received_udp_header.source_port(), received_udp_header.destination_port(), received_ipv4_header_2.identification()), probe))
+					record_hop(probe.ttl, received_ipv4_header_1.source_address(), now - probe.sent_at);
+			}
+		}
+	}
+}
+
+void udp_probe::record_hop(uint16_t ttl, const boost::asio::ip::address_v4& address, boost::asio::chrono::steady_clock::duration rtt)
+{
+	if(ttl == 0 || ttl > max_ttl_ || hop_answered_[ttl])
+		return;
+	
+	hop_answered_[ttl] = true;
+	hop_address_[ttl] = address;
+	hop_rtt_[ttl] = rtt;
+	
+	if(address == remote_address_ && (destination_ttl_ == 0 || ttl < destination_ttl_))
+		destination_ttl_ = ttl;
+	
+	if(destination_ttl_ == 0)
+		return;
+	
+	for(uint16_t hop = 1; hop < destination_ttl_; ++hop)
+	{
+		if(!hop_answered_[hop])
+		{
+			// the destination answered, give the missing hops as long again as its round trip
+			boost::asio::chrono::steady_clock::time_point grace = boost::asio::steady_timer::clock_type::now() + hop_rtt_[destination_ttl_];
+			if(grace < receive_timeout_.expiry())
+			{
+				receive_timeout_.expires_at(grace);
+				receive_timeout_.async_wait(boost::bind(&udp_probe::handle_deadline, this, boost::placeholders::_1));
+			}
+			return;
+		}
+	}
+	finish();
+}
+
+void udp_probe::finish()
+{
+	if(done_)
+		return;
+	done_ = true;
+	receive_timeout_.cancel();
+	transport_->stop();
+	if(send_stamps_)
+		send_stamps_->stop();
+	
+	uint8_t last_ttl = destination_ttl_ == 0 ? max_ttl_ : destination_ttl_;
+	for(uint16_t ttl = 1; ttl <= last_ttl; ++ttl)
+	{
+		if(hop_answered_[ttl])
+			log_info("{}: {}, time = {}", ttl, hop_address_[ttl], boost::asio::chrono::duration_cast<boost::asio::chrono::milliseconds>(hop_rtt_[ttl]).count());
+		else
+			log_info("{}: *", ttl);
+	}
+}
 
-void udp_probe::debug(const boost::asio::streambuf& buffer, std::size_t length)
+void udp_probe::debug(const uint8_t* data, std::size_t length)
 {
 	std::cout << "========================================================================================" << std::endl;
 	std::cout << "Packet received ..." << std::endl;
 	boost::asio::streambuf copy;
-	buffer_copy(copy.prepare(length), buffer.data());
+	buffer_copy(copy.prepare(length), boost::asio::buffer(data, length));
 	copy.commit(length);
 	std::istream is(&copy);
 	/*
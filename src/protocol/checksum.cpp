@@ -0,0 +1,156 @@
+#include <checksum.hpp>
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHECKSUM_X86
+#endif
+
+namespace
+{
+	typedef uint64_t (*kernel_type)(const uint8_t* data, std::size_t length);
+
+	// the sums below are of 32-bit words in memory order, the carries land in the upper half of the 64-bit sum
+	uint64_t add_scalar(const uint8_t* data, std::size_t length)
+	{
+		uint64_t sum = 0;
+		while(length >= 4)
+		{
+			uint32_t word;
+			std::memcpy(&word, data, sizeof(word));
+			sum += word;
+			data += 4;
+			length -= 4;
+		}
+		if(length >= 2)
+		{
+			uint16_t word;
+			std::memcpy(&word, data, sizeof(word));
+			sum += word;
+			data += 2;
+			length -= 2;
+		}
+		if(length == 1)
+		{
+			// the odd byte is the first of a word whose second byte is zero
+			uint16_t word = 0;
+			std::memcpy(&word, data, 1);
+			sum += word;
+		}
+		return sum;
+	}
+
+#ifdef CHECKSUM_X86
+	__attribute__((target("sse2")))
+	uint64_t add_sse2(const uint8_t* data, std::size_t length)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		__m128i sum = _mm_setzero_si128();
+		while(length >= 16)
+		{
+			__m128i words = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+			// widen the 32-bit words to 64 bits, so no carry is lost
+			sum = _mm_add_epi64(sum, _mm_unpacklo_epi32(words, zero));
+			sum = _mm_add_epi64(sum, _mm_unpackhi_epi32(words, zero));
+			data += 16;
+			length -= 16;
+		}
+		uint64_t lanes[2];
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sum);
+		return lanes[0] + lanes[1] + add_scalar(data, length);
+	}
+
+	__attribute__((target("avx2")))
+	uint64_t add_avx2(const uint8_t* data, std::size_t length)
+	{
+		const __m256i zero = _mm256_setzero_si256();
+		__m256i sum = _mm256_setzero_si256();
+		while(length >= 32)
+		{
+			__m256i words = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data));
+			sum = _mm256_add_epi64(sum, _mm256_unpacklo_epi32(words, zero));
+			sum = _mm256_add_epi64(sum, _mm256_unpackhi_epi32(words, zero));
+			data += 32;
+			length -= 32;
+		}
+		uint64_t lanes[4];
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), sum);
+		return lanes[0] + lanes[1] + lanes[2] + lanes[3] + add_sse2(data, length);
+	}
+#endif
+
+	kernel_type kernel_of(checksum_kernel kernel)
+	{
+#ifdef CHECKSUM_X86
+		if(kernel == checksum_avx2)
+			return add_avx2;
+		if(kernel == checksum_sse2)
+			return add_sse2;
+#endif
+		return add_scalar;
+	}
+
+	kernel_type select_kernel()
+	{
+		if(checksum_supported(checksum_avx2))
+			return kernel_of(checksum_avx2);
+		if(checksum_supported(checksum_sse2))
+			return kernel_of(checksum_sse2);
+		return add_scalar;
+	}
+
+	bool little_endian()
+	{
+		const uint16_t probe = 1;
+		uint8_t first;
+		std::memcpy(&first, &probe, 1);
+		return first == 1;
+	}
+
+	uint32_t add_on(kernel_type kernel, const uint8_t* data, std::size_t length, uint32_t sum)
+	{
+		static const bool swap = little_endian();
+
+		uint64_t wide = kernel(data, length);
+		wide = (wide & 0xFFFFFFFF) + (wide >> 32);
+		wide = (wide & 0xFFFFFFFF) + (wide >> 32);
+		uint32_t folded = static_cast<uint32_t>((wide & 0xFFFF) + (wide >> 16));
+		folded = (folded & 0xFFFF) + (folded >> 16);
+		folded = (folded & 0xFFFF) + (folded >> 16);
+
+		// the words were added in memory order, on little endian cpus the sum is byte swapped
+		if(swap)
+			folded = ((folded & 0xFF) << 8) | (folded >> 8);
+
+		uint64_t result = static_cast<uint64_t>(sum) + folded;
+		result = (result & 0xFFFF) + (result >> 16);
+		result = (result & 0xFFFF) + (result >> 16);
+		return static_cast<uint32_t>(result);
+	}
+}
+
+bool checksum_supported(checksum_kernel kernel)
+{
+	if(kernel == checksum_scalar)
+		return true;
+#ifdef CHECKSUM_X86
+	__builtin_cpu_init();
+	if(kernel == checksum_avx2)
+		return __builtin_cpu_supports("avx2");
+	if(kernel == checksum_sse2)
+		return __builtin_cpu_supports("sse2");
+#endif
+	return false;
+}
+
+uint32_t checksum_add_on(checksum_kernel kernel, const uint8_t* data, std::size_t length, uint32_t sum)
+{
+	return add_on(kernel_of(kernel), data, length, sum);
+}
+
+uint32_t checksum_add(const uint8_t* data, std::size_t length, uint32_t sum)
+{
+	static const kernel_type kernel = select_kernel();
+	return add_on(kernel, data, length, sum);
+}
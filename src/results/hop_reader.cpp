@@ -0,0 +1,196 @@
+#include <hop_reader.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+hop_reader::hop_reader(const std::string& path) :
+	data_(0),
+	length_(0),
+	records_(0)
+{
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if(fd < 0)
+		throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+
+	struct stat status;
+	if(::fstat(fd, &status) != 0 || static_cast<std::size_t>(status.st_size) < sizeof(hop_file_header))
+	{
+		::close(fd);
+		throw std::runtime_error(path + " is no hop record file");
+	}
+	length_ = static_cast<std::size_t>(status.st_size);
+
+	void* data = ::mmap(0, length_, PROT_READ, MAP_SHARED, fd, 0);
+	// the mapping keeps the file open
+	::close(fd);
+	if(data == MAP_FAILED)
+		throw std::runtime_error("Cannot map " + path + ": " + std::strerror(errno));
+	data_ = static_cast<const uint8_t*>(data);
+	// converters go through the file front to back
+	::madvise(data, length_, MADV_SEQUENTIAL);
+
+	try
+	{
+		load_index(path);
+	}
+	catch(...)
+	{
+		::munmap(const_cast<uint8_t*>(data_), length_);
+		throw;
+	}
+}
+
+hop_reader::~hop_reader()
+{
+	::munmap(const_cast<uint8_t*>(data_), length_);
+}
+
+std::vector<std::size_t> hop_reader::blocks_for(const boost::asio::ip::address_v4& target) const
+{
+	uint32_t value = target.to_uint();
+	std::vector<std::size_t> blocks;
+	for(std::size_t i = 0; i < index_.size(); ++i)
+	{
+		if(index_[i].min_target <= value && value <= index_[i].max_target)
+			blocks.push_back(i);
+	}
+	return blocks;
+}
+
+void hop_reader::load_index(const std::string& path)
+{
+	const hop_file_header& header = *reinterpret_cast<const hop_file_header*>(data_);
+	if(std::memcmp(header.magic, hop_format::magic, sizeof(header.magic)) != 0)
+		throw std::runtime_error(path + " is no hop record file");
+	if(header.byte_order != hop_format::byte_order)
+		throw std::runtime_error(path + " was written on a host of other byte order");
+	if(header.version != hop_format::version)
+		throw std::runtime_error(path + " has unsupported version");
+
+	if(header.index_offset == 0)
+	{
+		scan_blocks(path);
+		return;
+	}
+
+	if(header.index_offset > length_ || header.block_count > (length_ - header.index_offset) / sizeof(hop_index_entry))
+		throw std::runtime_error(path + " has a damaged index");
+	const hop_index_entry* entries = reinterpret_cast<const hop_index_entry*>(data_ + header.index_offset);
+	index_.assign(entries, entries + header.block_count);
+
+	for(std::size_t i = 0; i < index_.size(); ++i)
+	{
+		const hop_index_entry& entry = index_[i];
+		if(entry.offset < sizeof(hop_file_header) || entry.offset > header.index_offset || hop_block_layout(entry.count).size > header.index_offset - entry.offset)
+			throw std::runtime_error(path + " has a damaged index");
+		records_ += entry.count;
+	}
+}
+
+void hop_reader::scan_blocks(const std::string& path)
+{
+	std::size_t offset = sizeof(hop_file_header);
+	while(length_ - offset >= sizeof(hop_block_header))
+	{
+		const hop_block_header& block = *reinterpret_cast<const hop_block_header*>(data_ + offset);
+		std::size_t size = hop_block_layout(block.count).size;
+		// a block cut off by the end of the file was not written completely
+		if(block.count == 0 || block.size != size || size > length_ - offset)
+			break;
+
+		hop_block columns(data_ + offset, block.count, records_);
+		hop_index_entry entry;
+		std::memset(&entry, 0, sizeof(entry));
+		entry.offset = offset;
+		entry.first_record = records_;
+		entry.count = block.count;
+		entry.min_target = 0xFFFFFFFF;
+		for(uint32_t i = 0; i < block.count; ++i)
+		{
+			entry.min_target = std::min(entry.min_target, columns.targets()[i]);
+			entry.max_target = std::max(entry.max_target, columns.targets()[i]);
+		}
+		index_.push_back(entry);
+		records_ += block.count;
+		offset += size;
+	}
+	if(index_.empty() && length_ > sizeof(hop_file_header))
+		std::fprintf(stderr, "%s holds no complete block\n", path.c_str());
+}
+
+namespace
+{
+	void append_address(std::string& output, uint32_t address)
+	{
+		char buffer[16];
+		std::snprintf(buffer, sizeof(buffer), "%u.%u.%u.%u", address >> 24, (address >> 16) & 0xFF, (address >> 8) & 0xFF, address & 0xFF);
+		output += buffer;
+	}
+
+	// the output is gathered per block, formatting with snprintf instead of ostream insertions
+	template <typename Formatter>
+	void convert(const hop_reader& reader, std::ostream& os, Formatter formatter)
+	{
+		std::string output;
+		for(std::size_t i = 0; i < reader.block_count(); ++i)
+		{
+			hop_block block = reader.block(i);
+			output.clear();
+			for(std::size_t j = 0; j < block.size(); ++j)
+				formatter(output, block, j);
+			os.write(output.data(), output.size());
+		}
+	}
+
+	void format_csv(std::string& output, const hop_block& block, std::size_t i)
+	{
+		char buffer[64];
+		append_address(output, block.targets()[i]);
+		std::snprintf(buffer, sizeof(buffer), ",%u,", block.ttls()[i]);
+		output += buffer;
+		append_address(output, block.responders()[i]);
+		std::snprintf(buffer, sizeof(buffer), ",%llu,%u,%u,%u,%u\n", static_cast<unsigned long long>(block.rtt_ns()[i]), block.icmp_types()[i], block.icmp_codes()[i], block.reply_ttls()[i], block.flags()[i]);
+		output += buffer;
+	}
+
+	struct json_formatter
+	{
+		bool first;
+
+		void operator()(std::string& output, const hop_block& block, std::size_t i)
+		{
+			char buffer[128];
+			output += first ? "\n{\"target\":\"" : ",\n{\"target\":\"";
+			first = false;
+			append_address(output, block.targets()[i]);
+			std::snprintf(buffer, sizeof(buffer), "\",\"ttl\":%u,\"responder\":\"", block.ttls()[i]);
+			output += buffer;
+			append_address(output, block.responders()[i]);
+			std::snprintf(buffer, sizeof(buffer), "\",\"rtt_ns\":%llu,\"icmp_type\":%u,\"icmp_code\":%u,\"reply_ttl\":%u,\"flags\":%u}", static_cast<unsigned long long>(block.rtt_ns()[i]), block.icmp_types()[i], block.icmp_codes()[i], block.reply_ttls()[i], block.flags()[i]);
+			output += buffer;
+		}
+	};
+}
+
+void write_csv(const hop_reader& reader, std::ostream& os)
+{
+	os << "target,ttl,responder,rtt_ns,icmp_type,icmp_code,reply_ttl,flags\n";
+	convert(reader, os, format_csv);
+}
+
+void write_json(const hop_reader& reader, std::ostream& os)
+{
+	json_formatter formatter = { true };
+	os << "[";
+	// the formatter is passed by value, it has to see its own first line
+	convert(reader, os, std::ref(formatter));
+	os << "\n]\n";
+}
@@ -0,0 +1,138 @@
+#include <hop_writer.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+hop_writer::hop_writer(const std::string& path, uint32_t block_capacity) :
+	file_(std::fopen(path.c_str(), "wb")),
+	path_(path),
+	offset_(0)
+{
+	if(file_ == 0)
+		throw std::runtime_error("Cannot create " + path + ": " + std::strerror(errno));
+
+	std::memset(&header_, 0, sizeof(header_));
+	std::memcpy(header_.magic, hop_format::magic, sizeof(header_.magic));
+	header_.version = hop_format::version;
+	header_.byte_order = hop_format::byte_order;
+	header_.block_capacity = std::max<uint32_t>(1, block_capacity);
+	// written once now and again on close, a reader of an unfinished file finds the blocks without index
+	write(&header_, sizeof(header_));
+
+	rtt_ns_.reserve(header_.block_capacity);
+	target_.reserve(header_.block_capacity);
+	responder_.reserve(header_.block_capacity);
+	ttl_.reserve(header_.block_capacity);
+	icmp_type_.reserve(header_.block_capacity);
+	icmp_code_.reserve(header_.block_capacity);
+	reply_ttl_.reserve(header_.block_capacity);
+	flags_.reserve(header_.block_capacity);
+}
+
+hop_writer::~hop_writer()
+{
+	try
+	{
+		close();
+	}
+	catch(std::exception&)
+	{
+	}
+}
+
+void hop_writer::append(const std::vector<hop_record>& records)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if(file_ == 0)
+		return;
+
+	for(std::size_t i = 0; i < records.size(); ++i)
+	{
+		const hop_record& record = records[i];
+		rtt_ns_.push_back(record.rtt_ns);
+		target_.push_back(record.target);
+		responder_.push_back(record.responder);
+		ttl_.push_back(record.ttl);
+		icmp_type_.push_back(record.icmp_type);
+		icmp_code_.push_back(record.icmp_code);
+		reply_ttl_.push_back(record.reply_ttl);
+		flags_.push_back(record.flags);
+		if(target_.size() == header_.block_capacity)
+			write_block();
+	}
+}
+
+void hop_writer::close()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if(file_ == 0)
+		return;
+
+	if(!target_.empty())
+		write_block();
+
+	header_.index_offset = offset_;
+	if(!index_.empty())
+		write(&index_[0], index_.size() * sizeof(hop_index_entry));
+
+	bool failed = std::fseek(file_, 0, SEEK_SET) != 0;
+	if(!failed)
+		write(&header_, sizeof(header_));
+	failed = std::fclose(file_) != 0 || failed;
+	file_ = 0;
+	if(failed)
+		throw std::runtime_error("Cannot finish " + path_);
+}
+
+void hop_writer::write_block()
+{
+	uint32_t count = static_cast<uint32_t>(target_.size());
+	hop_block_layout layout(count);
+
+	hop_index_entry entry;
+	std::memset(&entry, 0, sizeof(entry));
+	entry.offset = offset_;
+	entry.first_record = header_.record_count;
+	entry.count = count;
+	entry.min_target = *std::min_element(target_.begin(), target_.end());
+	entry.max_target = *std::max_element(target_.begin(), target_.end());
+
+	hop_block_header block;
+	std::memset(&block, 0, sizeof(block));
+	block.count = count;
+	block.size = layout.size;
+	write(&block, sizeof(block));
+	write_column(rtt_ns_);
+	write_column(target_);
+	write_column(responder_);
+	write_column(ttl_);
+	write_column(icmp_type_);
+	write_column(icmp_code_);
+	write_column(reply_ttl_);
+	write_column(flags_);
+
+	index_.push_back(entry);
+	header_.record_count += count;
+	++header_.block_count;
+}
+
+template <typename Value>
+void hop_writer::write_column(std::vector<Value>& column)
+{
+	static const uint8_t padding[8] = { 0 };
+	std::size_t length = column.size() * sizeof(Value);
+	write(&column[0], length);
+	write(padding, hop_block_layout::align(length) - length);
+	column.clear();
+}
+
+void hop_writer::write(const void* data, std::size_t length)
+{
+	if(length == 0)
+		return;
+	if(std::fwrite(data, 1, length, file_) != length)
+		throw std::runtime_error("Cannot write " + path_ + ": " + std::strerror(errno));
+	offset_ += length;
+}
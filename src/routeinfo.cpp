@@ -1,12 +1,62 @@
+#include <fstream>
 #include <iostream>
+#include <hop_reader.h>
+#include <hop_writer.h>
 #include <logger.h>
 #include <icmp_probe.h>
 #include <icmp_tx.h>
+#include <raw_transport.h>
+#include <simulated_network.h>
+#include <topology_store.h>
+#include <stateless_engine.h>
+#include <trace_engine.h>
 #include <udp_probe.h>
 #include <udp_tx.h>
+#include <uring_transport.h>
+#include <worker_pool.h>
 
 #include <boost/program_options.hpp>
 
+namespace
+{
+	///@brief The sockets of one worker, or its own simulated chain of routers if simulate is given.
+	transport* create_transport(boost::asio::io_context& io_context, const boost::program_options::variables_map& vm, std::size_t worker, timestamping::mode stamps, int receive_buffer, std::size_t packet_size)
+	{
+		uint16_t routers = vm["simulate"].as<uint16_t>();
+		if(routers == 0 && vm["uring"].as<bool>())
+		{
+			if(stamps != timestamping::none && worker == 0)
+				std::cerr << "Replies through io_uring carry no kernel timestamps, their round trip times end when they are reaped" << std::endl;
+			return new uring_transport(io_context, vm["batch"].as<uint16_t>(), vm["flush"].as<uint32_t>(), packet_size, receive_buffer);
+		}
+		if(routers == 0)
+			return new raw_transport(io_context, vm["batch"].as<uint16_t>(), vm["flush"].as<uint32_t>(), packet_size, stamps, receive_buffer, static_cast<std::size_t>(vm["rx-ring"].as<uint32_t>()) * 1024 * 1024, vm["rx-retire"].as<uint32_t>(), vm["interface"].as<std::string>(), static_cast<std::size_t>(vm["tx-ring"].as<uint32_t>()) * 1024 * 1024, vm["qdisc-bypass"].as<bool>());
+		
+		simulated_network::hop hop;
+		hop.delay = boost::asio::chrono::microseconds(vm["sim-delay"].as<uint32_t>());
+		hop.loss = vm["sim-loss"].as<double>() / 100;
+		hop.rate = vm["sim-rate"].as<uint32_t>();
+		hop.burst = vm["sim-burst"].as<uint32_t>();
+		return new simulated_network(io_context, std::vector<simulated_network::hop>(routers, hop), hop, vm["sim-seed"].as<uint64_t>() + worker, vm["sim-bandwidth"].as<uint64_t>() * 1000000);
+	}
+
+	///@brief The local address of the route to destination, false if there is none.
+	bool route_source(boost::asio::io_context& io_context, const std::string& destination, boost::asio::ip::address_v4& source)
+	{
+		boost::system::error_code error;
+		boost::asio::ip::address_v4 remote = boost::asio::ip::make_address_v4(destination, error);
+		if(error)
+			return false;
+		// connecting a UDP socket sends nothing, the kernel only picks the route and with it the local address
+		boost::asio::ip::udp::socket socket(io_context);
+		socket.open(boost::asio::ip::udp::v4(), error);
+		if(!error)
+			socket.connect(boost::asio::ip::udp::endpoint(remote, 33434), error);
+		if(!error)
+			source = socket.local_endpoint(error).address().to_v4();
+		return !error;
+	}
+}
 
 int main(int argc, char* argv[])
 {
@@ -17,13 +67,51 @@ int main(int argc, char* argv[])
 			("help", "produce help message")
 			("probetype", boost::program_options::value<std::string>()->default_value(""), "probe type")
 			("tx", boost::program_options::value<std::string>()->default_value(""), "tx type")
-			("debug", boost::program_options::value<unsigned long>()->default_value(0), "set debug level")
+			("debug", boost::program_options::value<unsigned long>()->default_value(0), "set debug level, 1 logs debug and 2 per packet trace messages")
 			("destination", boost::program_options::value<std::string>()->default_value(""), "destination")
+			("source", boost::program_options::value<std::string>()->default_value(""), "source address of the probes and tx packets, by default the one of the route to the destination or the first target")
 			("port", boost::program_options::value<uint16_t>()->default_value(0), "destination port")
 			("hops", boost::program_options::value<uint8_t>()->default_value(0), "number of hops till destionation")
 			("packets", boost::program_options::value<uint32_t>()->default_value(0), "number of packets to transmit")
 			("interval", boost::program_options::value<uint32_t>()->default_value(0), "interval between the packets")
-			("payload", boost::program_options::value<uint16_t>()->default_value(0), "payload size");
+			("payload", boost::program_options::value<uint16_t>()->default_value(0), "payload size")
+			("parallel", boost::program_options::bool_switch()->default_value(false), "probe all TTLs in one burst")
+			("maxttl", boost::program_options::value<uint16_t>()->default_value(30), "highest TTL probed in parallel mode")
+			("deadline", boost::program_options::value<uint32_t>()->default_value(5000), "time to wait for replies in parallel mode in milliseconds")
+			("targets", boost::program_options::value<std::string>()->default_value(""), "file with one destination per line, traced in parallel")
+			("stateless", boost::program_options::bool_switch()->default_value(false), "probe every TTL of the targets once in random order and validate the replies from the probes they quote, without per probe state, the deadline applies after the last probe")
+			("concurrency", boost::program_options::value<uint16_t>()->default_value(1000), "number of destinations traced at the same time")
+			("batch", boost::program_options::value<uint16_t>()->default_value(1), "number of packets handed to the kernel per sendmmsg call in tx mode")
+			("flush", boost::program_options::value<uint32_t>()->default_value(1000), "longest time a partial batch waits before it is sent in microseconds")
+			("rate", boost::program_options::value<uint32_t>()->default_value(0), "packets per second in tx and stateless mode, replaces the interval")
+			("burst", boost::program_options::value<uint32_t>()->default_value(1), "most packets sent back to back to catch up with the rate")
+			("spin", boost::program_options::value<uint32_t>()->default_value(0), "busy-wait the last microseconds before each send")
+			("threads", boost::program_options::value<uint16_t>()->default_value(1), "number of worker threads, each with its own sockets and share of the destinations or packets")
+			("cpus", boost::program_options::value<std::string>()->default_value(""), "cores to pin the workers to, like 0-3,8")
+			("interface", boost::program_options::value<std::string>()->default_value(""), "pin the workers to the cores local to this network interface unless cpus is given, the rx and tx rings use it")
+			("timestamps", boost::program_options::value<std::string>()->default_value("none"), "take round trip times from kernel timestamps: none, software or hardware")
+			("rx-ring", boost::program_options::value<uint32_t>()->default_value(0), "receive replies through an AF_PACKET ring of this many MiB on the interface, or on all of them, instead of the ICMP socket")
+			("rx-retire", boost::program_options::value<uint32_t>()->default_value(10), "longest time the kernel fills a block of the rx ring before handing it over in milliseconds")
+			("tx-ring", boost::program_options::value<uint32_t>()->default_value(0), "send through an AF_PACKET ring of this many MiB on the interface instead of the raw socket, kicked once per batch")
+			("qdisc-bypass", boost::program_options::bool_switch()->default_value(false), "let the tx ring hand frames to the device without the queueing discipline")
+			("uring", boost::program_options::bool_switch()->default_value(false), "send and receive through an io_uring instead of the rings and readiness of the sockets, batch and flush apply")
+			("stats", boost::program_options::value<uint32_t>()->default_value(1000), "interval of the tx statistics reports in milliseconds")
+			("late", boost::program_options::value<uint32_t>()->default_value(1000), "time after which an unanswered tx packet counts as lost in milliseconds")
+			("results", boost::program_options::value<std::string>()->default_value(""), "write the hops of the targets to this binary hop record file instead of printing them")
+			("convert", boost::program_options::value<std::string>()->default_value(""), "print a binary hop record file in the given format and exit")
+			("format", boost::program_options::value<std::string>()->default_value("csv"), "format for convert: csv or json")
+			("topology", boost::program_options::value<std::string>()->default_value(""), "topology store that learns the interfaces, links and paths of the targets and seeds the doubletree stop set")
+			("show", boost::program_options::value<std::string>()->default_value(""), "print from the topology store and exit: links, or path for the destination")
+			("doubletree", boost::program_options::value<uint16_t>()->default_value(0), "probe targets forwards and backwards from this TTL and stop at hops known from other targets, the deadline applies per probe")
+			("stop-prefix", boost::program_options::value<uint16_t>()->default_value(24), "prefix length of the targets that share the forward stop set in doubletree mode")
+			("incremental", boost::program_options::value<uint16_t>()->default_value(0), "re-trace targets with a path in the topology store this many TTLs at a time, only where the path changed, and log the route changes")
+			("simulate", boost::program_options::value<uint16_t>()->default_value(0), "answer targets and tx packets from this many simulated routers in process instead of the network")
+			("sim-delay", boost::program_options::value<uint32_t>()->default_value(1000), "one way delay of every simulated hop in microseconds")
+			("sim-loss", boost::program_options::value<double>()->default_value(0), "chance of every simulated hop to lose a packet in each direction in percent")
+			("sim-rate", boost::program_options::value<uint32_t>()->default_value(0), "ICMP messages per second every simulated hop sends at most, 0 for no limit")
+			("sim-burst", boost::program_options::value<uint32_t>()->default_value(50), "ICMP messages a simulated hop sends back to back before its rate limit applies")
+			("sim-seed", boost::program_options::value<uint64_t>()->default_value(1), "seed of the simulated losses, every worker adds its number")
+			("sim-bandwidth", boost::program_options::value<uint64_t>()->default_value(1000), "Mbit/s of the simulated link of the sender, the rate limits of the simulated hops count time by it");
 			
 		boost::program_options::variables_map vm;
 		boost::program_options::store(boost::program_options::parse_command_line(argc, argv, desc), vm);
@@ -35,31 +123,213 @@ int main(int argc, char* argv[])
 			return 0;
 		}
 		
-		boost::asio::io_context io_context;
+		if(!vm["convert"].as<std::string>().empty())
+		{
+			hop_reader reader(vm["convert"].as<std::string>());
+			if(vm["format"].as<std::string>() == "json")
+				write_json(reader, std::cout);
+			else
+				write_csv(reader, std::cout);
+			std::cout << std::flush;
+			return 0;
+		}
+		
+		if(!vm["show"].as<std::string>().empty())
+		{
+			topology_store store(vm["topology"].as<std::string>(), true);
+			if(vm["show"].as<std::string>() == "path")
+				write_path(store, boost::asio::ip::make_address_v4(vm["destination"].as<std::string>()), std::cout);
+			else
+				write_links(store, std::cout);
+			std::cout << std::flush;
+			return 0;
+		}
+		
+		if(vm["incremental"].as<uint16_t>() > 0 && vm["topology"].as<std::string>().empty())
+		{
+			// the cached paths come from the store, without one there is nothing to re-trace
+			std::cerr << "Incremental traces need the topology store" << std::endl;
+			return 1;
+		}
+		
+		logger::instance().start(static_cast<logger::level>(logger::info + std::min<unsigned long>(vm["debug"].as<unsigned long>(), logger::trace - logger::info)));
+		
+		std::vector<int> cpus = worker_pool::parse_cpu_list(vm["cpus"].as<std::string>());
+		if(cpus.empty() && !vm["interface"].as<std::string>().empty())
+			cpus = worker_pool::interface_cpus(vm["interface"].as<std::string>());
+		worker_pool workers(vm["threads"].as<uint16_t>(), cpus);
+		boost::asio::io_context& io_context = workers.io_context(0);
+		
+		uint8_t max_ttl = static_cast<uint8_t>(std::min<uint16_t>(vm["maxttl"].as<uint16_t>(), 255));
+		hop_writer* results = 0;
+		topology_store* topology = 0;
 
-		if(vm["probetype"].as<std::string>() == "udp")
+		timestamping::mode stamps = timestamping::parse_mode(vm["timestamps"].as<std::string>());
+		if(stamps == timestamping::hardware)
 		{
-			udp_probe* probe = new udp_probe(io_context, vm["destination"].as<std::string>().c_str());
+			// NIC stamps count on the clock of the NIC, without it they cannot be set against software stamps or the steady clock
+			if(vm["interface"].as<std::string>().empty())
+			{
+				std::cerr << "Hardware timestamps need the interface" << std::endl;
+				return 1;
+			}
+			// the NIC only stamps once it is told to, which has to happen on some socket
+			boost::asio::ip::udp::socket control(io_context, boost::asio::ip::udp::v4());
+			if(!timestamping::enable_interface(control.native_handle(), vm["interface"].as<std::string>()))
+				std::cerr << "Cannot enable hardware timestamps on " << vm["interface"].as<std::string>() << std::endl;
+			if(!timestamping::open_hardware_clock(control.native_handle(), vm["interface"].as<std::string>()))
+			{
+				std::cerr << "Cannot open the hardware clock of " << vm["interface"].as<std::string>() << std::endl;
+				return 1;
+			}
+		}
+
+		// the probes are built with their source address, replies only come back if it is one of ours
+		std::string route_destination = vm["destination"].as<std::string>();
+		if(!vm["targets"].as<std::string>().empty())
+		{
+			std::ifstream first(vm["targets"].as<std::string>().c_str());
+			first >> route_destination;
+		}
+		boost::asio::ip::address_v4 source;
+		if(!vm["source"].as<std::string>().empty())
+		{
+			boost::system::error_code error;
+			source = boost::asio::ip::make_address_v4(vm["source"].as<std::string>(), error);
+			if(error)
+			{
+				std::cerr << "Invalid source address " << vm["source"].as<std::string>() << std::endl;
+				return 1;
+			}
+		}
+		else if(!route_destination.empty() && !route_source(io_context, route_destination, source) && vm["simulate"].as<uint16_t>() == 0)
+		{
+			// simulated routers answer any source
+			std::cerr << "No route to " << route_destination << ", give the source address with --source" << std::endl;
+			return 1;
+		}
+
+		if(!vm["targets"].as<std::string>().empty())
+		{
+			std::ifstream targets(vm["targets"].as<std::string>().c_str());
+			if(!targets)
+			{
+				std::cerr << "Cannot open " << vm["targets"].as<std::string>() << std::endl;
+				return 1;
+			}
+			trace_engine::probe_type type = vm["probetype"].as<std::string>() == "udp" ? trace_engine::udp : trace_engine::icmp;
+			if(!vm["results"].as<std::string>().empty())
+				results = new hop_writer(vm["results"].as<std::string>());
+			if(vm["stateless"].as<bool>())
+			{
+				// every worker probes its share of the targets at its share of the rate, the probes tell the shards apart
+				// the send stamp travels in the probe, kernel stamps only end the round trips
+				std::vector<stateless_engine*> engines;
+				for(std::size_t worker = 0; worker < workers.size(); ++worker)
+				{
+					uint32_t rate = static_cast<uint32_t>(vm["rate"].as<uint32_t>() / workers.size());
+					if(vm["rate"].as<uint32_t>() > 0)
+						rate = std::max<uint32_t>(1, rate);
+					engines.push_back(new stateless_engine(workers.io_context(worker), create_transport(workers.io_context(worker), vm, worker, stamps, 4 * 1024 * 1024, 2048), source, type == trace_engine::udp ? probe_codec::udp : probe_codec::icmp, max_ttl, vm["deadline"].as<uint32_t>(), rate, vm["burst"].as<uint32_t>(), vm["spin"].as<uint32_t>(), vm["batch"].as<uint16_t>(), static_cast<uint16_t>(worker), results));
+				}
+				std::string destination;
+				for(std::size_t next = 0; targets >> destination; ++next)
+					engines[next % engines.size()]->add_destination(destination);
+				for(std::size_t worker = 0; worker < engines.size(); ++worker)
+					engines[worker]->start();
+			}
+			else
+			{
+				// every worker runs an engine on its own shard of the identifiers, destinations are dealt out in turn
+				uint16_t concurrency = static_cast<uint16_t>(std::max<std::size_t>(1, vm["concurrency"].as<uint16_t>() / workers.size()));
+				std::vector<trace_engine*> engines;
+				// replies of a whole burst arrive together, the socket buffer has to hold them until the next batch is drained
+				for(std::size_t worker = 0; worker < workers.size(); ++worker)
+					engines.push_back(new trace_engine(workers.io_context(worker), create_transport(workers.io_context(worker), vm, worker, stamps, 4 * 1024 * 1024, 2048), source, type, max_ttl, vm["deadline"].as<uint32_t>(), concurrency, static_cast<uint16_t>(worker), static_cast<uint16_t>(workers.size()), stamps, results));
+				if(!vm["topology"].as<std::string>().empty())
+				{
+					topology = new topology_store(vm["topology"].as<std::string>());
+					for(std::size_t worker = 0; worker < engines.size(); ++worker)
+					{
+						engines[worker]->topology(topology);
+						engines[worker]->incremental(static_cast<uint8_t>(std::min<uint16_t>(vm["incremental"].as<uint16_t>(), 255)));
+					}
+				}
+				if(vm["doubletree"].as<uint16_t>() > 0)
+				{
+					// one stop set for all workers, what one engine learns saves probes on the others
+					stop_set* stops = new stop_set(static_cast<uint8_t>(std::min<uint16_t>(vm["stop-prefix"].as<uint16_t>(), 32)));
+					if(topology)
+					{
+						// earlier runs count as traces seen before
+						std::vector<uint32_t> hops;
+						for(uint32_t id = 1; id <= topology->interface_count(); ++id)
+							stops->add_interface(boost::asio::ip::address_v4(topology->interface(id).address));
+						for(uint32_t i = 0; i < topology->destination_count(); ++i)
+						{
+							boost::asio::ip::address_v4 destination(topology->destination(i).address);
+							if(!topology->path(topology->destination(i), hops))
+								continue;
+							for(std::size_t ttl = 0; ttl < hops.size(); ++ttl)
+							{
+								if(hops[ttl] != 0)
+									stops->add_path(boost::asio::ip::address_v4(topology->interface(hops[ttl]).address), destination);
+							}
+						}
+					}
+					for(std::size_t worker = 0; worker < engines.size(); ++worker)
+						engines[worker]->doubletree(stops, static_cast<uint8_t>(std::min<uint16_t>(vm["doubletree"].as<uint16_t>(), 255)));
+				}
+				std::string destination;
+				for(std::size_t next = 0; targets >> destination; ++next)
+					engines[next % engines.size()]->add_destination(destination);
+				for(std::size_t worker = 0; worker < engines.size(); ++worker)
+					engines[worker]->start();
+			}
+		} else if(vm["probetype"].as<std::string>() == "udp")
+		{
+			udp_probe* probe = new udp_probe(io_context, create_transport(io_context, vm, 0, stamps, 0, 2048), source, vm["destination"].as<std::string>().c_str(), max_ttl, vm["deadline"].as<uint32_t>(), vm["parallel"].as<bool>(), stamps);
 			probe->start();
 		} else if(vm["probetype"].as<std::string>() == "icmp")
 		{
-			icmp_probe* probe = new icmp_probe(io_context, vm["destination"].as<std::string>().c_str());
+			icmp_probe* probe = new icmp_probe(io_context, create_transport(io_context, vm, 0, stamps, 0, 2048), source, vm["destination"].as<std::string>().c_str(), max_ttl, vm["deadline"].as<uint32_t>(), vm["parallel"].as<bool>(), stamps);
 			probe->start();
 		}
 
-		if(vm.count("tx") && vm.count("destination") && vm.count("port") && vm.count("hops") && vm.count("packets") && vm.count("interval") && vm.count("payload") && vm["tx"].as<std::string>() == "udp") 
-		{
-			udp_tx* tx = new udp_tx(io_context, vm["destination"].as<std::string>().c_str(), vm["port"].as<uint16_t>(), vm["hops"].as<uint8_t>(), vm["packets"].as<uint32_t>(), vm["interval"].as<uint32_t>(), vm["payload"].as<uint16_t>());
-			tx->start();
-		} 
-		if(vm.count("tx") && vm.count("destination") && vm.count("port") && vm.count("hops") && vm.count("packets") && vm.count("interval") && vm.count("payload") && vm["tx"].as<std::string>() == "icmp") 
+		if(vm.count("tx") && vm.count("destination") && vm.count("port") && vm.count("hops") && vm.count("packets") && vm.count("interval") && vm.count("payload") && (vm["tx"].as<std::string>() == "udp" || vm["tx"].as<std::string>() == "icmp")) 
 		{
-			std::cout << "Strating icmp_tx" << std::endl;
-			icmp_tx* tx = new icmp_tx(io_context, vm["destination"].as<std::string>().c_str(), vm["hops"].as<uint8_t>(), vm["packets"].as<uint32_t>(), vm["interval"].as<uint32_t>(), vm["payload"].as<uint16_t>());
-			tx->start();
+			if(vm["tx"].as<std::string>() == "icmp")
+				std::cout << "Strating icmp_tx" << std::endl;
+			// every worker sends its share of the packets at its share of the rate and numbers them out of its own range, the first one reports for all
+			tx_stats* stats = new tx_stats(vm["stats"].as<uint32_t>(), vm["late"].as<uint32_t>());
+			for(std::size_t worker = 0; worker < workers.size(); ++worker)
+			{
+				uint32_t packets = static_cast<uint32_t>(vm["packets"].as<uint32_t>() / workers.size() + (worker < vm["packets"].as<uint32_t>() % workers.size() ? 1 : 0));
+				uint32_t rate = static_cast<uint32_t>(vm["rate"].as<uint32_t>() / workers.size());
+				if(vm["rate"].as<uint32_t>() > 0)
+					rate = std::max<uint32_t>(1, rate);
+				if(packets == 0)
+					continue;
+				transport* network = create_transport(workers.io_context(worker), vm, worker, stamps, 0, std::max<std::size_t>(2048, 28 + vm["payload"].as<uint16_t>()));
+				if(vm["tx"].as<std::string>() == "udp")
+				{
+					udp_tx* tx = new udp_tx(workers.io_context(worker), network, source, vm["destination"].as<std::string>().c_str(), vm["port"].as<uint16_t>(), vm["hops"].as<uint8_t>(), packets, vm["interval"].as<uint32_t>(), vm["payload"].as<uint16_t>(), vm["batch"].as<uint16_t>(), rate, vm["burst"].as<uint32_t>(), vm["spin"].as<uint32_t>(), static_cast<uint16_t>(worker), static_cast<uint16_t>(workers.size()), stats, stamps);
+					tx->start();
+				}
+				else
+				{
+					icmp_tx* tx = new icmp_tx(workers.io_context(worker), network, source, vm["destination"].as<std::string>().c_str(), vm["hops"].as<uint8_t>(), packets, vm["interval"].as<uint32_t>(), vm["payload"].as<uint16_t>(), vm["batch"].as<uint16_t>(), rate, vm["burst"].as<uint32_t>(), vm["spin"].as<uint32_t>(), static_cast<uint16_t>(worker), static_cast<uint16_t>(workers.size()), stats, stamps);
+					tx->start();
+				}
+			}
 		}
 		
-		io_context.run();
+		workers.run();
+		if(results)
+			results->close();
+		if(topology)
+			topology->flush();
+		logger::instance().stop();
 	}
 	catch (std::exception& e)
 	{
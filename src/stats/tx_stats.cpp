@@ -0,0 +1,218 @@
+#include <tx_stats.h>
+
+#include <algorithm>
+#include <cstdio>
+
+tx_counters::tx_counters() :
+	sent_packets_(0),
+	sent_bytes_(0),
+	received_(0),
+	lost_(0),
+	duplicates_(0),
+	reordered_(0),
+	late_(0),
+	rtt_max_(0),
+	rtt_(new std::atomic<uint64_t>[hdr_histogram::bucket_count]())
+{
+}
+
+flow_tracker::flow_tracker(uint16_t shard, uint16_t shards, tx_counters* counters, boost::asio::chrono::milliseconds late) :
+	counters_(counters),
+	late_(late),
+	sent_(0),
+	oldest_(0),
+	newest_answered_(0),
+	answered_any_(false)
+{
+	// zero is left out, the kernel fills in a zero IP identification itself
+	shards = std::max<uint16_t>(1, shards);
+	range_ = 65535 / shards;
+	base_ = static_cast<uint16_t>(1 + std::min<uint16_t>(shard, shards - 1) * range_);
+	sent_at_.resize(range_);
+	answered_.resize(range_, 0);
+}
+
+uint16_t flow_tracker::next(time_point now, std::size_t bytes)
+{
+	// the number is needed again before the packet that had it is old enough to give up on
+	if(sent_ - oldest_ == range_)
+		retire();
+
+	uint32_t index = static_cast<uint32_t>(sent_ % range_);
+	sent_at_[index] = now;
+	answered_[index] = 0;
+	++sent_;
+	if(counters_)
+		counters_->sent(bytes);
+	return static_cast<uint16_t>(base_ + index);
+}
+
+void flow_tracker::restamp(uint16_t sequence, time_point sent_at)
+{
+	if(sequence < base_ || static_cast<uint32_t>(sequence - base_) >= range_)
+		return;
+
+	// a number already retired is not in flight any more
+	uint32_t index = static_cast<uint32_t>(sequence - base_);
+	uint64_t number = oldest_ + (index + range_ - oldest_ % range_) % range_;
+	if(number < sent_)
+		sent_at_[index] = sent_at;
+}
+
+bool flow_tracker::reply(uint16_t sequence, time_point now, boost::asio::chrono::steady_clock::duration& rtt)
+{
+	if(sequence < base_ || static_cast<uint32_t>(sequence - base_) >= range_)
+		return false;
+
+	// the only packet in flight with this index, if any
+	uint32_t index = static_cast<uint32_t>(sequence - base_);
+	uint64_t number = oldest_ + (index + range_ - oldest_ % range_) % range_;
+	if(number >= sent_)
+	{
+		if(counters_)
+			counters_->late();
+		return false;
+	}
+
+	rtt = now - sent_at_[index];
+	if(answered_[index])
+	{
+		if(counters_)
+			counters_->duplicate();
+		return true;
+	}
+	answered_[index] = 1;
+
+	if(answered_any_ && number < newest_answered_)
+	{
+		if(counters_)
+			counters_->reordered();
+	}
+	else
+	{
+		newest_answered_ = number;
+		answered_any_ = true;
+	}
+
+	if(counters_)
+		counters_->received(static_cast<uint64_t>(boost::asio::chrono::duration_cast<boost::asio::chrono::nanoseconds>(rtt).count()));
+	return true;
+}
+
+void flow_tracker::expire(time_point now)
+{
+	while(oldest_ < sent_ && now - sent_at_[oldest_ % range_] >= late_)
+		retire();
+}
+
+void flow_tracker::retire()
+{
+	if(!answered_[oldest_ % range_] && counters_)
+		counters_->lost();
+	++oldest_;
+}
+
+tx_stats::tx_stats(uint32_t interval, uint32_t late) :
+	interval_(std::max<uint32_t>(1, interval)),
+	late_(late),
+	finished_(0),
+	started_(boost::asio::chrono::steady_clock::now()),
+	reported_(started_)
+{
+	previous_.sent_packets = 0;
+	previous_.sent_bytes = 0;
+	previous_.received = 0;
+	previous_.lost = 0;
+	previous_.duplicates = 0;
+	previous_.reordered = 0;
+	previous_.late = 0;
+}
+
+tx_counters* tx_stats::add_flow()
+{
+	std::lock_guard<std::mutex> lock(flows_mutex_);
+	flows_.push_back(std::unique_ptr<tx_counters>(new tx_counters()));
+	return flows_.back().get();
+}
+
+bool tx_stats::finished() const
+{
+	return finished_.load(std::memory_order_acquire) == flows_.size();
+}
+
+void tx_stats::load(snapshot& current)
+{
+	current.sent_packets = 0;
+	current.sent_bytes = 0;
+	current.received = 0;
+	current.lost = 0;
+	current.duplicates = 0;
+	current.reordered = 0;
+	current.late = 0;
+	current.rtt.reset();
+
+	std::lock_guard<std::mutex> lock(flows_mutex_);
+	for(std::size_t i = 0; i < flows_.size(); ++i)
+	{
+		const tx_counters& flow = *flows_[i];
+		current.sent_packets += flow.sent_packets_.load(std::memory_order_relaxed);
+		current.sent_bytes += flow.sent_bytes_.load(std::memory_order_relaxed);
+		current.received += flow.received_.load(std::memory_order_relaxed);
+		current.lost += flow.lost_.load(std::memory_order_relaxed);
+		current.duplicates += flow.duplicates_.load(std::memory_order_relaxed);
+		current.reordered += flow.reordered_.load(std::memory_order_relaxed);
+		current.late += flow.late_.load(std::memory_order_relaxed);
+		for(std::size_t bucket = 0; bucket < hdr_histogram::bucket_count; ++bucket)
+		{
+			uint64_t count = flow.rtt_[bucket].load(std::memory_order_relaxed);
+			if(count != 0)
+				current.rtt.add(bucket, count);
+		}
+		current.rtt.max(flow.rtt_max_.load(std::memory_order_relaxed));
+	}
+}
+
+void tx_stats::report(std::ostream& os, bool total)
+{
+	boost::asio::chrono::steady_clock::time_point now = boost::asio::chrono::steady_clock::now();
+	snapshot current;
+	load(current);
+
+	snapshot interval = current;
+	if(!total)
+	{
+		interval.sent_packets -= previous_.sent_packets;
+		interval.sent_bytes -= previous_.sent_bytes;
+		interval.received -= previous_.received;
+		interval.lost -= previous_.lost;
+		interval.duplicates -= previous_.duplicates;
+		interval.reordered -= previous_.reordered;
+		interval.late -= previous_.late;
+		interval.rtt.subtract(previous_.rtt);
+	}
+	double seconds = boost::asio::chrono::duration<double>(now - (total ? started_ : reported_)).count();
+	seconds = std::max(seconds, 1e-6);
+	double elapsed = boost::asio::chrono::duration<double>(now - started_).count();
+	uint64_t retired = interval.received + interval.lost;
+
+	char line[512];
+	std::snprintf(line, sizeof(line), "%s%.3f s: sent %llu (%.0f pps, %.3f Mbit/s), received %llu (%.0f pps), lost %llu (%.3f%%), duplicates %llu, reordered %llu, late %llu\n",
+		total ? "total " : "", elapsed,
+		static_cast<unsigned long long>(interval.sent_packets), interval.sent_packets / seconds, interval.sent_bytes * 8 / seconds / 1e6,
+		static_cast<unsigned long long>(interval.received), interval.received / seconds,
+		static_cast<unsigned long long>(interval.lost), retired == 0 ? 0.0 : 100.0 * interval.lost / retired,
+		static_cast<unsigned long long>(interval.duplicates), static_cast<unsigned long long>(interval.reordered), static_cast<unsigned long long>(interval.late));
+	os << line;
+	if(interval.rtt.count() > 0)
+	{
+		std::snprintf(line, sizeof(line), "%srtt us: p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n",
+			total ? "total " : "",
+			interval.rtt.percentile(0.5) / 1e3, interval.rtt.percentile(0.9) / 1e3, interval.rtt.percentile(0.99) / 1e3,
+			interval.rtt.percentile(0.999) / 1e3, interval.rtt.max() / 1e3);
+		os << line;
+	}
+	os << std::flush;
+
+	previous_ = current;
+	reported_ = now;
+}
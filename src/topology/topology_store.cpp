@@ -0,0 +1,512 @@
+#include <topology_store.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+	const uint32_t initial_interfaces = 1024;
+	const uint32_t initial_links = 2048;
+	const uint32_t initial_destinations = 1024;
+	const uint64_t initial_path_words = 16384;
+
+	uint64_t hash(uint64_t key)
+	{
+		return key * 0x9E3779B97F4A7C15ull;
+	}
+
+	uint64_t link_key(uint32_t from, uint32_t to)
+	{
+		return (static_cast<uint64_t>(from) << 32) | to;
+	}
+
+	uint32_t to_us(uint64_t ns)
+	{
+		return static_cast<uint32_t>(std::min<uint64_t>(ns / 1000, 0xFFFFFFFF));
+	}
+
+	uint64_t wall_clock()
+	{
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+	}
+
+	bool power_of_two(uint64_t value)
+	{
+		return value != 0 && (value & (value - 1)) == 0;
+	}
+}
+
+topology_store::topology_store(const std::string& path, bool read_only) :
+	path_(path),
+	read_only_(read_only),
+	data_(0),
+	length_(0),
+	header_(0),
+	layout_(topology_file_header())
+{
+	int fd = ::open(path.c_str(), read_only ? O_RDONLY : O_RDWR);
+	if(fd < 0 && errno == ENOENT && !read_only)
+	{
+		create(path);
+		return;
+	}
+	if(fd < 0)
+		throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+
+	struct stat status;
+	if(::fstat(fd, &status) != 0 || static_cast<std::size_t>(status.st_size) < sizeof(topology_file_header))
+	{
+		::close(fd);
+		throw std::runtime_error(path + " is no topology store");
+	}
+	map(path, fd, static_cast<std::size_t>(status.st_size));
+
+	const topology_file_header& header = *header_;
+	const char* error = 0;
+	if(std::memcmp(header.magic, topology_format::magic, sizeof(header.magic)) != 0)
+		error = " is no topology store";
+	else if(header.byte_order != topology_format::byte_order)
+		error = " was written on a host of other byte order";
+	else if(header.version != topology_format::version)
+		error = " has unsupported version";
+	else if(!power_of_two(header.interface_capacity) || !power_of_two(header.link_capacity) || !power_of_two(header.destination_capacity)
+		|| header.interface_count > header.interface_capacity || header.link_count > header.link_capacity || header.destination_count > header.destination_capacity
+		|| header.path_used > header.path_capacity || topology_layout(header).size != length_)
+		error = " is damaged";
+	if(error)
+	{
+		unmap();
+		throw std::runtime_error(path + error);
+	}
+	layout_ = topology_layout(header);
+}
+
+topology_store::~topology_store()
+{
+	flush();
+	unmap();
+}
+
+void topology_store::create(const std::string& path)
+{
+	topology_file_header header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, topology_format::magic, sizeof(header.magic));
+	header.version = topology_format::version;
+	header.byte_order = topology_format::byte_order;
+	header.interface_capacity = initial_interfaces;
+	header.link_capacity = initial_links;
+	header.destination_capacity = initial_destinations;
+	header.path_capacity = initial_path_words;
+	header.updated = wall_clock();
+
+	int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0)
+		throw std::runtime_error("Cannot create " + path + ": " + std::strerror(errno));
+	// the file starts out as zeros, which are empty sections and free index slots
+	topology_layout layout(header);
+	if(::ftruncate(fd, static_cast<off_t>(layout.size)) != 0)
+	{
+		::close(fd);
+		throw std::runtime_error("Cannot size " + path + ": " + std::strerror(errno));
+	}
+	map(path, fd, layout.size);
+	*header_ = header;
+	layout_ = layout;
+}
+
+void topology_store::map(const std::string& path, int fd, std::size_t length)
+{
+	void* data = ::mmap(0, length, read_only_ ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	// the mapping keeps the file open
+	::close(fd);
+	if(data == MAP_FAILED)
+		throw std::runtime_error("Cannot map " + path + ": " + std::strerror(errno));
+	data_ = static_cast<uint8_t*>(data);
+	length_ = length;
+	header_ = reinterpret_cast<topology_file_header*>(data_);
+}
+
+void topology_store::unmap()
+{
+	if(data_)
+		::munmap(data_, length_);
+	data_ = 0;
+	header_ = 0;
+}
+
+void topology_store::flush()
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if(data_ && !read_only_)
+		::msync(data_, length_, MS_SYNC);
+}
+
+void topology_store::add_trace(const std::vector<hop_record>& hops, bool partial)
+{
+	if(hops.empty())
+		return;
+	if(read_only_)
+		throw std::logic_error(path_ + " is open read only");
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	uint64_t now = wall_clock();
+	// the path ends with the first answer of the target, later TTLs only repeat it
+	std::size_t count = 0;
+	while(count < hops.size() && (count == 0 || !(hops[count - 1].flags & hop_flags::destination)))
+		++count;
+	reserve(static_cast<uint32_t>(count), static_cast<uint32_t>(count), 1, hops[count - 1].ttl + 1);
+
+	hops_.assign(hops[count - 1].ttl, 0);
+	uint32_t previous = 0;
+	uint8_t previous_ttl = 0;
+	for(std::size_t i = 0; i < count; ++i)
+	{
+		const hop_record& hop = hops[i];
+		if(hop.ttl == 0)
+			continue;
+		uint32_t rtt_us = to_us(hop.rtt_ns);
+		// hops an incremental trace took from the store keep the path whole, but were not measured
+		bool seen = !(hop.flags & hop_flags::cached);
+		uint32_t id = intern_interface(hop.responder, rtt_us, now, seen);
+		hops_[hop.ttl - 1] = id;
+		// only hops at neighbouring TTLs are known to be linked
+		if(seen && previous != 0 && previous != id && hop.ttl == previous_ttl + 1)
+			add_link(previous, id, rtt_us, now);
+		previous = id;
+		previous_ttl = hop.ttl;
+	}
+	set_path(hops[0].target, hops_, partial, now);
+	header_->updated = now;
+}
+
+template <typename Match>
+std::size_t topology_store::find(const uint32_t* index, uint32_t capacity, uint64_t key, Match match)
+{
+	// twice as many slots as entries keeps the runs short
+	std::size_t mask = 2 * static_cast<std::size_t>(capacity) - 1;
+	std::size_t slot = static_cast<std::size_t>(hash(key) >> 32) & mask;
+	while(index[slot] != 0 && !match(index[slot] - 1))
+		slot = (slot + 1) & mask;
+	return slot;
+}
+
+namespace
+{
+	struct interface_match
+	{
+		const topology_interface* interfaces;
+		uint32_t address;
+
+		bool operator()(uint32_t i) const
+		{
+			return interfaces[i].address == address;
+		}
+	};
+
+	struct link_match
+	{
+		const topology_link* links;
+		uint32_t from;
+		uint32_t to;
+
+		bool operator()(uint32_t i) const
+		{
+			return links[i].from == from && links[i].to == to;
+		}
+	};
+
+	struct destination_match
+	{
+		const topology_destination* destinations;
+		uint32_t address;
+
+		bool operator()(uint32_t i) const
+		{
+			return destinations[i].address == address;
+		}
+	};
+}
+
+uint32_t topology_store::intern_interface(uint32_t address, uint32_t rtt_us, uint64_t now, bool seen)
+{
+	interface_match match = { interfaces(), address };
+	std::size_t slot = find(interface_index(), header_->interface_capacity, address, match);
+	uint32_t* index = interface_index();
+	if(index[slot] == 0)
+	{
+		topology_interface& entry = interfaces()[header_->interface_count];
+		entry.address = address;
+		entry.min_rtt_us = rtt_us;
+		entry.first_seen = now;
+		index[slot] = ++header_->interface_count;
+	}
+	topology_interface& entry = interfaces()[index[slot] - 1];
+	if(seen)
+	{
+		entry.min_rtt_us = std::min(entry.min_rtt_us, rtt_us);
+		entry.last_seen = now;
+	}
+	return index[slot];
+}
+
+void topology_store::add_link(uint32_t from, uint32_t to, uint32_t rtt_us, uint64_t now)
+{
+	link_match match = { links(), from, to };
+	std::size_t slot = find(link_index(), header_->link_capacity, link_key(from, to), match);
+	uint32_t* index = link_index();
+	if(index[slot] == 0)
+	{
+		topology_link& entry = links()[header_->link_count];
+		std::memset(&entry, 0, sizeof(entry));
+		entry.from = from;
+		entry.to = to;
+		entry.min_rtt_us = rtt_us;
+		index[slot] = ++header_->link_count;
+	}
+	topology_link& entry = links()[index[slot] - 1];
+	entry.min_rtt_us = std::min(entry.min_rtt_us, rtt_us);
+	entry.recent_rtt_us[entry.samples % topology_format::recent_samples] = rtt_us;
+	++entry.samples;
+	entry.last_seen = now;
+}
+
+void topology_store::set_path(uint32_t address, const std::vector<uint32_t>& hops, bool partial, uint64_t now)
+{
+	destination_match match = { destinations(), address };
+	std::size_t slot = find(destination_index(), header_->destination_capacity, address, match);
+	uint32_t* index = destination_index();
+	if(index[slot] == 0)
+	{
+		topology_destination& entry = destinations()[header_->destination_count];
+		std::memset(&entry, 0, sizeof(entry));
+		entry.address = address;
+		index[slot] = ++header_->destination_count;
+	}
+	topology_destination& entry = destinations()[index[slot] - 1];
+	// a path cut short at the stop set says less than a whole one it would replace
+	if(partial && entry.path != 0 && !(entry.flags & topology_path_flags::partial))
+		return;
+	entry.updated = now;
+
+	// an unchanged path is only stamped, a changed one is appended
+	uint32_t* words = paths();
+	uint32_t flags = partial ? topology_path_flags::partial : 0;
+	if(entry.path != 0)
+	{
+		const uint32_t* current = words + entry.path - 1;
+		if(current[0] == hops.size() && std::equal(hops.begin(), hops.end(), current + 1))
+		{
+			entry.flags = flags;
+			return;
+		}
+	}
+	uint32_t* path = words + header_->path_used;
+	path[0] = static_cast<uint32_t>(hops.size());
+	std::copy(hops.begin(), hops.end(), path + 1);
+	entry.path = header_->path_used + 1;
+	entry.flags = flags;
+	header_->path_used += hops.size() + 1;
+}
+
+void topology_store::reserve(uint32_t interfaces, uint32_t links, uint32_t destinations, uint64_t words)
+{
+	topology_file_header capacities = *header_;
+	bool full = false;
+	while(capacities.interface_count + interfaces > capacities.interface_capacity)
+	{
+		capacities.interface_capacity *= 2;
+		full = true;
+	}
+	while(capacities.link_count + links > capacities.link_capacity)
+	{
+		capacities.link_capacity *= 2;
+		full = true;
+	}
+	while(capacities.destination_count + destinations > capacities.destination_capacity)
+	{
+		capacities.destination_capacity *= 2;
+		full = true;
+	}
+	if(capacities.path_used + words > capacities.path_capacity)
+	{
+		// the rewrite leaves out replaced paths, only the live ones need the room
+		uint64_t live = 0;
+		for(uint32_t i = 0; i < header_->destination_count; ++i)
+		{
+			if(destination(i).path != 0)
+				live += paths()[destination(i).path - 1] + 1;
+		}
+		while(live + words > capacities.path_capacity / 2)
+			capacities.path_capacity *= 2;
+		full = true;
+	}
+	if(full)
+		grow(capacities);
+}
+
+void topology_store::grow(const topology_file_header& capacities)
+{
+	// the larger store is built next to the old one and replaces it in one rename
+	std::string temporary = path_ + ".tmp";
+	topology_file_header header = capacities;
+	header.interface_count = 0;
+	header.link_count = 0;
+	header.destination_count = 0;
+	header.path_used = 0;
+	topology_layout layout(header);
+
+	int fd = ::open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0)
+		throw std::runtime_error("Cannot create " + temporary + ": " + std::strerror(errno));
+	if(::ftruncate(fd, static_cast<off_t>(layout.size)) != 0)
+	{
+		::close(fd);
+		throw std::runtime_error("Cannot size " + temporary + ": " + std::strerror(errno));
+	}
+	void* mapped = ::mmap(0, layout.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if(mapped == MAP_FAILED)
+		throw std::runtime_error("Cannot map " + temporary + ": " + std::strerror(errno));
+
+	// entries keep their numbers, so ids in links and paths stay valid, only the indexes are rebuilt
+	uint8_t* data = static_cast<uint8_t*>(mapped);
+	std::copy(data_ + layout_.interfaces, data_ + layout_.interfaces + header_->interface_count * sizeof(topology_interface), data + layout.interfaces);
+	std::copy(data_ + layout_.links, data_ + layout_.links + header_->link_count * sizeof(topology_link), data + layout.links);
+	std::copy(data_ + layout_.destinations, data_ + layout_.destinations + header_->destination_count * sizeof(topology_destination), data + layout.destinations);
+
+	const uint32_t* old_paths = paths();
+	uint8_t* old_data = data_;
+	std::size_t old_length = length_;
+	data_ = data;
+	length_ = layout.size;
+	header_ = reinterpret_cast<topology_file_header*>(data_);
+	*header_ = header;
+	layout_ = layout;
+
+	for(uint32_t i = 0; i < capacities.interface_count; ++i)
+	{
+		interface_match match = { interfaces(), interfaces()[i].address };
+		interface_index()[find(interface_index(), header_->interface_capacity, match.address, match)] = i + 1;
+	}
+	header_->interface_count = capacities.interface_count;
+	for(uint32_t i = 0; i < capacities.link_count; ++i)
+	{
+		link_match match = { links(), links()[i].from, links()[i].to };
+		link_index()[find(link_index(), header_->link_capacity, link_key(match.from, match.to), match)] = i + 1;
+	}
+	header_->link_count = capacities.link_count;
+	for(uint32_t i = 0; i < capacities.destination_count; ++i)
+	{
+		topology_destination& entry = destinations()[i];
+		destination_match match = { destinations(), entry.address };
+		destination_index()[find(destination_index(), header_->destination_capacity, entry.address, match)] = i + 1;
+		if(entry.path != 0)
+		{
+			// only the latest path of every destination moves over
+			const uint32_t* path = old_paths + entry.path - 1;
+			std::copy(path, path + path[0] + 1, paths() + header_->path_used);
+			entry.path = header_->path_used + 1;
+			header_->path_used += path[0] + 1;
+		}
+	}
+	header_->destination_count = capacities.destination_count;
+
+	// the new file has to be on the disk before it replaces the old one, a crash in between must not leave a hole in its place
+	if(::msync(data_, length_, MS_SYNC) != 0)
+		throw std::runtime_error("Cannot write " + temporary + ": " + std::strerror(errno));
+	::munmap(old_data, old_length);
+	if(std::rename(temporary.c_str(), path_.c_str()) != 0)
+		throw std::runtime_error("Cannot replace " + path_ + ": " + std::strerror(errno));
+}
+
+const topology_destination* topology_store::find_destination(const boost::asio::ip::address_v4& destination) const
+{
+	destination_match match = { destinations(), destination.to_uint() };
+	std::size_t slot = find(destination_index(), header_->destination_capacity, match.address, match);
+	if(destination_index()[slot] == 0)
+		return 0;
+	return &destinations()[destination_index()[slot] - 1];
+}
+
+bool topology_store::path(const boost::asio::ip::address_v4& destination, std::vector<uint32_t>& hops) const
+{
+	const topology_destination* entry = find_destination(destination);
+	return entry && path(*entry, hops);
+}
+
+bool topology_store::path(const topology_destination& destination, std::vector<uint32_t>& hops) const
+{
+	if(destination.path == 0)
+		return false;
+	const uint32_t* path = paths() + destination.path - 1;
+	hops.assign(path + 1, path + 1 + path[0]);
+	return true;
+}
+
+bool topology_store::route(const boost::asio::ip::address_v4& destination, std::vector<uint32_t>& addresses) const
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if(!path(destination, addresses))
+		return false;
+	for(std::size_t i = 0; i < addresses.size(); ++i)
+	{
+		if(addresses[i] != 0)
+			addresses[i] = interface(addresses[i]).address;
+	}
+	return true;
+}
+
+uint32_t topology_store::median_rtt_us(const topology_link& link)
+{
+	std::size_t count = std::min<std::size_t>(link.samples, topology_format::recent_samples);
+	if(count == 0)
+		return 0;
+	uint32_t samples[topology_format::recent_samples];
+	std::copy(link.recent_rtt_us, link.recent_rtt_us + count, samples);
+	std::nth_element(samples, samples + count / 2, samples + count);
+	return samples[count / 2];
+}
+
+void write_links(const topology_store& store, std::ostream& os)
+{
+	os << "from,to,min_rtt_us,median_rtt_us,samples,last_seen\n";
+	for(uint32_t i = 0; i < store.link_count(); ++i)
+	{
+		const topology_link& link = store.link(i);
+		os << boost::asio::ip::address_v4(store.interface(link.from).address).to_string() << ','
+			<< boost::asio::ip::address_v4(store.interface(link.to).address).to_string() << ','
+			<< link.min_rtt_us << ','
+			<< topology_store::median_rtt_us(link) << ','
+			<< link.samples << ','
+			<< link.last_seen / 1000000000 << '\n';
+	}
+}
+
+void write_path(const topology_store& store, const boost::asio::ip::address_v4& destination, std::ostream& os)
+{
+	std::vector<uint32_t> hops;
+	if(!store.path(destination, hops))
+	{
+		os << "no path to " << destination.to_string() << " known" << std::endl;
+		return;
+	}
+	bool partial = (store.find_destination(destination)->flags & topology_path_flags::partial) != 0;
+	os << "path to " << destination.to_string() << (partial ? ", partial" : "") << std::endl;
+	for(std::size_t ttl = 1; ttl <= hops.size(); ++ttl)
+	{
+		if(hops[ttl - 1] == 0)
+			os << ttl << ": *" << std::endl;
+		else
+			os << ttl << ": " << boost::asio::ip::address_v4(store.interface(hops[ttl - 1]).address).to_string()
+				<< ", min time = " << store.interface(hops[ttl - 1]).min_rtt_us / 1000.0 << std::endl;
+	}
+}
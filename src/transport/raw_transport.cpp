@@ -0,0 +1,146 @@
+#include <raw_transport.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <boost/bind/bind.hpp>
+
+namespace
+{
+	// bounds of the wait for a full device queue, it doubles while the queue stays full
+	const boost::asio::chrono::microseconds min_backoff(50);
+	const boost::asio::chrono::microseconds max_backoff(10000);
+
+	raw::endpoint destination_of(const uint8_t* data)
+	{
+		// the destination address is bytes 16 to 19 of the IPv4 header
+		boost::asio::ip::address_v4::bytes_type bytes;
+		std::memcpy(bytes.data(), data + 16, bytes.size());
+		return raw::endpoint(boost::asio::ip::address_v4(bytes), 0);
+	}
+}
+
+raw_transport::raw_transport(boost::asio::io_context& io_context, uint16_t batch_size, uint32_t flush_deadline, std::size_t packet_size, timestamping::mode stamps, int receive_buffer, std::size_t ring_size, uint32_t retire_timeout, const std::string& interface, std::size_t tx_ring_size, bool qdisc_bypass) :
+	raw_socket_(io_context, raw::endpoint(raw::v4(), 0)),
+	waiting_(false),
+	backoff_timer_(io_context),
+	backoff_(min_backoff)
+{
+	if(ring_size > 0)
+		// the ring takes the replies off the interface, there is no ICMP socket to queue them as well
+		packet_ring_.reset(new packet_ring(io_context, interface, ring_size, retire_timeout, stamps));
+	else
+	{
+		receive_socket_.reset(new boost::asio::ip::icmp::socket(io_context, boost::asio::ip::icmp::v4()));
+		receive_ring_.reset(new receive_ring<boost::asio::ip::icmp::socket>(*receive_socket_, 64, 2048, stamps));
+		if(stamps != timestamping::none && !timestamping::enable(receive_socket_->native_handle(), stamps, false, true))
+			std::cerr << "Kernel receive timestamps are not available, using the time of the receive calls" << std::endl;
+		if(receive_buffer > 0)
+			receive_socket_->set_option(boost::asio::socket_base::receive_buffer_size(receive_buffer));
+	}
+
+	// one datagram per batch goes straight to sendto
+	if(tx_ring_size > 0)
+		tx_ring_.reset(new packet_tx_ring(io_context, interface, tx_ring_size, packet_size, batch_size, boost::asio::chrono::microseconds(flush_deadline), qdisc_bypass));
+	else if(batch_size > 1)
+		batch_.reset(new raw::batch_sender(raw_socket_, batch_size, boost::asio::chrono::microseconds(flush_deadline), packet_size));
+}
+
+bool raw_transport::send(const uint8_t* data, std::size_t length)
+{
+	if(length < 20)
+		return false;
+
+	if(tx_ring_)
+		return tx_ring_->send(data, length);
+
+	raw::endpoint destination = destination_of(data);
+	if(batch_)
+		return batch_->send_to(boost::asio::buffer(data, length), destination);
+
+	int error = EAGAIN;
+	if(backlog_.empty())
+	{
+		ssize_t result = ::sendto(raw_socket_.native_handle(), data, length, MSG_DONTWAIT, destination.data(), static_cast<socklen_t>(destination.size()));
+		if(result >= 0)
+			return true;
+		error = errno;
+		if(error != EAGAIN && error != EWOULDBLOCK && error != ENOBUFS)
+			return false;
+	}
+
+	// the socket buffer or the device queue is full, the datagram waits its turn
+	backlog_.push_back(std::vector<uint8_t>(data, data + length));
+	if(!waiting_)
+		wait_writable(error);
+	return true;
+}
+
+std::size_t raw_transport::pending() const
+{
+	if(tx_ring_)
+		return tx_ring_->pending();
+	return batch_ ? batch_->pending() : backlog_.size();
+}
+
+void raw_transport::start(receive_handler handler)
+{
+	if(packet_ring_)
+		packet_ring_->start(handler);
+	else
+		receive_ring_->start(handler);
+}
+
+void raw_transport::stop()
+{
+	if(packet_ring_)
+		packet_ring_->stop();
+	else
+		receive_ring_->stop();
+}
+
+bool raw_transport::filter(const icmp_filter& filter)
+{
+	bool attached = packet_ring_ ? packet_ring_->filter(filter) : filter.attach(receive_socket_->native_handle());
+	if(!attached)
+		std::cerr << "Cannot attach the ICMP socket filter, unrelated replies are dropped in userspace" << std::endl;
+	return attached;
+}
+
+void raw_transport::wait_writable(int error)
+{
+	waiting_ = true;
+	if(error == ENOBUFS)
+	{
+		// the socket stays writable while the device queue is full, waiting for that would spin
+		backoff_timer_.expires_after(backoff_);
+		backoff_timer_.async_wait(boost::bind(&raw_transport::handle_writable, this, boost::placeholders::_1));
+		backoff_ = std::min(backoff_ * 2, max_backoff);
+	}
+	else
+		raw_socket_.async_wait(raw::socket::wait_write, boost::bind(&raw_transport::handle_writable, this, boost::placeholders::_1));
+}
+
+void raw_transport::handle_writable(const boost::system::error_code& error)
+{
+	waiting_ = false;
+	if(error)
+		return;
+
+	while(!backlog_.empty())
+	{
+		const std::vector<uint8_t>& datagram = backlog_.front();
+		raw::endpoint destination = destination_of(&datagram[0]);
+		ssize_t result = ::sendto(raw_socket_.native_handle(), &datagram[0], datagram.size(), MSG_DONTWAIT, destination.data(), static_cast<socklen_t>(destination.size()));
+		if(result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS))
+		{
+			wait_writable(errno);
+			return;
+		}
+		if(result >= 0)
+			backoff_ = min_backoff;
+		// a refused datagram is dropped like a failed send
+		backlog_.pop_front();
+	}
+}
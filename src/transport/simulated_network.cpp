@@ -0,0 +1,283 @@
+#include <simulated_network.h>
+
+#include <algorithm>
+#include <checksum.hpp>
+#include <icmp_header.hpp>
+#include <ipv4_header.hpp>
+#include <boost/bind/bind.hpp>
+
+namespace
+{
+	const uint32_t none = 0xFFFFFFFF;
+	const std::size_t batch_size = 64;
+	// batches delivered in a row before other handlers get their turn
+	const std::size_t batches_per_wakeup = 64;
+	// as much of the offending datagram as fits into 576 bytes is quoted, like Linux does
+	const std::size_t quote_limit = 576 - 20 - 8;
+}
+
+simulated_network::simulated_network(boost::asio::io_context& io_context, const std::vector<hop>& routers, const hop& destination, uint64_t seed, uint64_t bandwidth) :
+	timer_(io_context),
+	armed_(false),
+	running_(false),
+	bandwidth_(bandwidth == 0 ? 1 : bandwidth),
+	random_(seed),
+	uniform_(0.0, 1.0),
+	lost_(0),
+	limited_(0)
+{
+	std::vector<hop> hops(routers);
+	hops.push_back(destination);
+
+	boost::asio::chrono::steady_clock::duration one_way = boost::asio::chrono::steady_clock::duration::zero();
+	responders_.resize(hops.size());
+	for(std::size_t i = 0; i < hops.size(); ++i)
+	{
+		one_way += hops[i].delay;
+		responders_[i].link = hops[i];
+		responders_[i].round_trip = one_way * 2;
+		responders_[i].tokens = hops[i].burst;
+		responders_[i].refilled = clock_;
+	}
+	batch_.reserve(batch_size);
+	batch_slots_.reserve(batch_size);
+}
+
+boost::asio::ip::address_v4 simulated_network::router_address(uint16_t ttl)
+{
+	return boost::asio::ip::address_v4((100u << 24) | (64u << 16) | ttl);
+}
+
+bool simulated_network::send(const uint8_t* data, std::size_t length)
+{
+	ipv4_header_view ip(data, length);
+	if(!ip.valid() || ip.time_to_live() == 0)
+		return false;
+
+	std::size_t routers = responders_.size() - 1;
+	std::size_t index = std::min<std::size_t>(ip.time_to_live(), routers + 1) - 1;
+	responder& target = responders_[index];
+	boost::asio::chrono::steady_clock::time_point now = boost::asio::chrono::steady_clock::now();
+	// the datagram is on the wire of the sender before anyone sees it
+	clock_ += boost::asio::chrono::duration_cast<boost::asio::chrono::steady_clock::duration>(boost::asio::chrono::nanoseconds(length * 8 * 1000000000 / bandwidth_));
+
+	// out through every hop up to the one that answers
+	for(std::size_t i = 0; i <= index; ++i)
+	{
+		if(lose(responders_[i].link))
+		{
+			++lost_;
+			return true;
+		}
+	}
+	if(!allow(target, clock_))
+	{
+		++limited_;
+		return true;
+	}
+	// and the reply back through the links in front of it
+	for(std::size_t i = index + 1; i > 0; --i)
+	{
+		if(lose(responders_[i - 1].link))
+		{
+			++lost_;
+			return true;
+		}
+	}
+
+	uint32_t slot = answer(data, length, index, index < routers ? router_address(static_cast<uint16_t>(index + 1)) : ip.destination_address());
+	if(slot == none)
+		return true;
+
+	reply pending = { now + target.round_trip, clock_ + target.round_trip, slot };
+	target.replies.push_back(pending);
+	if(running_ && (!armed_ || pending.due < armed_at_))
+	{
+		armed_ = true;
+		armed_at_ = pending.due;
+		timer_.expires_at(armed_at_);
+		timer_.async_wait(boost::bind(&simulated_network::handle_timer, this, boost::placeholders::_1));
+	}
+	return true;
+}
+
+void simulated_network::start(receive_handler handler)
+{
+	handler_ = handler;
+	running_ = true;
+	schedule();
+}
+
+void simulated_network::stop()
+{
+	running_ = false;
+	armed_ = false;
+	timer_.cancel();
+}
+
+bool simulated_network::lose(const hop& link)
+{
+	return link.loss > 0 && uniform_(random_) < link.loss;
+}
+
+bool simulated_network::allow(responder& target, boost::asio::chrono::steady_clock::time_point now)
+{
+	if(target.link.rate == 0)
+		return true;
+
+	target.tokens = std::min<double>(target.link.burst, target.tokens + boost::asio::chrono::duration<double>(now - target.refilled).count() * target.link.rate);
+	target.refilled = now;
+	if(target.tokens < 1)
+		return false;
+	target.tokens -= 1;
+	return true;
+}
+
+uint32_t simulated_network::answer(const uint8_t* data, std::size_t length, std::size_t distance, const boost::asio::ip::address_v4& from)
+{
+	ipv4_header_view ip(data, length);
+	uint8_t type = icmp_header::time_exceeded;
+	uint8_t code = 0;
+	const uint8_t* body = data;
+	std::size_t body_length = std::min(length, quote_limit);
+
+	if(distance == responders_.size() - 1)
+	{
+		if(ip.protocol() == ipv4_header::protocol::udp)
+		{
+			type = icmp_header::destination_unreachable;
+			code = 3;
+		}
+		else if(ip.protocol() == ipv4_header::protocol::icmp)
+		{
+			icmp_header_view request(ip.payload(), ip.payload_length());
+			if(!request.valid() || request.type() != icmp_header::echo_request)
+				return none;
+			// the echo reply carries identifier, sequence number and data of the request
+			type = icmp_header::echo_reply;
+			body = request.data() + 4;
+			body_length = request.size() + request.payload_length() - 4;
+		}
+		else
+			return none;
+	}
+
+	std::size_t reply_length = 20 + 4 + (type == icmp_header::echo_reply ? 0 : 4) + body_length;
+	uint32_t slot = allocate(reply_length);
+	uint8_t* reply = &slots_[slot][0];
+
+	uint32_t source = from.to_uint();
+	uint32_t destination = ip.source_address().to_uint();
+	const uint8_t header[20] = {
+		0x45, 0, static_cast<uint8_t>(reply_length >> 8), static_cast<uint8_t>(reply_length),
+		0, 0, 0, 0,
+		static_cast<uint8_t>(64 - std::min<std::size_t>(distance, 63)), ipv4_header::protocol::icmp, 0, 0,
+		static_cast<uint8_t>(source >> 24), static_cast<uint8_t>(source >> 16), static_cast<uint8_t>(source >> 8), static_cast<uint8_t>(source),
+		static_cast<uint8_t>(destination >> 24), static_cast<uint8_t>(destination >> 16), static_cast<uint8_t>(destination >> 8), static_cast<uint8_t>(destination)
+	};
+	std::copy(header, header + 20, reply);
+	uint16_t checksum = internet_checksum(reply, 20);
+	reply[10] = static_cast<uint8_t>(checksum >> 8);
+	reply[11] = static_cast<uint8_t>(checksum);
+
+	uint8_t* icmp = reply + 20;
+	icmp[0] = type;
+	icmp[1] = code;
+	icmp[2] = 0;
+	icmp[3] = 0;
+	uint8_t* rest = icmp + 4;
+	if(type != icmp_header::echo_reply)
+	{
+		// unused word of error messages
+		std::fill(rest, rest + 4, 0);
+		rest += 4;
+	}
+	std::copy(body, body + body_length, rest);
+	checksum = internet_checksum(icmp, reply_length - 20);
+	icmp[2] = static_cast<uint8_t>(checksum >> 8);
+	icmp[3] = static_cast<uint8_t>(checksum);
+	return slot;
+}
+
+uint32_t simulated_network::allocate(std::size_t length)
+{
+	uint32_t slot;
+	if(free_slots_.empty())
+	{
+		slot = static_cast<uint32_t>(slots_.size());
+		slots_.push_back(std::vector<uint8_t>());
+	}
+	else
+	{
+		slot = free_slots_.back();
+		free_slots_.pop_back();
+	}
+	// the slot keeps its capacity when it is reused
+	slots_[slot].resize(length);
+	return slot;
+}
+
+void simulated_network::schedule()
+{
+	if(!running_)
+		return;
+
+	bool found = false;
+	boost::asio::chrono::steady_clock::time_point due;
+	for(std::size_t i = 0; i < responders_.size(); ++i)
+	{
+		if(!responders_[i].replies.empty() && (!found || responders_[i].replies.front().due < due))
+		{
+			due = responders_[i].replies.front().due;
+			found = true;
+		}
+	}
+	if(!found || (armed_ && armed_at_ <= due))
+		return;
+
+	armed_ = true;
+	armed_at_ = due;
+	timer_.expires_at(armed_at_);
+	timer_.async_wait(boost::bind(&simulated_network::handle_timer, this, boost::placeholders::_1));
+}
+
+void simulated_network::handle_timer(const boost::system::error_code& error)
+{
+	// a wait cancelled by an earlier deadline, the new wait is pending already
+	if(error)
+		return;
+	armed_ = false;
+
+	boost::asio::chrono::steady_clock::time_point now = boost::asio::chrono::steady_clock::now();
+	for(std::size_t round = 0; round < batches_per_wakeup && running_; ++round)
+	{
+		batch_.clear();
+		batch_slots_.clear();
+		while(batch_.size() < batch_size)
+		{
+			// the earliest reply of all responders, each of them has its replies in order
+			responder* next = 0;
+			for(std::size_t i = 0; i < responders_.size(); ++i)
+			{
+				if(!responders_[i].replies.empty() && responders_[i].replies.front().due <= now && (next == 0 || responders_[i].replies.front().due < next->replies.front().due))
+					next = &responders_[i];
+			}
+			if(next == 0)
+				break;
+
+			const reply& due = next->replies.front();
+			received_datagram datagram = { &slots_[due.slot][0], slots_[due.slot].size(), due.due };
+			// whatever the receiver sends next, it sends after this reply arrived
+			clock_ = std::max(clock_, due.simulated);
+			batch_.push_back(datagram);
+			batch_slots_.push_back(due.slot);
+			next->replies.pop_front();
+		}
+		if(batch_.empty())
+			break;
+
+		handler_(&batch_[0], batch_.size());
+		free_slots_.insert(free_slots_.end(), batch_slots_.begin(), batch_slots_.end());
+	}
+	schedule();
+}
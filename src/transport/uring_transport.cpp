@@ -0,0 +1,436 @@
+#include <uring_transport.h>
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <boost/bind/bind.hpp>
+
+namespace
+{
+	// completions of sends carry their slot, the others one of these
+	const uint64_t receive_tag = 1ull << 62;
+	const uint64_t flush_tag = 2ull << 62;
+
+	const uint16_t buffer_group = 0;
+	const std::size_t receive_buffers = 1024;
+	const std::size_t receive_buffer_size = 2048;
+	// receives kept in flight when the kernel has no multishot receive
+	const std::size_t single_receives = 64;
+
+	int io_uring_setup(unsigned entries, io_uring_params* params)
+	{
+		return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+	}
+
+	int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+	{
+		return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, 0, 0));
+	}
+
+	int io_uring_register(int fd, unsigned opcode, void* argument, unsigned count)
+	{
+		return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, argument, count));
+	}
+
+	void* map_ring(std::size_t length, int fd, off_t offset)
+	{
+		void* mapped = ::mmap(0, length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+		if(mapped == MAP_FAILED)
+			throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()), "Cannot map the io_uring");
+		return mapped;
+	}
+}
+
+uring_transport::uring_transport(boost::asio::io_context& io_context, uint16_t batch_size, uint32_t flush_deadline, std::size_t packet_size, int receive_buffer) :
+	raw_socket_(io_context, raw::endpoint(raw::v4(), 0)),
+	receive_socket_(io_context, boost::asio::ip::icmp::v4()),
+	completions_(io_context),
+	ring_fd_(-1),
+	sq_ring_(0),
+	sq_ring_size_(0),
+	cq_ring_(0),
+	cq_ring_size_(0),
+	entries_(0),
+	unsubmitted_(0),
+	packet_size_(packet_size),
+	batch_size_(std::max<uint16_t>(1, batch_size)),
+	queued_(0),
+	flush_armed_(false),
+	buffer_ring_(0),
+	buffer_ring_size_(0),
+	receives_(0),
+	multishot_(true),
+	receive_failed_(false),
+	running_(false),
+	dropped_(0)
+{
+	if(receive_buffer > 0)
+		receive_socket_.set_option(boost::asio::socket_base::receive_buffer_size(receive_buffer));
+
+	// room for two batches in flight, the completion queue for those and a reply in every receive buffer
+	unsigned entries = 256;
+	while(entries < 2 * batch_size_ && entries < 32768)
+		entries *= 2;
+	std::memset(&params_, 0, sizeof(params_));
+	params_.flags = IORING_SETUP_CQSIZE;
+	params_.cq_entries = static_cast<unsigned>(entries + receive_buffers);
+	ring_fd_ = io_uring_setup(entries, &params_);
+	if(ring_fd_ < 0)
+		throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()), "Cannot set up an io_uring");
+
+	try
+	{
+		sq_ring_size_ = params_.sq_off.array + params_.sq_entries * sizeof(unsigned);
+		cq_ring_size_ = params_.cq_off.cqes + params_.cq_entries * sizeof(io_uring_cqe);
+		// newer kernels map both rings in one go
+		if(params_.features & IORING_FEAT_SINGLE_MMAP)
+			sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+		sq_ring_ = static_cast<uint8_t*>(map_ring(sq_ring_size_, ring_fd_, IORING_OFF_SQ_RING));
+		cq_ring_ = params_.features & IORING_FEAT_SINGLE_MMAP ? sq_ring_ : static_cast<uint8_t*>(map_ring(cq_ring_size_, ring_fd_, IORING_OFF_CQ_RING));
+		entries_ = static_cast<io_uring_sqe*>(map_ring(params_.sq_entries * sizeof(io_uring_sqe), ring_fd_, IORING_OFF_SQES));
+
+		sq_head_ = reinterpret_cast<unsigned*>(sq_ring_ + params_.sq_off.head);
+		sq_tail_ = reinterpret_cast<unsigned*>(sq_ring_ + params_.sq_off.tail);
+		sq_mask_ = reinterpret_cast<unsigned*>(sq_ring_ + params_.sq_off.ring_mask);
+		sq_array_ = reinterpret_cast<unsigned*>(sq_ring_ + params_.sq_off.array);
+		sq_flags_ = reinterpret_cast<unsigned*>(sq_ring_ + params_.sq_off.flags);
+		cq_head_ = reinterpret_cast<unsigned*>(cq_ring_ + params_.cq_off.head);
+		cq_tail_ = reinterpret_cast<unsigned*>(cq_ring_ + params_.cq_off.tail);
+		cq_mask_ = reinterpret_cast<unsigned*>(cq_ring_ + params_.cq_off.ring_mask);
+		cqes_ = reinterpret_cast<io_uring_cqe*>(cq_ring_ + params_.cq_off.cqes);
+
+		// completions wake the io_context through an eventfd
+		int event = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if(event < 0 || io_uring_register(ring_fd_, IORING_REGISTER_EVENTFD, &event, 1) != 0)
+			throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()), "Cannot register the io_uring eventfd");
+		completions_.assign(event);
+
+		// the buffer ring has to be page aligned, an anonymous mapping is
+		buffer_ring_size_ = receive_buffers * sizeof(io_uring_buf);
+		void* buffers = ::mmap(0, buffer_ring_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(buffers == MAP_FAILED)
+			throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()), "Cannot map the io_uring buffer ring");
+		buffer_ring_ = static_cast<io_uring_buf_ring*>(buffers);
+		io_uring_buf_reg registration;
+		std::memset(&registration, 0, sizeof(registration));
+		registration.ring_addr = reinterpret_cast<uint64_t>(buffer_ring_);
+		registration.ring_entries = static_cast<uint32_t>(receive_buffers);
+		registration.bgid = buffer_group;
+		if(io_uring_register(ring_fd_, IORING_REGISTER_PBUF_RING, &registration, 1) != 0)
+			throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()), "Cannot register the io_uring buffer ring, it needs Linux 5.19");
+	}
+	catch(...)
+	{
+		// the destructor does not run for a transport that throws, the sockets close themselves
+		release();
+		throw;
+	}
+
+	receive_storage_.resize(receive_buffers * receive_buffer_size);
+	for(std::size_t buffer = 0; buffer < receive_buffers; ++buffer)
+		used_buffers_.push_back(static_cast<uint16_t>(buffer));
+	recycle();
+	datagrams_.reserve(receive_buffers);
+	arrived_.reserve(receive_buffers);
+
+	// every submission queue entry may hold a send
+	std::size_t slots = params_.sq_entries;
+	send_storage_.resize(slots * packet_size_);
+	send_addresses_.resize(slots);
+	send_iovecs_.resize(slots);
+	send_messages_.resize(slots);
+	for(std::size_t slot = slots; slot > 0; --slot)
+		free_slots_.push_back(static_cast<uint16_t>(slot - 1));
+
+	flush_deadline_.tv_sec = flush_deadline / 1000000;
+	flush_deadline_.tv_nsec = static_cast<long long>(flush_deadline % 1000000) * 1000;
+}
+
+uring_transport::~uring_transport()
+{
+	release();
+}
+
+void uring_transport::release()
+{
+	if(buffer_ring_)
+		::munmap(buffer_ring_, buffer_ring_size_);
+	if(entries_)
+		::munmap(entries_, params_.sq_entries * sizeof(io_uring_sqe));
+	if(cq_ring_ && cq_ring_ != sq_ring_)
+		::munmap(cq_ring_, cq_ring_size_);
+	if(sq_ring_)
+		::munmap(sq_ring_, sq_ring_size_);
+	if(ring_fd_ >= 0)
+		::close(ring_fd_);
+	buffer_ring_ = 0;
+	entries_ = 0;
+	cq_ring_ = 0;
+	sq_ring_ = 0;
+	ring_fd_ = -1;
+}
+
+bool uring_transport::send(const uint8_t* data, std::size_t length)
+{
+	if(free_slots_.empty())
+	{
+		// the slots come back with the completions of their sends, the ones already posted are taken without waiting
+		submit();
+		collect();
+	}
+	if(length < 20 || length > packet_size_ || free_slots_.empty())
+	{
+		++dropped_;
+		return false;
+	}
+
+	// a partial batch goes out once its flush timeout completes, the timeout is submitted on its own
+	if(queued_ == 0 && batch_size_ > 1 && !flush_armed_)
+		arm_flush_timeout();
+
+	io_uring_sqe* entry = next_entry();
+	if(!entry)
+	{
+		submit();
+		entry = next_entry();
+		if(!entry)
+		{
+			++dropped_;
+			return false;
+		}
+	}
+
+	uint16_t slot = free_slots_.back();
+	free_slots_.pop_back();
+	uint8_t* buffer = &send_storage_[slot * packet_size_];
+	std::memcpy(buffer, data, length);
+	// the destination address is bytes 16 to 19 of the IPv4 header
+	sockaddr_in& address = send_addresses_[slot];
+	std::memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	std::memcpy(&address.sin_addr, data + 16, sizeof(address.sin_addr));
+	send_iovecs_[slot].iov_base = buffer;
+	send_iovecs_[slot].iov_len = length;
+	msghdr& message = send_messages_[slot];
+	std::memset(&message, 0, sizeof(message));
+	message.msg_name = &address;
+	message.msg_namelen = sizeof(address);
+	message.msg_iov = &send_iovecs_[slot];
+	message.msg_iovlen = 1;
+
+	entry->opcode = IORING_OP_SENDMSG;
+	entry->fd = raw_socket_.native_handle();
+	entry->addr = reinterpret_cast<uint64_t>(&message);
+	entry->len = 1;
+	entry->user_data = slot;
+
+	if(++queued_ >= batch_size_)
+		submit();
+	return true;
+}
+
+void uring_transport::start(receive_handler handler)
+{
+	handler_ = handler;
+	running_ = true;
+	arm_receive();
+	wait_completions();
+}
+
+void uring_transport::stop()
+{
+	// what is queued still goes out, the kernel finishes it without the io_context
+	submit();
+	running_ = false;
+	completions_.cancel();
+}
+
+bool uring_transport::filter(const icmp_filter& filter)
+{
+	bool attached = filter.attach(receive_socket_.native_handle());
+	if(!attached)
+		std::cerr << "Cannot attach the ICMP socket filter, unrelated replies are dropped in userspace" << std::endl;
+	return attached;
+}
+
+io_uring_sqe* uring_transport::next_entry()
+{
+	unsigned tail = *sq_tail_;
+	if(tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= params_.sq_entries)
+		return 0;
+
+	unsigned index = tail & *sq_mask_;
+	io_uring_sqe* entry = &entries_[index];
+	std::memset(entry, 0, sizeof(*entry));
+	sq_array_[index] = index;
+	__atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+	++unsubmitted_;
+	return entry;
+}
+
+void uring_transport::submit()
+{
+	queued_ = 0;
+	while(unsubmitted_ > 0)
+	{
+		int result = io_uring_enter(ring_fd_, unsubmitted_, 0, 0);
+		if(result > 0)
+			unsubmitted_ -= static_cast<unsigned>(result);
+		else if(result < 0 && errno != EINTR)
+			// the entries stay in the queue for the next submission
+			return;
+	}
+}
+
+void uring_transport::arm_receive()
+{
+	std::size_t wanted = multishot_ ? 1 : single_receives;
+	if(receives_ >= wanted)
+		return;
+	for(; receives_ < wanted; ++receives_)
+	{
+		io_uring_sqe* entry = next_entry();
+		if(!entry)
+		{
+			submit();
+			entry = next_entry();
+			if(!entry)
+				break;
+		}
+		entry->opcode = IORING_OP_RECV;
+		entry->fd = receive_socket_.native_handle();
+		entry->flags = IOSQE_BUFFER_SELECT;
+		entry->buf_group = buffer_group;
+		entry->ioprio = multishot_ ? IORING_RECV_MULTISHOT : 0;
+		entry->user_data = receive_tag;
+	}
+	submit();
+}
+
+void uring_transport::arm_flush_timeout()
+{
+	io_uring_sqe* entry = next_entry();
+	if(!entry)
+		return;
+	entry->opcode = IORING_OP_TIMEOUT;
+	entry->addr = reinterpret_cast<uint64_t>(&flush_deadline_);
+	entry->len = 1;
+	entry->user_data = flush_tag;
+	submit();
+	flush_armed_ = true;
+}
+
+void uring_transport::wait_completions()
+{
+	completions_.async_wait(boost::asio::posix::stream_descriptor::wait_read, boost::bind(&uring_transport::handle_completions, this, boost::placeholders::_1));
+}
+
+void uring_transport::handle_completions(const boost::system::error_code& error)
+{
+	if(error || !running_)
+		return;
+
+	uint64_t count;
+	if(::read(completions_.native_handle(), &count, sizeof(count)) < 0 && errno != EAGAIN)
+		return;
+	reap();
+
+	if(running_)
+		wait_completions();
+}
+
+void uring_transport::reap()
+{
+	collect();
+
+	// replies collected by sends from within the handler wait for the next round
+	datagrams_.swap(arrived_);
+	used_buffers_.swap(arrived_buffers_);
+	if(!datagrams_.empty() && running_)
+		handler_(&datagrams_[0], datagrams_.size());
+	datagrams_.clear();
+	recycle();
+
+	if(running_ && !receive_failed_)
+		arm_receive();
+}
+
+void uring_transport::collect()
+{
+	boost::asio::chrono::steady_clock::time_point now = boost::asio::chrono::steady_clock::now();
+	bool flush = false;
+
+	unsigned head = *cq_head_;
+	unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+	for(; head != tail; ++head)
+	{
+		const io_uring_cqe& completion = cqes_[head & *cq_mask_];
+		if(completion.user_data == receive_tag)
+		{
+			if(completion.flags & IORING_CQE_F_BUFFER)
+			{
+				uint16_t buffer = static_cast<uint16_t>(completion.flags >> IORING_CQE_BUFFER_SHIFT);
+				arrived_buffers_.push_back(buffer);
+				if(completion.res > 0)
+				{
+					received_datagram datagram = { &receive_storage_[buffer * receive_buffer_size], static_cast<std::size_t>(completion.res), now };
+					arrived_.push_back(datagram);
+				}
+			}
+			// out of buffers ends the multishot receive, it is armed again once the buffers are back
+			if(completion.res < 0 && completion.res != -ENOBUFS)
+			{
+				if(multishot_ && (completion.res == -EINVAL || completion.res == -EOPNOTSUPP))
+				{
+					// kernels before 6.0 refuse the multishot flag, single receives take over
+					multishot_ = false;
+					std::cerr << "The io_uring has no multishot receive, using single receives" << std::endl;
+				}
+				else if(!receive_failed_)
+				{
+					// arming again would only fail again, on every round
+					receive_failed_ = true;
+					std::cerr << "Cannot receive through the io_uring: " << std::strerror(-completion.res) << std::endl;
+				}
+			}
+			if(!(completion.flags & IORING_CQE_F_MORE) && receives_ > 0)
+				--receives_;
+		}
+		else if(completion.user_data == flush_tag)
+		{
+			flush_armed_ = false;
+			flush = true;
+		}
+		else
+			free_slots_.push_back(static_cast<uint16_t>(completion.user_data));
+	}
+	__atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+
+	if(flush && queued_ > 0)
+		submit();
+}
+
+void uring_transport::recycle()
+{
+	if(used_buffers_.empty())
+		return;
+
+	// the ring owns tail, the kernel only reads it
+	uint16_t tail = buffer_ring_->tail;
+	uint16_t mask = static_cast<uint16_t>(receive_buffers - 1);
+	// bufs of the header is shifted by an empty struct in C++, the entries start at the ring itself
+	io_uring_buf* buffers = reinterpret_cast<io_uring_buf*>(buffer_ring_);
+	for(std::size_t i = 0; i < used_buffers_.size(); ++i)
+	{
+		io_uring_buf& buffer = buffers[(tail + i) & mask];
+		buffer.addr = reinterpret_cast<uint64_t>(&receive_storage_[used_buffers_[i] * receive_buffer_size]);
+		buffer.len = static_cast<uint32_t>(receive_buffer_size);
+		buffer.bid = used_buffers_[i];
+	}
+	__atomic_store_n(&buffer_ring_->tail, static_cast<uint16_t>(tail + used_buffers_.size()), __ATOMIC_RELEASE);
+	used_buffers_.clear();
+}
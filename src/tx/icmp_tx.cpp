@@ -1,20 +1,33 @@
 #include <icmp_tx.h>
 
 #include <istream>
+#include <algorithm>
 #include <iostream>
 #include <ostream>
 #include <icmp_header.hpp>
 #include <ipv4_header.hpp>
+#include <logger.h>
+#include <packet_template.hpp>
 #include <udp_header.hpp>
+#include <utils.hpp>
 #include <boost/bind/bind.hpp>
 
+namespace
+{
+	// bounds of the wait while the batch sender has no room
+	const boost::asio::chrono::microseconds min_backoff(50);
+	const boost::asio::chrono::microseconds max_backoff(10000);
+}
 
-icmp_tx::icmp_tx(boost::asio::io_context& io_context, const char* destination, uint8_t hops, uint32_t number_of_packets, uint32_t send_interval, uint16_t payload_size) : 
-	strand_(io_context),
-	raw_socket_(io_context, raw::endpoint(raw::v4(), 0)),
-	receive_socket_(io_context, boost::asio::ip::icmp::v4()), 
+icmp_tx::icmp_tx(boost::asio::io_context& io_context, transport* network, const boost::asio::ip::address_v4& source, const char* destination, uint8_t hops, uint32_t number_of_packets, uint32_t send_interval, uint16_t payload_size, uint16_t batch_size, uint32_t rate, uint32_t burst, uint32_t spin, uint16_t shard, uint16_t shards, tx_stats* stats, timestamping::mode stamps) : 
+	transport_(network),
+	tracker_(shard, shards, stats ? stats->add_flow() : 0, stats ? stats->late() : boost::asio::chrono::milliseconds(1000)),
 	send_timer_(io_context), 
+	backoff_(min_backoff),
 	stats_timer_(io_context),
+	stats_(stats),
+	reporter_(shard == 0),
+	finished_(false),
 	icmp_resolver_(io_context)
 {	
 	remote_end_point_ = std::string(destination);
@@ -23,135 +36,162 @@ icmp_tx::icmp_tx(boost::asio::io_context& io_context, const char* destination, u
 	send_interval_ = send_interval;
 	payload_size_ = payload_size;
 	counter_ = 0;
+	// every shard sends with its own identifier, so its socket filter keeps only its own replies
+	identifier_ = static_cast<uint16_t>(get_identifier() + shard);
+	batch_size_ = batch_size == 0 ? 1 : batch_size;
+	
+	boost::asio::ip::address_v4 destination_address = boost::asio::ip::address::from_string(remote_end_point_).to_v4();
+	const uint8_t payload[] = {0x1B, 0x1B, 0x1B, 0x1B};
+	packet_.icmp_echo(source, destination_address, identifier_, 0, payload, sizeof(payload));
+	packet_.time_to_live(ttl_);
+	
+	// kernel stamps leave the io_context scheduling delay out of the round trip times, receive stamps are up to the transport
+	send_stamps_.reset(send_stamps::open(transport_->socket(), stamps, source));
+	
+	// a packet rate replaces the millisecond interval
+	if(rate > 0)
+		pacer_.reset(new pacer(io_context, rate, burst, boost::asio::chrono::microseconds(spin)));
 }
 
-void icmp_tx::start() 
+void icmp_tx::start(bool receive) 
 {
-	receive_buffer_.consume(receive_buffer_.size());
-	receive_socket_.async_receive(receive_buffer_.prepare(65536), 
-		boost::bind(&icmp_tx::handle_receive, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+	if(receive)
+	{
+		transport_->filter(icmp_filter(icmp_filter::icmp, identifier_, identifier_));
+		transport_->start(boost::bind(&icmp_tx::handle_receive, this, boost::placeholders::_1, boost::placeholders::_2));
+		if(send_stamps_)
+			send_stamps_->start(boost::bind(&icmp_tx::handle_send_stamp, this, boost::placeholders::_1, boost::placeholders::_2));
+	}
+	
+	if(stats_)
+	{
+		stats_timer_.expires_after(stats_->interval());
+		stats_timer_.async_wait(boost::bind(&icmp_tx::handle_stats, this, boost::asio::placeholders::error));
+	}
+	
+	if(pacer_)
+	{
+		pacer_->start(boost::bind(&icmp_tx::send_paced, this, boost::placeholders::_1));
+		return;
+	}
 	
 	send_timer_.expires_after(boost::asio::chrono::milliseconds(send_interval_));
-	send_timer_.async_wait(strand_.wrap(boost::bind(&icmp_tx::send_packet, this)));	
+	send_timer_.async_wait(boost::bind(&icmp_tx::send_packet, this));	
 	
 }
 
 void icmp_tx::send_packet()
 {
-	if(--number_of_packets_to_send_ > 0) 
+	// without an interval a batching sender fills the free part of its batch on every wake-up
+	uint32_t burst = 1;
+	if(batch_size_ > 1 && send_interval_ == 0)
+		burst = std::min<uint32_t>(batch_size_ - std::min<std::size_t>(transport_->pending(), batch_size_), number_of_packets_to_send_);
+
+	number_of_packets_to_send_ -= burst;
+	if(number_of_packets_to_send_ > 0) 
 	{
-		send_timer_.expires_after(boost::asio::chrono::milliseconds(send_interval_));
-		send_timer_.async_wait(strand_.wrap(boost::bind(&icmp_tx::send_packet, this)));
+		if(burst > 0)
+		{
+			backoff_ = min_backoff;
+			send_timer_.expires_after(boost::asio::chrono::milliseconds(send_interval_));
+		}
+		else
+		{
+			// the batch is full until the socket drains, a zero interval would spin until then
+			send_timer_.expires_after(backoff_);
+			backoff_ = std::min(backoff_ * 2, max_backoff);
+		}
+		send_timer_.async_wait(boost::bind(&icmp_tx::send_packet, this));
 	}
-	std::cout << "sendigna packet " << std::endl;
-	icmp_header icmp;
-	icmp.type(icmp_header::echo_request);
-	icmp.code(0);
-	identifier_ = 1;
-	icmp.identifier(identifier_);
-	sequence_number_ = 1;
-	icmp.sequence_number(sequence_number_);
-	std::string body = "";
-	std::vector<uint8_t> p{0x1B, 0x1B, 0x1B, 0x1B};
-	//icmp.calculate_checksum(body.begin(), body.end());
-	icmp.calculate_checksum(p.begin(), p.end());
-	ipv4_header ip;
-	ip.version(4);
-	ip.header_length(ip.size() / 4);
-	ip.type_of_service(0);
-	ip.total_length(ip.size() + icmp.size() + 4);
-	ip.identification(0);
-	ip.dont_fragment(false);
-	ip.more_fragments(false);
-	ip.fragment_offset(0);
-	ip.time_to_live(ttl_);
-	// change to get available IPv4 Endpoint !!!
-	ip.source_address(boost::asio::ip::address::from_string("192.168.178.35").to_v4());
-	ip.destination_address(boost::asio::ip::address::from_string(remote_end_point_).to_v4());
-	ip.protocol(ipv4_header::protocol::icmp);	
-	ip.calculate_checksum();
-
-	boost::array<boost::asio::const_buffer, 3> buffers = {{
-		boost::asio::buffer(ip.data()),
-		boost::asio::buffer(icmp.data()),
-		boost::asio::buffer(p)
-	}};
-	
-	raw_socket_.async_send_to(buffers, 
-		raw::endpoint(boost::asio::ip::address::from_string(remote_end_point_), 0),
-		boost::bind(&icmp_tx::handle_send, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+	log_trace("sending {} packets", burst);
+	
+	transmit(burst);
 	//timestamp_ = boost::asio::steady_timer::clock_type::now();
 }
 		
 
-void icmp_tx::handle_send(const boost::system::error_code& error, std::size_t bytes_transferred) 
+uint32_t icmp_tx::send_paced(uint32_t allowance)
 {
-	std::cout << "packet send" << std::endl;
+	uint32_t count = std::min(allowance, number_of_packets_to_send_);
+	if(batch_size_ > 1)
+		count = std::min<uint32_t>(count, batch_size_ - std::min<std::size_t>(transport_->pending(), batch_size_));
+	
+	number_of_packets_to_send_ -= count;
+	if(number_of_packets_to_send_ == 0)
+		pacer_->stop();
+	
+	transmit(count);
+	return count;
+}
+
+void icmp_tx::transmit(uint32_t count)
+{
+	for(uint32_t i = 0; i < count; ++i)
+	{
+		// echo replies carry the sequence number, time exceeded messages quote it, the identification is unique as well
+		uint16_t sequence_number = tracker_.next(boost::asio::chrono::steady_clock::now(), packet_.size());
+		packet_.sequence_number(sequence_number);
+		packet_.identification(sequence_number);
+		if(!transport_->send(packet_.data(), packet_.size()))
+			log_trace("packet {} dropped", sequence_number);
+	}
 }
 
+void icmp_tx::handle_receive(const received_datagram* datagrams, std::size_t count)
+{
+	// stamps of the packets answered in this batch may still wait in the error queue
+	if(send_stamps_)
+		send_stamps_->read();
+	
+	for(std::size_t i = 0; i < count; ++i)
+		handle_reply(datagrams[i].data, datagrams[i].length, datagrams[i].received_at);
+}
 		
-void icmp_tx::handle_receive(const boost::system::error_code& error, std::size_t length) 
+void icmp_tx::handle_reply(const uint8_t* data, std::size_t length, boost::asio::chrono::steady_clock::time_point now) 
 {
-	std::cout << "=========================" << ++counter_<< std::endl;
+	log_trace("packet received {}, {} bytes", ++counter_, length);
 	
-	ipv4_header received_ipv4_header_1, received_ipv4_header_2;
-	icmp_header received_icmp_header_1, received_icmp_header_2;
-	icmp_payload received_icmp_playload;
-	receive_buffer_.commit(length);
-	debug(receive_buffer_, length);
+	// debug(data, length);
 	
-
-	std::istream is(&receive_buffer_);
+	ipv4_header_view received_ipv4_header_1(data, length);
+	ipv4_header_view received_ipv4_header_2;
+	icmp_header_view received_icmp_header_1, received_icmp_header_2;
 	
-	receive_socket_.async_receive(receive_buffer_.prepare(65536), 
-		boost::bind(&icmp_tx::handle_receive, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
-		
-	is >> received_ipv4_header_1;
-	if(received_ipv4_header_1.protocol() == ipv4_header::protocol::icmp) 
+	if(received_ipv4_header_1.valid() && received_ipv4_header_1.protocol() == ipv4_header::protocol::icmp) 
 	{
-		is >> received_icmp_header_1;
-		if(received_icmp_header_1.type() == icmp_header::icmp_type::time_exceeded) 
-		{
-			is >> received_ipv4_header_2 >> received_icmp_header_2;
-		}
-		// TODO -> fix this for the time exceeded case ...
-		uint16_t icmp_payload_size = received_ipv4_header_1.total_length() - received_ipv4_header_1.header_length() * 4 - received_icmp_header_1.size();
-		if(icmp_payload_size)
+		received_icmp_header_1 = icmp_header_view(received_ipv4_header_1.payload(), received_ipv4_header_1.payload_length());
+		if(received_icmp_header_1.valid() && received_icmp_header_1.type() == icmp_header::icmp_type::time_exceeded) 
 		{
-			received_icmp_playload.length(icmp_payload_size);
-			is >> received_icmp_playload;
+			received_ipv4_header_2 = ipv4_header_view(received_icmp_header_1.payload(), received_icmp_header_1.payload_length());
+			if(received_ipv4_header_2.valid())
+				received_icmp_header_2 = icmp_header_view(received_ipv4_header_2.payload(), received_ipv4_header_2.payload_length());
 		}
 	}
-
-	std::cout << "ip2header version:; " << +received_ipv4_header_2.version() << std::endl;
-	std::cout << "icmp header type:; " << +received_icmp_header_1.type() << std::endl;
-	std::cout << "icmp header identifier 1&2 ; " << received_icmp_header_1.identifier() << " " << identifier_ << std::endl;
-	std::cout << "icmp header sequence 1&2 ; " << received_icmp_header_1.sequence_number() << " " << sequence_number_ << std::endl;
-	std::cout << "=========================" << ++counter_<< std::endl;
-
-
+	
+	if(received_icmp_header_1.valid())
+		log_trace("ip2header version {}, icmp type {}, identifier {}/{}, sequence {}", received_ipv4_header_2.valid() ? received_ipv4_header_2.version() : 0, received_icmp_header_1.type(), received_icmp_header_1.identifier(), identifier_, received_icmp_header_1.sequence_number());
 			
-	if (is && ((received_icmp_header_1.type() == icmp_header::icmp_type::time_exceeded && received_icmp_header_2.identifier() == identifier_ && received_icmp_header_2.sequence_number() == sequence_number_) || (received_ipv4_header_2.version() == 0 && received_icmp_header_1.type() == icmp_header::icmp_type::echo_reply && received_icmp_header_1.identifier() == identifier_ && received_icmp_header_1.sequence_number() == sequence_number_))) 
+	icmp_header_view* probe = 0;
+	if(received_icmp_header_1.valid() && received_icmp_header_1.type() == icmp_header::icmp_type::time_exceeded && received_icmp_header_2.valid())
+		probe = &received_icmp_header_2;
+	else if(received_icmp_header_1.valid() && received_icmp_header_1.type() == icmp_header::icmp_type::echo_reply)
+		probe = &received_icmp_header_1;
+	
+	boost::asio::chrono::steady_clock::duration elapsed;
+	if(probe && probe->identifier() == identifier_ && tracker_.reply(probe->sequence_number(), now, elapsed)) 
 	{
-		boost::asio::chrono::steady_clock::time_point now = boost::asio::chrono::steady_clock::now();
-		boost::asio::chrono::steady_clock::duration elapsed = now - timestamp_;
-		std::cout << +ttl_ << ": " 
-			<< received_ipv4_header_1.source_address().to_string()
-			<< ", time = "
-			<< boost::asio::chrono::duration_cast<boost::asio::chrono::milliseconds>(elapsed).count()
-			<< std::endl;
+		log_debug("{}: {}, time = {}", ttl_, received_ipv4_header_1.source_address(), boost::asio::chrono::duration_cast<boost::asio::chrono::milliseconds>(elapsed).count());
 	}
-	
 }
 		
 
-void icmp_tx::debug(const boost::asio::streambuf& buffer, std::size_t length)
+void icmp_tx::debug(const uint8_t* data, std::size_t length)
 {
 	std::cout << "========================================================================================" << std::endl;
 	std::cout << "Packet received ..." << std::endl;
 	boost::asio::streambuf copy, copy1;
-	buffer_copy(copy.prepare(length), buffer.data());
-	buffer_copy(copy1.prepare(length), buffer.data());
+	buffer_copy(copy.prepare(length), boost::asio::buffer(data, length));
+	buffer_copy(copy1.prepare(length), boost::asio::buffer(data, length));
 	copy.commit(length);
 	copy1.commit(length);
 	std::istream is(&copy);
@@ -175,3 +215,41 @@ void icmp_tx::debug(const boost::asio::streambuf& buffer, std::size_t length)
 	std::cout << "=====" << std::endl;
 	// to be deleted end
 }
+
+void icmp_tx::handle_send_stamp(const ipv4_header_view& sent, boost::asio::chrono::steady_clock::time_point sent_at)
+{
+	icmp_header_view icmp(sent.payload(), sent.payload_length());
+	if(sent.protocol() == ipv4_header::protocol::icmp && icmp.valid() && icmp.type() == icmp_header::echo_request && icmp.identifier() == identifier_)
+		tracker_.restamp(icmp.sequence_number(), sent_at);
+}
+
+void icmp_tx::handle_stats(const boost::system::error_code& error)
+{
+	if(error)
+		return;
+	
+	tracker_.expire(boost::asio::chrono::steady_clock::now());
+	if(!finished_ && number_of_packets_to_send_ == 0 && tracker_.idle())
+	{
+		// every packet got its reply or was given up on, nothing is left to wait for
+		finished_ = true;
+		transport_->stop();
+		if(send_stamps_)
+			send_stamps_->stop();
+		stats_->finish_flow();
+	}
+	
+	// the first flow reports for all of them until the last one is done
+	if(reporter_)
+	{
+		bool done = stats_->finished();
+		stats_->report(std::cout, done);
+		if(done)
+			return;
+	}
+	else if(finished_)
+		return;
+	
+	stats_timer_.expires_after(stats_->interval());
+	stats_timer_.async_wait(boost::bind(&icmp_tx::handle_stats, this, boost::asio::placeholders::error));
+}
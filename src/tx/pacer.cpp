@@ -0,0 +1,74 @@
+#include <pacer.h>
+
+#include <algorithm>
+#include <boost/bind/bind.hpp>
+
+pacer::pacer(boost::asio::io_context& io_context, uint32_t rate, uint32_t burst, boost::asio::chrono::microseconds spin) :
+	timer_(io_context)
+{
+	rate_ = std::max<uint32_t>(1, rate);
+	burst_ = std::max<uint32_t>(1, burst);
+	spin_ = spin;
+	sent_ = 0;
+	running_ = false;
+}
+
+void pacer::start(const handler_type& handler)
+{
+	handler_ = handler;
+	running_ = true;
+	sent_ = 0;
+	start_ = boost::asio::chrono::steady_clock::now();
+	schedule(start_);
+}
+
+void pacer::stop()
+{
+	running_ = false;
+	timer_.cancel();
+}
+
+void pacer::schedule(boost::asio::chrono::steady_clock::time_point next)
+{
+	next_ = next;
+	timer_.expires_at(next_ - spin_);
+	timer_.async_wait(boost::bind(&pacer::handle_timer, this, boost::placeholders::_1));
+}
+
+void pacer::handle_timer(const boost::system::error_code& error)
+{
+	if(error || !running_)
+		return;
+	
+	boost::asio::chrono::steady_clock::time_point now = boost::asio::chrono::steady_clock::now();
+	while(now < next_)
+		now = boost::asio::chrono::steady_clock::now();
+	
+	// the first packet is due at the start, one more every 1 / rate seconds
+	uint64_t due = static_cast<uint64_t>(boost::asio::chrono::duration<double>(now - start_).count() * rate_) + 1;
+	if(due - sent_ > burst_)
+	{
+		// the bucket holds no more than burst tokens, credit beyond that is lost
+		sent_ = due - burst_;
+	}
+	
+	uint32_t allowance = static_cast<uint32_t>(due - sent_);
+	uint32_t sent = handler_(allowance);
+	sent_ += sent;
+	
+	if(!running_)
+		return;
+	
+	boost::asio::chrono::steady_clock::time_point next = due_at(sent_);
+	if(sent < allowance)
+	{
+		// the sender could not take everything, try again one gap later instead of spinning on it
+		next = std::max(next, now + boost::asio::chrono::duration_cast<boost::asio::chrono::steady_clock::duration>(boost::asio::chrono::duration<double>(1.0 / rate_)));
+	}
+	schedule(next);
+}
+
+boost::asio::chrono::steady_clock::time_point pacer::due_at(uint64_t packets) const
+{
+	return start_ + boost::asio::chrono::duration_cast<boost::asio::chrono::steady_clock::duration>(boost::asio::chrono::duration<double>(packets / rate_));
+}
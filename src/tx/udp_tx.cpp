@@ -1,137 +1,210 @@
 #include <udp_tx.h>
 
 #include <istream>
+#include <algorithm>
 #include <iostream>
 #include <ostream>
 #include <icmp_header.hpp>
 #include <ipv4_header.hpp>
+#include <logger.h>
+#include <packet_template.hpp>
 #include <udp_header.hpp>
 #include <boost/bind/bind.hpp>
 
+namespace
+{
+	// bounds of the wait while the batch sender has no room
+	const boost::asio::chrono::microseconds min_backoff(50);
+	const boost::asio::chrono::microseconds max_backoff(10000);
+}
 
-udp_tx::udp_tx(boost::asio::io_context& io_context, const char* destination, uint16_t port, uint8_t hops, uint32_t number_of_packets, uint32_t send_interval, uint16_t payload_size) : 
-	strand_(io_context),
-	raw_socket_(io_context, raw::endpoint(raw::v4(), 12345)),
-	receive_socket_(io_context, boost::asio::ip::icmp::v4()), 
+udp_tx::udp_tx(boost::asio::io_context& io_context, transport* network, const boost::asio::ip::address_v4& source, const char* destination, uint16_t port, uint8_t hops, uint32_t number_of_packets, uint32_t send_interval, uint16_t payload_size, uint16_t batch_size, uint32_t rate, uint32_t burst, uint32_t spin, uint16_t shard, uint16_t shards, tx_stats* stats, timestamping::mode stamps) : 
+	transport_(network),
+	tracker_(shard, shards, stats ? stats->add_flow() : 0, stats ? stats->late() : boost::asio::chrono::milliseconds(1000)),
 	send_timer_(io_context), 
-	stats_timer_(io_context) 
+	backoff_(min_backoff),
+	stats_timer_(io_context),
+	stats_(stats),
+	reporter_(shard == 0),
+	finished_(false)
 {	
 	remote_end_point_ = std::string(destination);
 	remote_end_point_port_ = port;
+	source_port_ = static_cast<uint16_t>(12345 + shard);
 	ttl_ = hops == 0 ? 255 : hops;
 	number_of_packets_to_send_ = number_of_packets; 
 	send_interval_ = send_interval;
 	payload_size_ = payload_size;
+	batch_size_ = batch_size == 0 ? 1 : batch_size;
+	
+	boost::asio::ip::address_v4 destination_address = boost::asio::ip::address::from_string(remote_end_point_).to_v4();
+	packet_.udp(source, destination_address, source_port_, remote_end_point_port_, 0, payload_size_);
+	packet_.time_to_live(ttl_);
+	
+	// kernel stamps leave the io_context scheduling delay out of the round trip times, receive stamps are up to the transport
+	send_stamps_.reset(send_stamps::open(transport_->socket(), stamps, source));
+	
+	// a packet rate replaces the millisecond interval
+	if(rate > 0)
+		pacer_.reset(new pacer(io_context, rate, burst, boost::asio::chrono::microseconds(spin)));
 }
 
-void udp_tx::start() 
+void udp_tx::start(bool receive) 
 {
-	receive_buffer_.consume(receive_buffer_.size());
-	receive_socket_.async_receive(receive_buffer_.prepare(65536), 
-		boost::bind(&udp_tx::handle_receive, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+	if(receive)
+	{
+		transport_->filter(icmp_filter(icmp_filter::udp, source_port_, source_port_));
+		transport_->start(boost::bind(&udp_tx::handle_receive, this, boost::placeholders::_1, boost::placeholders::_2));
+		if(send_stamps_)
+			send_stamps_->start(boost::bind(&udp_tx::handle_send_stamp, this, boost::placeholders::_1, boost::placeholders::_2));
+	}
+	
+	if(stats_)
+	{
+		stats_timer_.expires_after(stats_->interval());
+		stats_timer_.async_wait(boost::bind(&udp_tx::handle_stats, this, boost::asio::placeholders::error));
+	}
+	
+	if(pacer_)
+	{
+		pacer_->start(boost::bind(&udp_tx::send_paced, this, boost::placeholders::_1));
+		return;
+	}
 	
 	send_timer_.expires_after(boost::asio::chrono::milliseconds(send_interval_));
-	send_timer_.async_wait(strand_.wrap(boost::bind(&udp_tx::send_packet, this)));	
+	send_timer_.async_wait(boost::bind(&udp_tx::send_packet, this));	
 	
 }
 
 void udp_tx::send_packet()
 {
-	if(--number_of_packets_to_send_ > 0) 
+	// without an interval a batching sender fills the free part of its batch on every wake-up
+	uint32_t burst = 1;
+	if(batch_size_ > 1 && send_interval_ == 0)
+		burst = std::min<uint32_t>(batch_size_ - std::min<std::size_t>(transport_->pending(), batch_size_), number_of_packets_to_send_);
+
+	number_of_packets_to_send_ -= burst;
+	if(number_of_packets_to_send_ > 0) 
 	{
-		send_timer_.expires_after(boost::asio::chrono::milliseconds(send_interval_));
-		send_timer_.async_wait(strand_.wrap(boost::bind(&udp_tx::send_packet, this)));
+		if(burst > 0)
+		{
+			backoff_ = min_backoff;
+			send_timer_.expires_after(boost::asio::chrono::milliseconds(send_interval_));
+		}
+		else
+		{
+			// the batch is full until the socket drains, a zero interval would spin until then
+			send_timer_.expires_after(backoff_);
+			backoff_ = std::min(backoff_ * 2, max_backoff);
+		}
+		send_timer_.async_wait(boost::bind(&udp_tx::send_packet, this));
 	}
 	
-	udp_header udp;
-	udp.source_port(12345);
-	udp.destination_port(remote_end_point_port_);
-	udp.length(udp.size() + payload_size_);
-	udp.checksum(0);
-	
-	ipv4_header ip;
-	ip.version(4);
-	ip.header_length(ip.size() / 4);
-	ip.type_of_service(0);
-	ip.total_length(ip.size() + udp.length());
-	ip.identification(0);
-	ip.dont_fragment(false);
-	ip.more_fragments(false);
-	ip.fragment_offset(0);
-	ip.time_to_live(ttl_);
-	// change to get available IPv4 Endpoint !!!
-	ip.source_address(boost::asio::ip::address::from_string("192.168.178.35").to_v4());
-	ip.destination_address(boost::asio::ip::address::from_string(remote_end_point_).to_v4());
-	ip.protocol(IPPROTO_UDP);	
-	ip.calculate_checksum();
-
-	uint8_t udp_payload_[payload_size_] = {0};
-
-	boost::array<boost::asio::const_buffer, 3> buffers = {{
-		boost::asio::buffer(ip.data()),
-		boost::asio::buffer(udp.data()),
-		boost::asio::buffer(udp_payload_, sizeof(udp_payload_))
-	}};
-	
-	raw_socket_.async_send_to(buffers, 
-		raw::endpoint(boost::asio::ip::address::from_string(remote_end_point_), remote_end_point_port_),
-		boost::bind(&udp_tx::handle_send, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+	transmit(burst);
 	//timestamp_ = boost::asio::steady_timer::clock_type::now();
 
 }
 		
 
-void udp_tx::handle_send(const boost::system::error_code& error, std::size_t bytes_transferred) 
+uint32_t udp_tx::send_paced(uint32_t allowance)
 {
+	uint32_t count = std::min(allowance, number_of_packets_to_send_);
+	if(batch_size_ > 1)
+		count = std::min<uint32_t>(count, batch_size_ - std::min<std::size_t>(transport_->pending(), batch_size_));
+	
+	number_of_packets_to_send_ -= count;
+	if(number_of_packets_to_send_ == 0)
+		pacer_->stop();
+	
+	transmit(count);
+	return count;
 }
 
-		
-void udp_tx::handle_receive(const boost::system::error_code& error, std::size_t length) 
+void udp_tx::transmit(uint32_t count)
 {
-	std::cout << "packet received" << std::endl;
-	ipv4_header received_ipv4_header_1, received_ipv4_header_2;
-	icmp_header received_icmp_header;
-	udp_header received_udp_header;
-	
-	receive_buffer_.commit(length);
-
-	// debug(receive_buffer_, length);
+	for(uint32_t i = 0; i < count; ++i)
+	{
+		// only the identification changes between packets
+		packet_.identification(tracker_.next(boost::asio::chrono::steady_clock::now(), packet_.size()));
+		transport_->send(packet_.data(), packet_.size());
+	}
+}
 
-	std::istream is(&receive_buffer_);
-	
-	
-	receive_socket_.async_receive(receive_buffer_.prepare(65536), 
-		boost::bind(&udp_tx::handle_receive, this, boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
-	
+void udp_tx::handle_receive(const received_datagram* datagrams, std::size_t count)
+{
+	// stamps of the packets answered in this batch may still wait in the error queue
+	if(send_stamps_)
+		send_stamps_->read();
 	
+	for(std::size_t i = 0; i < count; ++i)
+		handle_reply(datagrams[i].data, datagrams[i].length, datagrams[i].received_at);
+}
+		
+void udp_tx::handle_reply(const uint8_t* data, std::size_t length, boost::asio::chrono::steady_clock::time_point now) 
+{
+	log_trace("packet received, {} bytes", length);
+
+	ipv4_header_view received_ipv4_header_1(data, length);
+	ipv4_header_view received_ipv4_header_2;
+	icmp_header_view received_icmp_header;
+	udp_header_view received_udp_header;
 	
-	is >> received_ipv4_header_1;
-	if(received_ipv4_header_1.protocol() == ipv4_header::protocol::icmp) 
+	if(received_ipv4_header_1.valid() && received_ipv4_header_1.protocol() == ipv4_header::protocol::icmp) 
 	{
-		is >> received_icmp_header >> received_ipv4_header_2;
-		if(received_ipv4_header_2.protocol() == ipv4_header::protocol::udp)
-			is >> received_udp_header;
+		received_icmp_header = icmp_header_view(received_ipv4_header_1.payload(), received_ipv4_header_1.payload_length());
+		if(received_icmp_header.valid())
+			received_ipv4_header_2 = ipv4_header_view(received_icmp_header.payload(), received_icmp_header.payload_length());
+		if(received_ipv4_header_2.valid() && received_ipv4_header_2.protocol() == ipv4_header::protocol::udp)
+			received_udp_header = udp_header_view(received_ipv4_header_2.payload(), received_ipv4_header_2.payload_length());
 	}
-	/*
-	int qq;
-	std::cin >> qq;
-	*/
 			
-	if (is && (received_icmp_header.type() == icmp_header::time_exceeded || received_icmp_header.type() == icmp_header::destination_unreachable) && (received_udp_header.source_port() == 12345)) // && received_udp_header.destination_port() == remote_end_point_port_)) 
+	if (received_udp_header.valid() && (received_icmp_header.type() == icmp_header::time_exceeded || received_icmp_header.type() == icmp_header::destination_unreachable) && (received_udp_header.source_port() == source_port_)) // && received_udp_header.destination_port() == remote_end_point_port_)) 
 	{
-		boost::asio::chrono::steady_clock::time_point now = boost::asio::chrono::steady_clock::now();
-		boost::asio::chrono::steady_clock::duration elapsed = now - now;// - timestamp_;
-		std::cout << +ttl_ << ": " 
-			<< received_ipv4_header_1.source_address().to_string()
-			<< ", time = "
-			<< boost::asio::chrono::duration_cast<boost::asio::chrono::milliseconds>(elapsed).count()
-			<< std::endl;
+		boost::asio::chrono::steady_clock::duration elapsed;
+		if(tracker_.reply(received_ipv4_header_2.identification(), now, elapsed))
+			log_debug("{}: {}, time = {}", ttl_, received_ipv4_header_1.source_address(), boost::asio::chrono::duration_cast<boost::asio::chrono::milliseconds>(elapsed).count());
 	
 		//receive_timeout_.cancel();
 	}
 	
 	//retries_ = 0;
-	
-
 }
 		
+
+void udp_tx::handle_send_stamp(const ipv4_header_view& sent, boost::asio::chrono::steady_clock::time_point sent_at)
+{
+	udp_header_view udp(sent.payload(), sent.payload_length());
+	if(sent.protocol() == ipv4_header::protocol::udp && udp.valid() && udp.source_port() == source_port_)
+		tracker_.restamp(sent.identification(), sent_at);
+}
+
+void udp_tx::handle_stats(const boost::system::error_code& error)
+{
+	if(error)
+		return;
+	
+	tracker_.expire(boost::asio::chrono::steady_clock::now());
+	if(!finished_ && number_of_packets_to_send_ == 0 && tracker_.idle())
+	{
+		// every packet got its reply or was given up on, nothing is left to wait for
+		finished_ = true;
+		transport_->stop();
+		if(send_stamps_)
+			send_stamps_->stop();
+		stats_->finish_flow();
+	}
+	
+	// the first flow reports for all of them until the last one is done
+	if(reporter_)
+	{
+		bool done = stats_->finished();
+		stats_->report(std::cout, done);
+		if(done)
+			return;
+	}
+	else if(finished_)
+		return;
+	
+	stats_timer_.expires_after(stats_->interval());
+	stats_timer_.async_wait(boost::bind(&udp_tx::handle_stats, this, boost::asio::placeholders::error));
+}
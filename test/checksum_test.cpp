@@ -0,0 +1,110 @@
+#include <test.hpp>
+
+#include <vector>
+#include <boost/random.hpp>
+#include <checksum.hpp>
+
+namespace
+{
+	const checksum_kernel kernels[] = { checksum_scalar, checksum_sse2, checksum_avx2 };
+
+	///@brief The sum as rfc1071 writes it down, big-endian words one by one, the odd byte padded with zero.
+	uint32_t reference_add(const uint8_t* data, std::size_t length, uint32_t sum = 0)
+	{
+		uint64_t wide = sum;
+		for(std::size_t i = 0; i + 1 < length; i += 2)
+			wide += static_cast<uint32_t>(data[i]) << 8 | data[i + 1];
+		if(length % 2 == 1)
+			wide += static_cast<uint32_t>(data[length - 1]) << 8;
+		while(wide >> 16)
+			wide = (wide & 0xFFFF) + (wide >> 16);
+		return static_cast<uint32_t>(wide);
+	}
+
+	///@brief Every kernel against the reference, for all lengths up to a few vectors at every alignment.
+	void kernels_match_reference(const std::vector<uint8_t>& buffer)
+	{
+		for(std::size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k)
+		{
+			if(!checksum_supported(kernels[k]))
+				continue;
+			for(std::size_t offset = 0; offset < 32; ++offset)
+			{
+				for(std::size_t length = 0; offset + length <= buffer.size() && length <= 300; ++length)
+				{
+					const uint8_t* data = &buffer[0] + offset;
+					CHECK(checksum_add_on(kernels[k], data, length) == reference_add(data, length));
+				}
+			}
+		}
+	}
+
+	void random_buffers()
+	{
+		boost::random::mt19937 generator(1071);
+		std::vector<uint8_t> buffer(400);
+		for(std::size_t i = 0; i < buffer.size(); ++i)
+			buffer[i] = static_cast<uint8_t>(generator());
+		kernels_match_reference(buffer);
+	}
+
+	void all_ones()
+	{
+		// every word is 0xFFFF, the sum carries on every add
+		std::vector<uint8_t> buffer(400, 0xFF);
+		kernels_match_reference(buffer);
+	}
+
+	void long_buffers()
+	{
+		// more 32-bit words than a 32-bit sum holds without overflow in its upper half
+		boost::random::mt19937 generator(768);
+		std::vector<uint8_t> buffer(65536 + 7);
+		for(std::size_t i = 0; i < buffer.size(); ++i)
+			buffer[i] = static_cast<uint8_t>(i % 3 == 0 ? 0xFF : generator());
+		for(std::size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k)
+		{
+			if(!checksum_supported(kernels[k]))
+				continue;
+			for(std::size_t offset = 0; offset < 4; ++offset)
+				CHECK(checksum_add_on(kernels[k], &buffer[0] + offset, buffer.size() - offset) == reference_add(&buffer[0] + offset, buffer.size() - offset));
+		}
+	}
+
+	void chained_sums()
+	{
+		// even parts, then an odd last one, carry the running sum like udp_checksum does with the pseudo header
+		boost::random::mt19937 generator(768);
+		std::vector<uint8_t> buffer(301);
+		for(std::size_t i = 0; i < buffer.size(); ++i)
+			buffer[i] = static_cast<uint8_t>(generator());
+		for(std::size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k)
+		{
+			if(!checksum_supported(kernels[k]))
+				continue;
+			for(std::size_t split = 0; split < buffer.size(); split += 2)
+			{
+				uint32_t sum = checksum_add_on(kernels[k], &buffer[0], split, 0xFFFE);
+				sum = checksum_add_on(kernels[k], &buffer[0] + split, buffer.size() - split, sum);
+				CHECK(sum == reference_add(&buffer[0], buffer.size(), 0xFFFE));
+			}
+		}
+	}
+
+	void selected_kernel()
+	{
+		boost::random::mt19937 generator(1624);
+		std::vector<uint8_t> buffer(1501);
+		for(std::size_t i = 0; i < buffer.size(); ++i)
+			buffer[i] = static_cast<uint8_t>(generator());
+		// odd lengths from an odd address, as the payload of a packet may start
+		for(std::size_t length = 0; length < buffer.size(); length += 13)
+			CHECK(checksum_add(&buffer[0] + 1, length) == reference_add(&buffer[0] + 1, length));
+	}
+
+	TEST("checksum kernels on random data", random_buffers);
+	TEST("checksum kernels on all ones", all_ones);
+	TEST("checksum kernels on long buffers", long_buffers);
+	TEST("checksum kernels chained", chained_sums);
+	TEST("checksum selected kernel", selected_kernel);
+}
@@ -0,0 +1,198 @@
+#include <test.hpp>
+
+#include <algorithm>
+#include <vector>
+#include <boost/asio.hpp>
+#include <incremental_trace.h>
+
+namespace
+{
+	const uint32_t destination = 1000;
+	const uint8_t max_ttl = 30;
+
+	/// @brief Runs an incremental_trace against the path the network has now.
+	///
+	/// Every probe is answered at once by the hop at its TTL, 0 stands for a
+	/// silent hop, beyond the end of the path the destination answers.
+	struct network
+	{
+		explicit network(const std::vector<uint32_t>& hops) :
+			path(hops),
+			probes(0)
+		{
+		}
+
+		uint32_t at(uint8_t ttl) const
+		{
+			return ttl <= path.size() ? path[ttl - 1] : destination;
+		}
+
+		void run(incremental_trace& trace)
+		{
+			incremental_trace::time_point now = boost::asio::chrono::steady_clock::now();
+			std::vector<uint8_t> pending;
+			trace.start(now, pending);
+			while(!pending.empty() && !trace.done())
+			{
+				uint8_t ttl = pending.front();
+				pending.erase(pending.begin());
+				sent.push_back(ttl);
+				++probes;
+				trace.answer(ttl, at(ttl), now, pending);
+			}
+		}
+
+		bool sent_to(uint8_t ttl) const
+		{
+			return std::find(sent.begin(), sent.end(), ttl) != sent.end();
+		}
+
+		std::vector<uint32_t> path;
+		std::vector<uint8_t> sent;
+		std::size_t probes;
+	};
+
+	std::vector<uint32_t> hops(uint32_t first, std::size_t count)
+	{
+		std::vector<uint32_t> result;
+		for(std::size_t i = 0; i < count; ++i)
+			result.push_back(first + static_cast<uint32_t>(i));
+		return result;
+	}
+
+	void unchanged_path()
+	{
+		// only the sentinels are probed and every one of them agrees
+		std::vector<uint32_t> cached = hops(1, 9);
+		cached.push_back(destination);
+		network now(cached);
+		incremental_trace trace(cached, destination, max_ttl, 3);
+		now.run(trace);
+
+		CHECK(trace.done());
+		CHECK(trace.changes().empty());
+		CHECK(trace.path() == cached);
+		CHECK(now.probes == 3);
+	}
+
+	void changed_segment()
+	{
+		// hops 4 and 5 are replaced by others, from 6 on the path is the cached one
+		std::vector<uint32_t> cached = hops(1, 9);
+		cached.push_back(destination);
+		std::vector<uint32_t> current = cached;
+		current[3] = 104;
+		current[4] = 105;
+		network now(current);
+		incremental_trace trace(cached, destination, max_ttl, 2);
+		now.run(trace);
+
+		CHECK(trace.done());
+		CHECK(trace.path() == current);
+		CHECK(trace.changes().size() == 1);
+		if(trace.changes().size() == 1)
+		{
+			CHECK(trace.changes()[0].ttl == 4);
+			CHECK(trace.changes()[0].before == hops(4, 2));
+			CHECK(trace.changes()[0].after == hops(104, 2));
+		}
+		CHECK(!now.sent_to(8) && !now.sent_to(9));
+	}
+
+	void longer_path()
+	{
+		// a hop more in front of hop 3 shifts the rest of the path by one TTL
+		std::vector<uint32_t> cached = hops(1, 7);
+		cached.push_back(destination);
+		std::vector<uint32_t> current = cached;
+		current.insert(current.begin() + 2, 50);
+		network now(current);
+		incremental_trace trace(cached, destination, max_ttl, 2);
+		now.run(trace);
+
+		CHECK(trace.done());
+		CHECK(trace.path() == current);
+		CHECK(trace.changes().size() == 1);
+		if(trace.changes().size() == 1)
+		{
+			CHECK(trace.changes()[0].ttl == 3);
+			CHECK(trace.changes()[0].before.empty());
+			CHECK(trace.changes()[0].after == std::vector<uint32_t>(1, 50));
+		}
+	}
+
+	void cached_path_short_of_destination()
+	{
+		// the previous trace gave up after hop 5, now the path goes on to the destination
+		std::vector<uint32_t> cached = hops(1, 5);
+		std::vector<uint32_t> current = hops(1, 8);
+		current.push_back(destination);
+		network now(current);
+		incremental_trace trace(cached, destination, max_ttl, 2);
+		now.run(trace);
+
+		CHECK(trace.done());
+		CHECK(trace.path() == current);
+		CHECK(trace.changes().empty());
+		for(uint8_t ttl = 6; ttl <= 9; ++ttl)
+			CHECK(now.sent_to(ttl));
+		CHECK(!trace.probed(15));
+	}
+
+	void silent_beyond_cached_path()
+	{
+		// probing on from the end of the cached path stops after five silent hops in a row
+		std::vector<uint32_t> cached = hops(1, 5);
+		std::vector<uint32_t> current = cached;
+		current.resize(max_ttl, 0);
+		network now(current);
+		incremental_trace trace(cached, destination, max_ttl, 1);
+		now.run(trace);
+
+		CHECK(trace.done());
+		CHECK(trace.changes().empty());
+		CHECK(now.sent_to(10));
+		CHECK(!now.sent_to(11));
+		CHECK(trace.path().size() >= cached.size());
+		CHECK(std::equal(cached.begin(), cached.end(), trace.path().begin()));
+	}
+
+	void silent_at_max_ttl()
+	{
+		// the TTL after 255 must not wrap around to 0 and leave the trace waiting for nothing
+		std::vector<uint32_t> cached = hops(1, 254);
+		std::vector<uint32_t> current = cached;
+		current.push_back(0);
+		network now(current);
+		incremental_trace trace(cached, destination, 255, 2);
+		now.run(trace);
+
+		CHECK(trace.done());
+		CHECK(now.sent_to(255));
+		CHECK(trace.changes().empty());
+		CHECK(trace.path().size() == cached.size());
+	}
+
+	void nothing_cached()
+	{
+		// without a cached path the trace runs from TTL 1 like a plain one
+		std::vector<uint32_t> current = hops(1, 3);
+		current.push_back(destination);
+		network now(current);
+		incremental_trace trace(std::vector<uint32_t>(), destination, max_ttl, 2);
+		now.run(trace);
+
+		CHECK(trace.done());
+		CHECK(trace.path() == current);
+		for(uint8_t ttl = 1; ttl <= 4; ++ttl)
+			CHECK(trace.observed(ttl));
+	}
+
+	TEST("incremental trace of an unchanged path", unchanged_path);
+	TEST("incremental trace of a changed segment", changed_segment);
+	TEST("incremental trace of a longer path", longer_path);
+	TEST("incremental trace beyond a cached path short of the destination", cached_path_short_of_destination);
+	TEST("incremental trace gives up on silence beyond the cached path", silent_beyond_cached_path);
+	TEST("incremental trace silent at the highest TTL", silent_at_max_ttl);
+	TEST("incremental trace without a cached path", nothing_cached);
+}
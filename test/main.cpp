@@ -0,0 +1,41 @@
+#include <test.hpp>
+
+#include <cstdio>
+#include <exception>
+#include <string>
+
+// usage: routeinfo_test [filter], only tests whose name contains filter run
+int main(int argc, char* argv[])
+{
+	const char* filter = argc > 1 ? argv[1] : "";
+
+	std::size_t passed = 0;
+	std::size_t failed = 0;
+	std::vector<test::test_case>& tests = test::registry();
+	for(std::size_t i = 0; i < tests.size(); ++i)
+	{
+		const test::test_case& entry = tests[i];
+		if(entry.name.find(filter) == std::string::npos)
+			continue;
+
+		test::failures() = 0;
+		try
+		{
+			entry.function();
+		}
+		catch(const std::exception& error)
+		{
+			std::fprintf(stderr, "%s: exception: %s\n", entry.name.c_str(), error.what());
+			++test::failures();
+		}
+
+		if(test::failures() == 0)
+			++passed;
+		else
+			++failed;
+		std::printf("%s %s\n", test::failures() == 0 ? "ok  " : "FAIL", entry.name.c_str());
+		std::fflush(stdout);
+	}
+	std::printf("%u passed, %u failed\n", static_cast<unsigned>(passed), static_cast<unsigned>(failed));
+	return failed == 0 ? 0 : 1;
+}
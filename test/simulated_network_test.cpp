@@ -0,0 +1,54 @@
+#include <test.hpp>
+
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include <boost/array.hpp>
+#include <packet_template.hpp>
+#include <simulated_network.h>
+
+namespace
+{
+	///@brief Datagrams to router 1 that one network lets through its rate limit, sent with pause between every 16.
+	std::vector<bool> limited_sends(boost::asio::chrono::microseconds pause)
+	{
+		boost::asio::io_context io_context;
+		simulated_network::hop hop;
+		hop.rate = 1000;
+		hop.burst = 10;
+		hop.loss = 0.1;
+		simulated_network network(io_context, std::vector<simulated_network::hop>(3, hop), hop, 7, 10000000);
+
+		packet_template probe;
+		probe.icmp_echo(boost::asio::ip::make_address_v4("192.0.2.1"), boost::asio::ip::make_address_v4("198.51.100.1"), 1, 0, 0, 0);
+		probe.time_to_live(1);
+
+		std::vector<bool> limited;
+		for(uint16_t sequence = 0; sequence < 400; ++sequence)
+		{
+			probe.sequence_number(sequence);
+			uint64_t before = network.limited();
+			network.send(probe.data(), probe.size());
+			limited.push_back(network.limited() != before);
+			if(sequence % 16 == 15)
+				std::this_thread::sleep_for(pause);
+		}
+		return limited;
+	}
+
+	void same_sends_same_limits()
+	{
+		// the host taking its time between the sends must not refill the buckets
+		std::vector<bool> fast = limited_sends(boost::asio::chrono::microseconds(0));
+		std::vector<bool> slow = limited_sends(boost::asio::chrono::microseconds(2000));
+		CHECK(fast == slow);
+
+		std::size_t count = 0;
+		for(std::size_t i = 0; i < fast.size(); ++i)
+			count += fast[i] ? 1 : 0;
+		// 10 Mbit/s carry the 400 datagrams of 28 bytes in 9 ms, room for the burst and 9 more
+		CHECK(count > 300 && count < 390);
+	}
+
+	TEST("simulated network rate limits on simulated time", same_sends_same_limits);
+}
@@ -0,0 +1,63 @@
+#ifndef TEST_TEST
+#define TEST_TEST
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <boost/function.hpp>
+
+/*
+	Unit tests
+
+	A test is a function that checks what a unit does without sockets or
+	privileges. CHECK records a failed condition with its place and lets the
+	test go on, so one run shows every difference. The runner reports each
+	test and fails if any check did.
+*/
+
+namespace test
+{
+	typedef boost::function<void()> function_type;
+
+	struct test_case
+	{
+		std::string name;
+		function_type function;
+	};
+
+	inline std::vector<test_case>& registry()
+	{
+		static std::vector<test_case> tests;
+		return tests;
+	}
+
+	///@brief Failed checks of the test running.
+	inline std::size_t& failures()
+	{
+		static std::size_t count = 0;
+		return count;
+	}
+
+	///@brief Registers a test at static initialization, one per translation unit and name.
+	struct registrar
+	{
+		registrar(const char* name, function_type function)
+		{
+			test_case entry = { name, function };
+			registry().push_back(entry);
+		}
+	};
+
+	inline void fail(const char* file, int line, const std::string& condition)
+	{
+		std::cerr << file << ":" << line << ": check failed: " << condition << std::endl;
+		++failures();
+	}
+}
+
+#define TEST_CONCAT_(a, b) a##b
+#define TEST_CONCAT(a, b) TEST_CONCAT_(a, b)
+#define TEST(name, function) static test::registrar TEST_CONCAT(test_registrar_, __LINE__)(name, function)
+#define CHECK(condition) do { if(!(condition)) test::fail(__FILE__, __LINE__, #condition); } while(false)
+
+#endif